@@ -49,10 +49,19 @@ void train_classifier(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
     int classes = option_find_int(options, "classes", 2);
 
     char **labels = get_labels(label_list);
-    list *plist = get_paths(train_list);
-    char **paths = (char **)list_to_array(plist);
-    printf("%d\n", plist->size);
-    int N = plist->size;
+    list *plist = 0;
+    char **paths = 0;
+    dataset_shard *shard = 0;
+    int N;
+    if(is_dataset_shard(train_list)){
+        shard = load_dataset_shard(train_list);
+        N = dataset_shard_size(shard);
+    } else {
+        plist = get_paths(train_list);
+        paths = (char **)list_to_array(plist);
+        N = plist->size;
+    }
+    printf("%d\n", N);
     double time;
 
     load_args args = {0};
@@ -71,6 +80,7 @@ void train_classifier(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
     args.size = net.w;
 
     args.paths = paths;
+    args.shard = shard;
     args.classes = classes;
     args.n = imgs;
     args.m = N;
@@ -78,18 +88,13 @@ void train_classifier(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
     args.type = CLASSIFICATION_DATA;
 
     data train;
-    data buffer;
-    pthread_t load_thread;
-    args.d = &buffer;
-    load_thread = load_data(args);
+    data_loader *loader = make_data_loader(args, 3);
 
     int epoch = (*net.seen)/N;
     while(get_current_batch(net) < net.max_batches || net.max_batches == 0){
         time = what_time_is_it_now();
 
-        pthread_join(load_thread, 0);
-        train = buffer;
-        load_thread = load_data(args);
+        train = data_loader_next(loader);
 
         printf("Loaded: %lf seconds\n", what_time_is_it_now()-time);
         time = what_time_is_it_now();
@@ -107,7 +112,6 @@ void train_classifier(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
         if(avg_loss == -1) avg_loss = loss;
         avg_loss = avg_loss*.9 + loss*.1;
         printf("%ld, %.3f: %f, %f avg, %f rate, %lf seconds, %ld images\n", get_current_batch(net), (float)(*net.seen)/N, loss, avg_loss, get_current_rate(net), what_time_is_it_now()-time, *net.seen);
-        free_data(train);
         if(*net.seen/N > epoch){
             epoch = *net.seen/N;
             char buff[256];
@@ -124,10 +128,15 @@ void train_classifier(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
     sprintf(buff, "%s/%s.weights", backup_directory, base);
     save_weights(net, buff);
 
+    free_data_loader(loader);
     free_network(net);
     free_ptrs((void**)labels, classes);
-    free_ptrs((void**)paths, plist->size);
-    free_list(plist);
+    if(shard){
+        free_dataset_shard(shard);
+    } else {
+        free_ptrs((void**)paths, plist->size);
+        free_list(plist);
+    }
     free(base);
 }
 
@@ -364,6 +364,20 @@ void denormalize_net(char *cfgfile, char *weightfile, char *outfile)
     save_weights(net, outfile);
 }
 
+void pack_net(char *cfgfile, char *weightfile, char *outfile)
+{
+    gpu_index = -1;
+    network net = parse_network_cfg_inference(cfgfile);
+    load_weights(&net, weightfile);
+    int i;
+    for (i = 0; i < net.n; ++i) {
+        if (net.layers[i].type == CONVOLUTIONAL) {
+            fold_convolutional_batchnorm(&net.layers[i]);
+        }
+    }
+    save_packed_weights(net, outfile);
+}
+
 void mkimg(char *cfgfile, char *weightfile, int h, int w, int num, char *prefix)
 {
     network net = load_network(cfgfile, weightfile, 0);
@@ -488,12 +502,24 @@ int main(int argc, char **argv)
         statistics_net(argv[2], argv[3]);
     } else if (0 == strcmp(argv[1], "normalize")){
         normalize_net(argv[2], argv[3], argv[4]);
+    } else if (0 == strcmp(argv[1], "pack")){
+        pack_net(argv[2], argv[3], argv[4]);
+    } else if (0 == strcmp(argv[1], "shard")){
+        pack_dataset_shard(argv[2], argv[3], (argc > 4) ? atoi(argv[4]) : 0);
     } else if (0 == strcmp(argv[1], "rescale")){
         rescale_net(argv[2], argv[3], argv[4]);
     } else if (0 == strcmp(argv[1], "ops")){
         operations(argv[2]);
     } else if (0 == strcmp(argv[1], "speed")){
         speed(argv[2], (argc > 3 && argv[3]) ? atoi(argv[3]) : 0);
+    } else if (0 == strcmp(argv[1], "gemm")){
+        int m = (argc > 2) ? atoi(argv[2]) : 512;
+        int k = (argc > 3) ? atoi(argv[3]) : m;
+        int n = (argc > 4) ? atoi(argv[4]) : m;
+        time_random_matrix(0, 0, m, k, n);
+        time_random_matrix(1, 0, m, k, n);
+        time_random_matrix(0, 1, m, k, n);
+        time_random_matrix(1, 1, m, k, n);
     } else if (0 == strcmp(argv[1], "oneoff")){
         oneoff(argv[2], argv[3], argv[4]);
     } else if (0 == strcmp(argv[1], "oneoff2")){
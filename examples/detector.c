@@ -36,31 +36,33 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
   int imgs = net.batch * net.subdivisions * ngpus;
   printf("Learning Rate: %g, Momentum: %g, Decay: %g\n", net.learning_rate,
          net.momentum, net.decay);
-  data train, buffer;
+  data train;
 
   layer l = net.layers[net.n - 1];
 
   int classes = l.classes;
   float jitter = l.jitter;
 
-  list *plist = get_paths(train_images);
-  // int N = plist->size;
-  char **paths = (char **)list_to_array(plist);
-
   load_args args = get_base_args(net);
+  if (is_dataset_shard(train_images)) {
+    args.shard = load_dataset_shard(train_images);
+    args.m = dataset_shard_size(args.shard);
+  } else {
+    list *plist = get_paths(train_images);
+    // int N = plist->size;
+    args.paths = (char **)list_to_array(plist);
+    args.m = plist->size;
+  }
   args.coords = l.coords;
-  args.paths = paths;
   args.n = imgs;
-  args.m = plist->size;
   args.classes = classes;
   args.jitter = jitter;
   args.num_boxes = l.max_boxes;
-  args.d = &buffer;
   args.type = DETECTION_DATA;
   // args.type = INSTANCE_DATA;
   args.threads = 8;
 
-  pthread_t load_thread = load_data(args);
+  data_loader *loader = make_data_loader(args, 3);
   clock_t time;
   int count = 0;
   // while(i*imgs < N*120){
@@ -72,13 +74,7 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
         dim = 608;
       // int dim = (rand() % 4 + 16) * 32;
       printf("%d\n", dim);
-      args.w = dim;
-      args.h = dim;
-
-      pthread_join(load_thread, 0);
-      train = buffer;
-      free_data(train);
-      load_thread = load_data(args);
+      data_loader_resize(loader, dim, dim);
 
       for (i = 0; i < ngpus; ++i) {
         resize_network(nets + i, dim, dim);
@@ -86,9 +82,7 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
       net = nets[0];
     }
     time = clock();
-    pthread_join(load_thread, 0);
-    train = buffer;
-    load_thread = load_data(args);
+    train = data_loader_next(loader);
 
     /*
     int k;
@@ -153,8 +147,10 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
       sprintf(buff, "%s/%s_%d.weights", backup_directory, base, i);
       save_weights(net, buff);
     }
-    free_data(train);
   }
+  free_data_loader(loader);
+  if (args.shard)
+    free_dataset_shard(args.shard);
 #ifdef GPU
   if (ngpus != 1)
     sync_nets(nets, ngpus, 0);
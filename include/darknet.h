@@ -102,6 +102,10 @@ typedef enum {
 
 typedef enum { SSE, MASKED, L1, SEG, SMOOTH } COST_TYPE;
 
+struct resize_plan_cache;
+
+typedef enum { YUV_NV12, YUV_I420 } YUV_FORMAT;
+
 typedef struct {
   int batch;
   float learning_rate;
@@ -238,6 +242,7 @@ struct layer {
 
   float *delta;
   float *output;
+  float *activated; /* 推理时 region 层激活后的输出, 见 defer_network_region_activation */
   float *squared;
   float *norms;
 
@@ -250,6 +255,11 @@ struct layer {
   float *expand_a;
   float *expand_b;
 
+  int winograd;
+  float *winograd_weights;
+  float *conv1x1_weights;
+  int fuse_maxpool;
+
   float *rolling_mean;
   float *rolling_variance;
 
@@ -419,6 +429,7 @@ struct layer {
 };
 
 void free_layer(layer);
+void free_layer_train_state(layer *l);
 
 typedef enum {
   CONSTANT,
@@ -485,6 +496,12 @@ typedef struct network {
   int index;
   float *cost;
 
+  float *arena;
+  size_t arena_size;
+  void *weights_map;
+  size_t weights_map_size;
+  int shared_weights;
+
 #ifdef GPU
   float *input_gpu;
   float *truth_gpu;
@@ -494,6 +511,7 @@ typedef struct network {
 
 #ifdef NNPACK
   pthreadpool_t threadpool;
+  struct resize_plan_cache *resize_plans;
 #endif
 
 } network;
@@ -551,6 +569,8 @@ typedef enum {
   INSTANCE_DATA
 } data_type;
 
+typedef struct dataset_shard dataset_shard;
+
 typedef struct load_args {
   int threads;
   char **paths;
@@ -582,6 +602,7 @@ typedef struct load_args {
   image *resized;
   data_type type;
   tree *hierarchy;
+  dataset_shard *shard;
 } load_args;
 
 typedef struct {
@@ -609,6 +630,18 @@ typedef struct list {
 } list;
 
 pthread_t load_data(load_args args);
+
+typedef struct data_loader data_loader;
+data_loader *make_data_loader(load_args args, int depth);
+data data_loader_next(data_loader *loader);
+void data_loader_resize(data_loader *loader, int w, int h);
+void free_data_loader(data_loader *loader);
+
+void pack_dataset_shard(char *listfile, char *filename, int max_side);
+dataset_shard *load_dataset_shard(char *filename);
+void free_dataset_shard(dataset_shard *shard);
+int dataset_shard_size(dataset_shard *shard);
+int is_dataset_shard(char *filename);
 list *read_data_cfg(char *filename);
 list *read_cfg(char *filename);
 
@@ -645,6 +678,8 @@ void sync_nets(network *nets, int n, int interval);
 void harmless_update_network_gpu(network net);
 #endif
 void save_image_png(image im, const char *name);
+void save_image_data(const unsigned char *data, int w, int h, int c,
+                     const char *name);
 void get_next_batch(data d, int n, int offset, float *X, float *y);
 void grayscale_image_3c(image im);
 void normalize_image(image p);
@@ -664,6 +699,8 @@ image make_random_image(int w, int h, int c);
 
 void denormalize_connected_layer(layer l);
 void denormalize_convolutional_layer(layer l);
+void fold_convolutional_batchnorm(layer *l);
+void fold_convolutional_batchnorm_layer(layer *l, layer *bn);
 void statistics_connected_layer(layer l);
 void rescale_weights(layer l, float scale, float trans);
 void rgbgr_weights(layer l);
@@ -680,8 +717,12 @@ char *option_find_str(list *l, char *key, char *def);
 int option_find_int(list *l, char *key, int def);
 
 network parse_network_cfg(char *filename);
+network parse_network_cfg_inference(char *filename);
+network parse_network_cfg_inference_batch(char *filename, int batch);
 void save_weights(network net, char *filename);
 void load_weights(network *net, char *filename);
+void save_packed_weights(network net, char *filename);
+int load_packed_weights(network *net, char *filename);
 void save_weights_upto(network net, char *filename, int cutoff);
 void load_weights_upto(network *net, char *filename, int start, int cutoff);
 
@@ -692,6 +733,11 @@ void get_region_boxes(layer l, int w, int h, int netw, int neth, float thresh,
                       int relative);
 void free_network(network net);
 void set_batch_network(network *net, int b);
+void plan_network_memory(network *net);
+void fold_network_batchnorm(network *net);
+void fuse_network_maxpool(network *net);
+void defer_network_region_activation(network *net);
+int clone_network_context(const network *net, network *ctx);
 void set_temp_network(network net, float t);
 image load_image(char *filename, int w, int h, int c);
 #ifdef NNPACK
@@ -704,7 +750,24 @@ image resize_image(image im, int w, int h);
 image letterbox_image(image im, int w, int h);
 #ifdef NNPACK
 image letterbox_image_thread(image im, int w, int h, pthreadpool_t threadpool);
+void letterbox_image_into_thread(image im, int w, int h, image boxed,
+                                 struct resize_plan_cache *plans,
+                                 pthreadpool_t threadpool);
+void letterbox_image_data_into_thread(const unsigned char *data, int w, int h,
+                                      int c, image boxed,
+                                      struct resize_plan_cache *plans,
+                                      pthreadpool_t threadpool);
+void load_image_letterbox_thread(char *filename, image boxed, int *w, int *h,
+                                 struct resize_plan_cache *plans,
+                                 pthreadpool_t threadpool);
+int letterbox_yuv_into_thread(const unsigned char *data, int w, int h,
+                              YUV_FORMAT format, image boxed,
+                              struct resize_plan_cache *plans,
+                              pthreadpool_t threadpool);
 #endif
+unsigned char *load_image_data(char *filename, int *w, int *h, int c);
+void letterbox_image_data_into(const unsigned char *data, int w, int h, int c,
+                               image boxed);
 image crop_image(image im, int dx, int dy, int w, int h);
 image resize_min(image im, int min);
 image threshold_image(image im, float thresh);
@@ -736,6 +799,7 @@ void fill_image(image m, float s);
 image grayscale_image(image im);
 void rotate_image_cw(image im, int times);
 double what_time_is_it_now();
+void time_random_matrix(int TA, int TB, int m, int k, int n);
 image rotate_image(image m, float rad);
 void visualize_network(network net);
 float box_iou(box a, box b);
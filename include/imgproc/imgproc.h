@@ -19,7 +19,9 @@ extern "C" {
 typedef uint32_t bool_t;
 typedef float float_t;
 
+#ifndef NULL
 #define NULL 0
+#endif
 /*
 #define M_PI 3.14159265358979323846
 #define M_PI_4 (M_PI / 4)
@@ -46,15 +48,21 @@ enum image_type {
    * BGR
    * YUV
    * WHCF   长宽顺序优先，通道依次排列， 像素类型为浮点类型
+   * NV12   YUV 420, Y 平面后为 UV 交错排列的半分辨率平面
+   * I420   YUV 420, Y 平面后依次为半分辨率的 U 平面和 V 平面
    */
   PIXEL_RGB = 1,
   PIXEL_BGR = (1 << 1),
   PIXEL_YUV = (1 << 3),
   PIXEL_WHCF = (1 << 4),
+  PIXEL_NV12 = (1 << 5),
+  PIXEL_I420 = (1 << 6),
 
   PIXEL_RGB2WHCF = PIXEL_RGB | (PIXEL_WHCF << PIXEL_CONVERT_SHIFT),
   PIXEL_BGR2WHCF = PIXEL_BGR | (PIXEL_WHCF << PIXEL_CONVERT_SHIFT),
   PIXEL_YUV2WHCF = PIXEL_YUV | (PIXEL_WHCF << PIXEL_CONVERT_SHIFT),
+  PIXEL_NV122WHCF = PIXEL_NV12 | (PIXEL_WHCF << PIXEL_CONVERT_SHIFT),
+  PIXEL_I4202WHCF = PIXEL_I420 | (PIXEL_WHCF << PIXEL_CONVERT_SHIFT),
 };
 
 /* Main image structure */
@@ -82,6 +90,13 @@ void image_create(struct image_t *img, uint16_t w, uint16_t h, uint16_t c,
 void image_copy(struct image_t *input, struct image_t *output);
 void image_free(struct image_t *img);
 
+/**
+ * @brief  目标图像是否为 WHCF 浮点图像, 包括 PIXEL_RGB2WHCF, PIXEL_BGR2WHCF
+ * @param  type:
+ * @retval 1 是, 0 否
+ */
+bool_t image_is_whcf(enum image_type type);
+
 /**
  * @brief  图像缩放参数，用于反复使用
  */
@@ -121,6 +136,14 @@ struct resize_params {
    */
   short *ialpha;
   short *ibeta;
+
+  /**
+   * YUV 420 色度平面 (宽高减半) 的坐标及变换参数, 坐标为色度平面中的像素位置
+   */
+  int *cxofs;
+  int *cyofs;
+  short *calpha;
+  short *cbeta;
 };
 
 /**
@@ -136,6 +159,19 @@ struct resize_params {
 void resize_params_create(struct resize_params *resize, uint16_t w, uint16_t h,
                           uint16_t src_w, uint16_t src_h);
 
+/**
+ * @brief  创建首尾像素对齐的变换参数, 采样位置与 darknet 的 resize_image 相同
+ * @note   用于网络输入的预处理, 使结果与训练时的 letterbox_image 一致
+ * @param  resize:
+ * @param  w:
+ * @param  h:
+ * @param  src_w:
+ * @param  src_h:
+ * @retval None
+ */
+void resize_params_create_aligned(struct resize_params *resize, uint16_t w,
+                                  uint16_t h, uint16_t src_w, uint16_t src_h);
+
 /**
  * @brief  释放变换参数
  * @note
@@ -144,9 +180,70 @@ void resize_params_create(struct resize_params *resize, uint16_t w, uint16_t h,
  */
 void resize_params_free(struct resize_params *resize);
 
+/**
+ * @brief  缓存的缩放参数个数, 视频推理时源图像大小通常只有一两种
+ */
+#define RESIZE_PLAN_CACHE_SIZE 4
+
+/**
+ * @brief  按 (src_w, src_h, w, h) 缓存的缩放参数及缩放用的临时缓冲区
+ * @note   缓存命中时预处理不再申请内存, 不是线程安全的, 每个推理上下文一个
+ */
+struct resize_plan_cache {
+  struct resize_params plans[RESIZE_PLAN_CACHE_SIZE];
+
+  /**
+   * 最近一次使用的序号, 0 表示未使用, 缓存满时替换最久未使用的参数
+   */
+  uint32_t last_use[RESIZE_PLAN_CACHE_SIZE];
+  uint32_t tick;
+
+  /**
+   * 临时缓冲区, 只增大不缩小
+   */
+  void *scratch;
+  size_t scratch_size;
+};
+
+/**
+ * @brief  创建缩放参数缓存
+ * @retval 缓存对象, 使用 resize_plan_cache_free 释放
+ */
+struct resize_plan_cache *resize_plan_cache_create();
+
+/**
+ * @brief  释放缩放参数缓存及其中的全部参数
+ * @param  *cache:
+ * @retval None
+ */
+void resize_plan_cache_free(struct resize_plan_cache *cache);
+
+/**
+ * @brief  取得缩放参数, 缓存中没有时由 resize_params_create_aligned 创建
+ * @note   返回的参数由缓存持有, 不要调用 resize_params_free
+ * @param  *cache:
+ * @param  w: 缩放后图像宽度
+ * @param  h: 缩放后图像高度
+ * @param  src_w: 缩放前图像宽度
+ * @param  src_h: 缩放前图像高度
+ * @retval 缩放参数
+ */
+struct resize_params *resize_plan_cache_get(struct resize_plan_cache *cache,
+                                            uint16_t w, uint16_t h,
+                                            uint16_t src_w, uint16_t src_h);
+
+/**
+ * @brief  取得至少 size 字节的临时缓冲区
+ * @note   再次调用后之前返回的缓冲区失效
+ * @param  *cache:
+ * @param  size:
+ * @retval 缓冲区, 申请失败时为 NULL
+ */
+void *resize_plan_cache_scratch(struct resize_plan_cache *cache, size_t size);
+
 /**
  * 从RGB，BGR,YUV格式内容设置WHC图片的内容
- * 图片大小由img 指定
+ * 图片大小由img 指定, YUV 数据的格式见 image_data_from_yuv_resize
  */
 bool_t image_data_from_rgb(struct image_t *img, const void *data);
 bool_t image_data_from_bgr(struct image_t *img, const void *data);
@@ -262,7 +359,9 @@ void rgb_resize_embed_thread_neon(void *params, size_t index);
 /**
  * @brief   先改变图像大小和目标图像一致，嵌入指定目标图像，缓冲区数据格式为rgb,
  * 通过线程池完成
- * @note
+ * @note   img 为 PIXEL_WHCF 或 PIXEL_RGB2WHCF 时 data 按 RGB 排列,
+ *         PIXEL_BGR2WHCF 时按 BGR 排列, 输出均为 R, G, B 平面;
+ *         嵌入区域以外填 .5, 与 letterbox_image 一致. 源图像宽高至少为 2
  * @param  *img: 目标图像
  * @param  *resize:  变换参数
  * @param  *data:  原始数据
@@ -290,7 +389,9 @@ bool_t image_data_from_bgr_resize(struct image_t *img,
 
 /**
 * @brief  先改变图像大小和目标图像一致，然后再设置缓冲区，缓冲区数据格式为yuv
-* @note
+* @note   img 的类型为 PIXEL_NV122WHCF 或 PIXEL_I4202WHCF, 表示 data 为 NV12
+*         或 I420 数据; 颜色转换按 BT.601 (16-235) 与缩放在同一次计算中完成,
+*         输出 R, G, B 平面. 源图像宽高为不小于 4 的偶数
 * @param  *img: 目标图像
 * @param  *resize: 改变参数
 * @param  *data:  原始图像数据
@@ -300,6 +401,31 @@ bool_t image_data_from_yuv_resize(struct image_t *img,
                                   struct resize_params *resize,
                                   const void *data);
 
+/**
+* @brief  YUV 420 缩放线程函数，单个任务完成嵌入目标图像一行的计算
+* @note
+* @param  *params: 参数
+* @param  index:  第几个任务，即计算行图片数据
+* @retval None
+*/
+void yuv_resize_embed_thread(void *params, size_t index);
+
+/**
+* @brief   YUV 420 数据转换为 RGB 并缩放后嵌入目标图像, 通过线程池完成
+* @note    数据格式见 image_data_from_yuv_resize, 嵌入区域以外填 .5
+* @param  *img: 目标图像
+* @param  *resize:  变换参数
+* @param  *data:  原始数据
+* @param  box:
+* @param  threadpool: 线程池对象指针
+* @retval  是否成功 0 表示是否  1表示成功
+*/
+bool_t image_data_from_yuv_resize_embed_thread(struct image_t *img,
+                                               struct resize_params *resize,
+                                               const void *data,
+                                               struct embed_box box,
+                                               pthreadpool_t threadpool);
+
 #ifdef __cplusplus
 }
 #endif
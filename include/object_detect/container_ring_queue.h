@@ -0,0 +1,90 @@
+/*
+ * File:   container_ring_queue.h
+ *
+ * 有界无锁队列, 多生产者多消费者
+ */
+
+#ifndef CONTAINER_RING_QUEUE_H
+#define CONTAINER_RING_QUEUE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+/**
+ * 队列单元
+ */
+typedef struct {
+  /**
+   * 序号, 表示单元当前可写 (等于写位置) 或可读 (等于读位置 + 1)
+   */
+  size_t sequence;
+
+  void *data;
+} ring_queue_cell;
+
+/**
+ * 队列结构
+ * 单元数为 2 的幂, 读写位置分别由消费者及生产者用原子操作推进,
+ * 放在不同的缓存行中
+ */
+typedef struct {
+  ring_queue_cell *cells;
+  size_t mask;
+  char pad0[64];
+
+  /**
+   * 写位置
+   */
+  size_t enqueue_pos;
+  char pad1[64];
+
+  /**
+   * 读位置
+   */
+  size_t dequeue_pos;
+  char pad2[64];
+} ring_queue;
+
+/**
+ * @brief  构建队列
+ * @note   容量向上取整为 2 的幂, 使用 free_ring_queue 释放
+ * @param  capacity: 最多容纳的元素数
+ * @retval
+ */
+ring_queue create_ring_queue(int capacity);
+
+/**
+ * @brief  释放队列, 不释放队列中的元素
+ */
+void free_ring_queue(ring_queue *queue);
+
+/**
+ * @brief  尝试放入一个元素
+ * @retval 1 成功  0 队列已满
+ */
+int ring_queue_try_push(ring_queue *queue, void *data);
+
+/**
+ * @brief  尝试取出一个元素
+ * @retval 1 成功  0 队列为空
+ */
+int ring_queue_try_pop(ring_queue *queue, void **data);
+
+/**
+ * @brief  放入一个元素, 队列满时等待
+ */
+void ring_queue_push(ring_queue *queue, void *data);
+
+/**
+ * @brief  取出一个元素, 队列空时等待
+ */
+void *ring_queue_pop(ring_queue *queue);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CONTAINER_RING_QUEUE_H */
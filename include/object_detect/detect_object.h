@@ -132,6 +132,64 @@ object_box_node *create_object_box_node(object_box value);
 void object_boxs_nms(linked_list *link_list, float nms);
 
 
+/**
+ * @brief  目标框数组, 按字段分别连续存放 (SoA), 用于目标较多的场景
+ * @note   使用 create_object_box_array 创建, free_object_box_array 释放
+ */
+typedef struct {
+  /**
+   * 目标个数及容量
+   */
+  int size;
+  int capacity;
+
+  /**
+   * 第 i 个目标为 x[i], y[i], w[i], h[i], prob[i], classid[i] ...
+   * 含义与 object_box 相同
+   */
+  float *x;
+  float *y;
+  float *w;
+  float *h;
+  float *prob;
+  int *classid;
+  int *anchor_x;
+  int *anchor_y;
+  int *anchor_n;
+
+  /**
+   * 极大值抑制使用的内部缓冲区
+   */
+  void *work;
+  size_t work_size;
+} object_box_array;
+
+object_box_array create_object_box_array(int capacity);
+void free_object_box_array(object_box_array *boxes);
+void object_box_array_reserve(object_box_array *boxes, int capacity);
+void object_box_array_push(object_box_array *boxes, object_box box);
+object_box object_box_array_get(const object_box_array *boxes, int i);
+
+/**
+ * @brief  数组形式的极大值抑制, 按类别分组及按概率排序后向量化计算 IOU
+ * @note   结果与 object_boxs_nms 相同, 保留的目标按概率降序排列
+ * @param  *boxes:
+ * @param  nms: 不大于 0 时只排序
+ * @retval None
+ */
+void object_box_array_nms(object_box_array *boxes, float nms);
+
+/**
+ * @brief  Gaussian soft-NMS
+ * @note   同类别目标的概率按 exp(-iou^2 / sigma) 衰减, 衰减后不超过 thresh 的
+ *         目标丢弃, 保留的目标按衰减后的概率降序排列
+ * @param  *boxes:
+ * @param  sigma:
+ * @param  thresh:
+ * @retval None
+ */
+void object_box_array_soft_nms(object_box_array *boxes, float sigma, float thresh);
+
 /**
  * @brief  目标转换矫正一次性参数，一次性完成从网络输出坐标到目标提取坐标的转换
  * @note
@@ -194,6 +252,20 @@ object_box object_box_correct(correct_param param, object_box box);
 void parse_object_boxs(layer l, correct_param param, float thresh, float nms,
                        linked_list *link_list);
 
+/**
+ * @brief  解析目标对象到数组中
+ * @note   结果与 parse_object_boxs 相同, 不使用链表, 适合目标较多的场景.
+ *         boxes 原有的内容被清除, 缓冲区在多次调用间重复使用
+ * @param  l:  region网络输出层
+ * @param  param  位置变换参数
+ * @param  thresh:
+ * @param  nms: 不大于 0 时不做极大值抑制
+ * @param  *boxes: 保留的目标, 按概率降序排列
+ * @retval None
+ */
+void parse_object_boxs_array(layer l, correct_param param, float thresh,
+                             float nms, object_box_array *boxes);
+
 #ifdef __cplusplus
 }
 #endif
@@ -15,21 +15,61 @@ extern "C" {
 
 #include <darknet.h>
 #include "utils.h"
+#include "object_detect/detect_object.h"
+
+    /**
+     * 网络加载方式
+     */
+    typedef enum {
+        NETWORK_LOAD_FULL,      /* 完整构造, 可用于训练 */
+        NETWORK_LOAD_INFERENCE  /* 只用于推理, 不分配训练缓冲区, 权重可以是 darknet pack 生成的打包文件 */
+    } network_load_mode;
 
     /**
      * 初始化网络
      * @param cfgfile
      * @param weightfile
      * @param threadsize
+     * @param mode NETWORK_LOAD_INFERENCE 时需要 weightfile, 加载后合并批归一化及池化并规划输出内存;
+     *             否则按 NETWORK_LOAD_FULL 加载, 保留训练缓冲区, 不做内存规划
      * @return 
      */
-    network network_init(const char *cfgfile, const char *weightfile, int threadsize);
+    network network_init(const char *cfgfile, const char *weightfile, int threadsize, network_load_mode mode);
+
+    /**
+     * 初始化网络, 一次前向计算 batch 张图片
+     * 各层的输出, workspace 及内存规划都按 batch 分配, 用于 detect_objects_batch
+     * @param cfgfile
+     * @param weightfile
+     * @param threadsize
+     * @param mode NETWORK_LOAD_FULL 时 batch 不超过 cfg 中的 batch
+     * @param batch
+     * @return 
+     */
+    network network_init_batch(const char *cfgfile, const char *weightfile, int threadsize, network_load_mode mode, int batch);
     
     /**
      * 释放网络
      * @param net
      */
     void network_release(network *net);
+
+    /**
+     * 创建与 net 共用权重的推理上下文, 用于多线程同时推理, 只占用一份权重内存
+     * 每个上下文有各自的输出缓冲区, workspace 及线程池, 一个上下文同一时刻只能
+     * 在一个线程中使用. net 需要在所有上下文释放之后再释放
+     * @param net network_init 加载的网络
+     * @param threadsize 上下文线程池的线程数
+     * @param ctx 创建的上下文
+     * @return 0 成功, 1 网络含有不能共用的层 (rnn/gru/lstm 等)
+     */
+    int network_context_create(network *net, int threadsize, network *ctx);
+
+    /**
+     * 释放推理上下文, 不释放共用的权重
+     * @param ctx
+     */
+    void network_context_release(network *ctx);
     
     /**
      * 加载图片
@@ -65,15 +105,92 @@ extern "C" {
     int detect_object(network * net, image im, float thresh, float hier_thresh, float nms, box *boxes, float **probs);
 
     /**
-     * 验证检测器
+     * 批量检测目标
+     * 每 net->batch 张图片 letterbox 后放入同一个输入, 一次前向计算, 再分别解析各图片的目标
+     * 图片数超过 net->batch 时分多次计算
+     * @param net network_init_batch 初始化的网络, 最后一层为 region 层
+     * @param images 图片, 大小任意
+     * @param n 图片数
+     * @param thresh
+     * @param nms
+     * @param detections n 个目标数组, 第 i 个为第 i 张图片的目标, 坐标为原图中的位置, 按概率降序排列
+     * @return 0 成功, 1 最后一层不是 region 层
+     */
+    int detect_objects_batch(network *net, image *images, int n, float thresh, float nms, object_box_array *detections);
+
+    /**
+     * 从图片文件检测目标
+     * 解码后的 8 位数据直接缩放写入 net->input, 不生成原始大小的浮点图片
+     * @param net network_init 初始化的网络, 最后一层为 region 层
+     * @param filename
+     * @param thresh
+     * @param nms
+     * @param boxes 目标, 坐标为原图中的位置, 按概率降序排列
+     * @return 0 成功, 1 最后一层不是 region 层
+     */
+    int detect_objects_file(network *net, char *filename, float thresh, float nms, object_box_array *boxes);
+
+#ifdef NNPACK
+    /**
+     * 从摄像头或硬件解码器输出的 NV12/I420 帧检测目标
+     * 颜色转换与 letterbox 缩放一次完成, 直接写入 net->input
+     * @param net network_init 初始化的网络, 最后一层为 region 层
+     * @param data 帧数据, Y 平面后紧跟色度平面, 行之间没有填充
+     * @param w 帧宽度, 不小于 4 的偶数
+     * @param h 帧高度, 不小于 4 的偶数
+     * @param format
+     * @param thresh
+     * @param nms
+     * @param boxes 目标, 坐标为原图中的位置, 按概率降序排列
+     * @return 0 成功, 1 最后一层不是 region 层或帧大小不支持
+     */
+    int detect_objects_yuv(network *net, const unsigned char *data, int w, int h, YUV_FORMAT format,
+                           float thresh, float nms, object_box_array *boxes);
+#endif
+
+    /**
+     * validate_detector 流水线各阶段的线程数
+     * 解码 -> letterbox -> 推理 -> 解析目标及保存, 阶段之间通过有界无锁队列传递图片
+     */
+    typedef struct {
+        int decode_workers;     /* 解码图片 */
+        int letterbox_workers;  /* 缩放到网络输入大小 */
+        int inference_workers;  /* 推理, 多于 1 个时每个线程使用共用权重的推理上下文 */
+        int post_workers;       /* 解析目标及保存图片 */
+        int inference_threads;  /* 每个推理线程的线程池大小 */
+        int queue_size;         /* 阶段之间队列的容量, 也决定预分配的网络输入及输出个数 */
+    } detector_pipeline_config;
+
+    /**
+     * 默认配置: 解码 2 个线程, 其余阶段各 1 个线程, 推理线程池 4 个线程
+     * @return 
+     */
+    detector_pipeline_config default_detector_pipeline_config();
+
+    /**
+     * 按流水线验证检测器, 解码及前后处理与推理同时进行, 结束时输出各阶段的吞吐量
+     * 检测到的目标框画在图片上后保存
+     * 图片的完成顺序与列表顺序不一定相同
+     * @param datacfg
+     * @param cfgfile
+     * @param weightfile
+     * @param outpath 保存结果的路径前缀, 后接图片文件名
+     * @param thresh
+     * @param nms
+     * @param config
+     */
+    void validate_detector_pipeline(char *datacfg, char *cfgfile, char *weightfile, char *outpath, float thresh, float nms,
+                                    detector_pipeline_config config);
+
+    /**
+     * 验证检测器, 使用默认的流水线配置, 检测结果画在图片上保存
      * @param datacfg
      * @param cfgfile
      * @param weightfile
      * @param outpath
      * @param thresh
-     * @param hier_thresh
      */
-    void validate_detector(char *datacfg, char *cfgfile, char *weightfile, char *outpath, float thresh, float hier_thresh);
+    void validate_detector(char *datacfg, char *cfgfile, char *weightfile, char *outpath, float thresh);
     
     /**
      * 测试检测器
@@ -157,6 +157,7 @@ struct normalize_params {
   float *adata;
   float *bdata;
   int spatial;
+  int channels;
 };
 
 /**
@@ -169,7 +170,7 @@ struct normalize_params {
 void normalize_cpu_thread(struct normalize_params *params, size_t batch,
                           size_t filters) {
   float *ptr =
-      params->x + batch * filters * params->spatial + filters * params->spatial;
+      params->x + (batch * params->channels + filters) * params->spatial;
   float a = params->adata[filters];
   float b = params->bdata[filters];
 
@@ -190,13 +191,13 @@ void forward_batchnorm_layer(layer l, network net) {
 
 #ifdef NNPACK
   struct normalize_params params = {l.output, l.expand_a, l.expand_b,
-                                    l.out_h * l.out_w};
+                                    l.out_h * l.out_w, l.out_c};
   pthreadpool_compute_2d(net.threadpool,
                          (pthreadpool_function_2d_t)normalize_cpu_thread,
                          &params, l.batch, l.out_c);
 #else
-  copy_cpu(l.outputs * l.batch, l.output, 1, l.x, 1);
   if (net.train) {
+    copy_cpu(l.outputs * l.batch, l.output, 1, l.x, 1);
     mean_cpu(l.output, l.batch, l.out_c, l.out_h * l.out_w, l.mean);
     variance_cpu(l.output, l.mean, l.batch, l.out_c, l.out_h * l.out_w,
                  l.variance);
@@ -220,6 +221,11 @@ void forward_batchnorm_layer(layer l, network net) {
   TIME_END(forward_batchnorm_layer);
 }
 
+/**
+ * @brief  已由 fold_network_batchnorm 合并到前一个卷积层, 输出与该层共用, 不需要计算
+ */
+void forward_folded_batchnorm_layer(layer l, network net) {}
+
 void backward_batchnorm_layer(layer l, network net) {
   if (!net.train) {
     l.mean = l.rolling_mean;
@@ -8,6 +8,8 @@
 layer make_batchnorm_layer(int batch, int w, int h, int c);
 void forward_batchnorm_layer(layer l, network net);
 void backward_batchnorm_layer(layer l, network net);
+void forward_folded_batchnorm_layer(layer l, network net);
+void expand_rolling_mean_variance(layer *l);
 
 #ifdef GPU
 void forward_batchnorm_layer_gpu(layer l, network net);
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <math.h>
+#include "col2im.h"
 void col2im_add_pixel(float *im, int height, int width, int channels,
                         int row, int col, int channel, int pad, float val)
 {
@@ -15,20 +16,34 @@ void col2im_cpu(float* data_col,
          int channels,  int height,  int width,
          int ksize,  int stride, int pad, float* data_im) 
 {
-    int c,h,w;
     int height_col = (height + 2*pad - ksize) / stride + 1;
+    col2im_rows_cpu(data_col, channels, height, width, ksize, stride, pad,
+            0, height_col, data_im);
+}
+
+/**
+ * @brief  只累加输出行 [row_begin, row_end) 对应的列,
+ *         data_col 为这些输出行的展开矩阵 [channels*ksize*ksize][rows*width_col]
+ */
+void col2im_rows_cpu(float* data_col,
+         int channels,  int height,  int width,
+         int ksize,  int stride, int pad,
+         int row_begin, int row_end, float* data_im)
+{
+    int c,h,w;
     int width_col = (width + 2*pad - ksize) / stride + 1;
+    int rows = row_end - row_begin;
 
     int channels_col = channels * ksize * ksize;
     for (c = 0; c < channels_col; ++c) {
         int w_offset = c % ksize;
         int h_offset = (c / ksize) % ksize;
         int c_im = c / ksize / ksize;
-        for (h = 0; h < height_col; ++h) {
+        for (h = 0; h < rows; ++h) {
             for (w = 0; w < width_col; ++w) {
-                int im_row = h_offset + h * stride;
+                int im_row = h_offset + (h + row_begin) * stride;
                 int im_col = w_offset + w * stride;
-                int col_index = (c * height_col + h) * width_col + w;
+                int col_index = (c * rows + h) * width_col + w;
                 double val = data_col[col_index];
                 col2im_add_pixel(data_im, height, width, channels,
                         im_row, im_col, c_im, pad, val);
@@ -36,4 +51,3 @@ void col2im_cpu(float* data_col,
         }
     }
 }
-
@@ -5,6 +5,11 @@ void col2im_cpu(float* data_col,
         int channels, int height, int width,
         int ksize, int stride, int pad, float* data_im);
 
+void col2im_rows_cpu(float* data_col,
+        int channels, int height, int width,
+        int ksize, int stride, int pad,
+        int row_begin, int row_end, float* data_im);
+
 #ifdef GPU
 void col2im_gpu(float *data_col,
         int channels, int height, int width,
@@ -11,7 +11,7 @@
 #include <stdlib.h>
 #include <string.h>
 
-layer make_connected_layer(int batch, int inputs, int outputs, ACTIVATION activation, int batch_normalize, int adam)
+layer make_connected_layer(int batch, int inputs, int outputs, ACTIVATION activation, int batch_normalize, int adam, int train)
 {
     int i;
     layer l = {0};
@@ -30,10 +30,6 @@ layer make_connected_layer(int batch, int inputs, int outputs, ACTIVATION activa
     l.out_c = outputs;
 
     l.output = calloc(batch*outputs, sizeof(float));
-    l.delta = calloc(batch*outputs, sizeof(float));
-
-    l.weight_updates = calloc(inputs*outputs, sizeof(float));
-    l.bias_updates = calloc(outputs, sizeof(float));
 
     l.weights = calloc(outputs*inputs, sizeof(float));
     l.biases = calloc(outputs, sizeof(float));
@@ -42,17 +38,19 @@ layer make_connected_layer(int batch, int inputs, int outputs, ACTIVATION activa
     l.backward = backward_connected_layer;
     l.update = update_connected_layer;
 
-    //float scale = 1./sqrt(inputs);
-    float scale = sqrt(2./inputs);
-    for(i = 0; i < outputs*inputs; ++i){
-        l.weights[i] = scale*rand_uniform(-1, 1);
-    }
+    if(train){
+        l.delta = calloc(batch*outputs, sizeof(float));
+        l.weight_updates = calloc(inputs*outputs, sizeof(float));
+        l.bias_updates = calloc(outputs, sizeof(float));
 
-    for(i = 0; i < outputs; ++i){
-        l.biases[i] = 0;
+        //float scale = 1./sqrt(inputs);
+        float scale = sqrt(2./inputs);
+        for(i = 0; i < outputs*inputs; ++i){
+            l.weights[i] = scale*rand_uniform(-1, 1);
+        }
     }
 
-    if(adam){
+    if(adam && train){
         l.m = calloc(l.inputs*l.outputs, sizeof(float));
         l.v = calloc(l.inputs*l.outputs, sizeof(float));
         l.bias_m = calloc(l.outputs, sizeof(float));
@@ -62,21 +60,24 @@ layer make_connected_layer(int batch, int inputs, int outputs, ACTIVATION activa
     }
     if(batch_normalize){
         l.scales = calloc(outputs, sizeof(float));
-        l.scale_updates = calloc(outputs, sizeof(float));
         for(i = 0; i < outputs; ++i){
             l.scales[i] = 1;
         }
 
-        l.mean = calloc(outputs, sizeof(float));
-        l.mean_delta = calloc(outputs, sizeof(float));
-        l.variance = calloc(outputs, sizeof(float));
-        l.variance_delta = calloc(outputs, sizeof(float));
-
         l.rolling_mean = calloc(outputs, sizeof(float));
         l.rolling_variance = calloc(outputs, sizeof(float));
 
-        l.x = calloc(batch*outputs, sizeof(float));
-        l.x_norm = calloc(batch*outputs, sizeof(float));
+        if(train){
+            l.scale_updates = calloc(outputs, sizeof(float));
+
+            l.mean = calloc(outputs, sizeof(float));
+            l.mean_delta = calloc(outputs, sizeof(float));
+            l.variance = calloc(outputs, sizeof(float));
+            l.variance_delta = calloc(outputs, sizeof(float));
+
+            l.x = calloc(batch*outputs, sizeof(float));
+            l.x_norm = calloc(batch*outputs, sizeof(float));
+        }
     }
 
 #ifdef GPU
@@ -8,6 +8,11 @@
 #include <stdio.h>
 #include <time.h>
 
+#ifdef NNPACK
+#include "simd/conv_neon.h"
+#include "simd/maxpool_neon.h"
+#endif
+
 #ifdef AI2
 #include "xnor_layer.h"
 #endif
@@ -82,6 +87,25 @@ image get_convolutional_delta(convolutional_layer l) {
   return float_to_image(l.out_w, l.out_h, l.out_c, l.delta);
 }
 
+/**
+ * 反向传播计算 net.delta 时, 展开矩阵按输入通道及输出行分块计算后立即 col2im,
+ * 每块最多 CONV_COL2IM_ROWS 行 (至少一个通道), 列数不少于 CONV_COL2IM_PIXELS
+ */
+#define CONV_COL2IM_ROWS 288
+#define CONV_COL2IM_PIXELS 1024
+
+static void get_col2im_block(layer l, int *channels, int *rows) {
+  int group_size = l.c / l.groups;
+  *channels = CONV_COL2IM_ROWS / (l.size * l.size);
+  if (*channels < 1)
+    *channels = 1;
+  if (*channels > group_size)
+    *channels = group_size;
+  *rows = (CONV_COL2IM_PIXELS + l.out_w - 1) / l.out_w;
+  if (*rows > l.out_h)
+    *rows = l.out_h;
+}
+
 static size_t get_workspace_size(layer l) {
 #ifdef CUDNN
   if (gpu_index >= 0) {
@@ -106,8 +130,39 @@ static size_t get_workspace_size(layer l) {
     return most;
   }
 #endif
-  return (size_t)l.out_h * l.out_w * l.size * l.size * l.c * sizeof(float) /
-         l.groups;
+#ifdef GPU
+  size_t im2col_size = (size_t)l.out_h * l.out_w * l.size * l.size * l.c *
+                       sizeof(float) / l.groups;
+#else
+  /* CPU 上前向及权重梯度由 gemm_im2col_cpu 直接从输入打包, 只有 col2im 需要缓冲区 */
+  int block_channels, block_rows;
+  get_col2im_block(l, &block_channels, &block_rows);
+  size_t im2col_size = (size_t)block_channels * l.size * l.size * block_rows *
+                       l.out_w * sizeof(float);
+#endif
+#ifdef NNPACK
+  if (l.winograd) {
+    size_t winograd_size =
+        winograd_workspace_size(l.winograd, l.out_w, l.out_h, l.c, l.n, l.batch) *
+        sizeof(float);
+    if (winograd_size > im2col_size)
+      return winograd_size;
+  }
+  if (1 == l.size && 1 == l.groups) {
+    size_t gemm_size =
+        conv1x1_gemm_workspace_size(l.out_w, l.out_h, l.c) * sizeof(float);
+    if (gemm_size > im2col_size)
+      return gemm_size;
+  }
+  /* 3x3/s1 的直接卷积及 depthwise 卷积先把整个 batch 的输入补边后放入 workspace */
+  if (3 == l.size && 1 == l.stride && (1 == l.groups || l.groups == l.c)) {
+    size_t border_size = (size_t)l.batch * l.c * (l.w + 2 * l.pad) *
+                         (l.h + 2 * l.pad) * sizeof(float);
+    if (border_size > im2col_size)
+      return border_size;
+  }
+#endif
+  return im2col_size;
 }
 
 #ifdef GPU
@@ -174,7 +229,7 @@ convolutional_layer make_convolutional_layer(int batch, int h, int w, int c,
                                              int padding, int groups,
                                              ACTIVATION activation,
                                              int batch_normalize, int binary,
-                                             int xnor, int adam) {
+                                             int xnor, int adam, int train) {
   int i;
   convolutional_layer l = {0};
   l.type = CONVOLUTIONAL;
@@ -196,14 +251,16 @@ convolutional_layer make_convolutional_layer(int batch, int h, int w, int c,
   l.nbiases = n;
 
   l.weights = calloc(l.nweights, sizeof(float));
-  l.weight_updates = calloc(l.nweights, sizeof(float));
-
   l.biases = calloc(n, sizeof(float));
-  l.bias_updates = calloc(n, sizeof(float));
 
-  float scale = sqrt(2. / (size * size * c));
-  for (i = 0; i < l.nweights; ++i)
-    l.weights[i] = scale * rand_normal();
+  if (train) {
+    l.weight_updates = calloc(l.nweights, sizeof(float));
+    l.bias_updates = calloc(n, sizeof(float));
+
+    float scale = sqrt(2. / (size * size * c));
+    for (i = 0; i < l.nweights; ++i)
+      l.weights[i] = scale * rand_normal();
+  }
   int out_w = convolutional_out_width(l);
   int out_h = convolutional_out_height(l);
   l.out_h = out_h;
@@ -213,10 +270,24 @@ convolutional_layer make_convolutional_layer(int batch, int h, int w, int c,
   l.inputs = l.w * l.h * l.c;
 
   l.output = calloc(l.batch * l.outputs, sizeof(float));
-  l.delta = calloc(l.batch * l.outputs, sizeof(float));
+  if (train)
+    l.delta = calloc(l.batch * l.outputs, sizeof(float));
 
 #ifdef NNPACK
   l.forward = forward_convolutional_layer_nnpack;
+  l.winograd = winograd_tile_size(size, stride, groups, c, out_w, out_h);
+  if (l.winograd) {
+    l.winograd_weights =
+        calloc(winograd_weights_size(l.winograd, n, c), sizeof(float));
+    if (train)
+      winograd_convolutional_weights(l);
+  }
+  if (1 == size && 1 == groups) {
+    l.conv1x1_weights =
+        calloc(conv1x1_gemm_weights_size(n, c), sizeof(float));
+    if (train)
+      conv1x1_convolutional_weights(l);
+  }
 #else
   l.forward = forward_convolutional_layer;
 #endif
@@ -237,27 +308,30 @@ convolutional_layer make_convolutional_layer(int batch, int h, int w, int c,
 
   if (batch_normalize) {
     l.scales = calloc(n, sizeof(float));
-    l.scale_updates = calloc(n, sizeof(float));
     for (i = 0; i < n; ++i) {
       l.scales[i] = 1;
     }
 
-    l.mean = calloc(n, sizeof(float));
-    l.variance = calloc(n, sizeof(float));
-
-    l.mean_delta = calloc(n, sizeof(float));
-    l.variance_delta = calloc(n, sizeof(float));
-
     l.rolling_mean = calloc(n, sizeof(float));
     l.rolling_variance = calloc(n, sizeof(float));
     l.expand_a = calloc(n, sizeof(float));
     l.expand_b = calloc(n, sizeof(float));
 
-    l.x = calloc(l.batch * l.outputs, sizeof(float));
-    l.x_norm = calloc(l.batch * l.outputs, sizeof(float));
+    if (train) {
+      l.scale_updates = calloc(n, sizeof(float));
+
+      l.mean = calloc(n, sizeof(float));
+      l.variance = calloc(n, sizeof(float));
+
+      l.mean_delta = calloc(n, sizeof(float));
+      l.variance_delta = calloc(n, sizeof(float));
+
+      l.x = calloc(l.batch * l.outputs, sizeof(float));
+      l.x_norm = calloc(l.batch * l.outputs, sizeof(float));
+    }
   }
 
-  if (adam) {
+  if (adam && train) {
     l.m = calloc(l.nweights, sizeof(float));
     l.v = calloc(l.nweights, sizeof(float));
     l.bias_m = calloc(n, sizeof(float));
@@ -347,6 +421,51 @@ convolutional_layer make_convolutional_layer(int batch, int h, int w, int c,
   return l;
 }
 
+/**
+ * 输出 y = scale * (x + bias - mean) / (sqrt(variance) + .000001f) + beta
+ * 合并到权重及偏置中, bias 为 NULL 时按 0 计算, 公式与推理时的
+ * normalize_cpu/expand_rolling_mean_variance 相同
+ */
+static void fold_batchnorm_weights(convolutional_layer *l, const float *bias,
+                                   const float *scales, const float *mean,
+                                   const float *variance, const float *beta) {
+  int i, j;
+  int size = l->nweights / l->n;
+  for (i = 0; i < l->n; ++i) {
+    float scale = scales[i] / (sqrt(variance[i]) + .000001f);
+    for (j = 0; j < size; ++j) {
+      l->weights[i * size + j] *= scale;
+    }
+    l->biases[i] = ((bias ? bias[i] : 0) - mean[i]) * scale + beta[i];
+  }
+#ifdef NNPACK
+  winograd_convolutional_weights(*l);
+  conv1x1_convolutional_weights(*l);
+#endif
+}
+
+/**
+ * @brief  将批归一化合并到卷积权重及偏置中, 只用于推理
+ * @note   合并后 batch_normalize 置 0, Winograd 权重重新计算
+ */
+void fold_convolutional_batchnorm(convolutional_layer *l) {
+  if (!l->batch_normalize)
+    return;
+  fold_batchnorm_weights(l, NULL, l->scales, l->rolling_mean,
+                         l->rolling_variance, l->biases);
+  l->batch_normalize = 0;
+}
+
+/**
+ * @brief  将紧跟在线性激活卷积层之后的 batchnorm 层合并到卷积权重及偏置中
+ * @note   调用者负责检查 l 的激活函数为 LINEAR 且输出只被 bn 使用
+ */
+void fold_convolutional_batchnorm_layer(convolutional_layer *l, layer *bn) {
+  fold_convolutional_batchnorm(l);
+  fold_batchnorm_weights(l, l->biases, bn->scales, bn->rolling_mean,
+                         bn->rolling_variance, bn->biases);
+}
+
 void denormalize_convolutional_layer(convolutional_layer l) {
   int i, j;
   for (i = 0; i < l.n; ++i) {
@@ -435,16 +554,44 @@ void backward_bias(float *bias_updates, float *delta, int batch, int n,
 }
 
 #ifdef NNPACK
+/**
+ * 计算 Winograd 变换后的权重, 创建层及加载权重后调用,
+ * 修改 l.weights 后需要重新调用
+ */
+void winograd_convolutional_weights(convolutional_layer l) {
+  if (l.winograd && l.winograd_weights) {
+    winograd_transform_weights(l.winograd, l.weights, l.winograd_weights, l.n,
+                               l.c);
+  }
+}
 
-#include "neon/conv_neon.h"
+/**
+ * 打包 1x1 卷积的权重, 调用时机与 winograd_convolutional_weights 相同
+ */
+void conv1x1_convolutional_weights(convolutional_layer l) {
+  if (l.conv1x1_weights)
+    conv1x1_gemm_pack_weights(l.weights, l.conv1x1_weights, l.n, l.c);
+}
 
 void forward_convolutional_layer_nnpack(convolutional_layer l, network net) {
   TIME_BEGIN(forward_convolutional_layer_nnpack);
   struct conv_params params = {
       net.input, l.output, l.weights, net.workspace, l.workspace_size,
       l.size,    l.pad,    l.stride,  l.groups,      l.w,
-      l.h,       l.c,      l.out_w,   l.out_h,       l.out_c};
-  conv_cpu_inference(net.threadpool, &params, net.batch, l.out_c);
+      l.h,       l.c,      l.out_w,   l.out_h,       l.out_c,
+      l.winograd_weights, l.winograd, l.conv1x1_weights,
+      l.batch_normalize ? l.expand_b : NULL,
+      l.batch_normalize ? l.expand_a : l.biases, l.activation};
+  struct maxpool_params pool;
+  if (l.fuse_maxpool) {
+    layer p = net.layers[net.index + 1];
+    struct maxpool_params fused_pool = {l.output, p.output, p.size,  p.pad,
+                                        p.w,      p.h,      p.c,     p.out_w,
+                                        p.out_h,  p.out_c,  p.stride};
+    pool = fused_pool;
+    params.pool = &pool;
+  }
+  int fused = conv_cpu_inference(net.threadpool, &params, net.batch, l.out_c);
   // image im = float_to_image(l.w, l.h, l.c, net.input);
   // printf("\nfilter_before:\n");
   // print_image(im);
@@ -453,24 +600,33 @@ void forward_convolutional_layer_nnpack(convolutional_layer l, network net) {
   // printf("\nfilter:\n");
   // print_image(im);
 
-  if (l.batch_normalize) {
-    TIME_BEGIN(normalize_active_cpu_thread);
-    struct normalize_params params = {l.output, l.expand_a, l.expand_b,
-                                      l.out_h * l.out_w, l.activation};
-    pthreadpool_compute_2d(
-        net.threadpool, (pthreadpool_function_2d_t)normalize_active_cpu_thread,
-        &params, l.batch, l.out_c);
-    TIME_END(normalize_active_cpu_thread);
-  } else {
-    TIME_BEGIN(convolutional_activate_array_thread);
-    int out_h = convolutional_out_height(l);
-    int out_w = convolutional_out_width(l);
-    int n = out_h * out_w;
-    add_bias(l.output, l.biases, l.batch, l.n, out_h * out_w);
-    activate_array_thread(l.output, l.n, n, l.activation, net.threadpool);
-    TIME_END(convolutional_activate_array_thread);
+  if (!fused) {
+    if (l.batch_normalize) {
+      TIME_BEGIN(normalize_active_cpu_thread);
+      struct normalize_params params = {l.output, l.expand_a, l.expand_b,
+                                        l.out_h * l.out_w, l.activation,
+                                        l.out_c};
+      pthreadpool_compute_2d(
+          net.threadpool,
+          (pthreadpool_function_2d_t)normalize_active_cpu_thread, &params,
+          l.batch, l.out_c);
+      TIME_END(normalize_active_cpu_thread);
+    } else {
+      TIME_BEGIN(convolutional_activate_array_thread);
+      int out_h = convolutional_out_height(l);
+      int out_w = convolutional_out_width(l);
+      int n = out_h * out_w;
+      add_bias(l.output, l.biases, l.batch, l.n, out_h * out_w);
+      activate_array_thread(l.output, l.n * l.batch, n, l.activation,
+                            net.threadpool);
+      TIME_END(convolutional_activate_array_thread);
+    }
   }
 
+  /* 无法在卷积任务中融合时, 后处理完成后再计算池化 */
+  if (l.fuse_maxpool && NULL == params.pool)
+    maxpool_cpu(net.threadpool, &pool, net.batch);
+
   if (l.binary || l.xnor)
     swap_binary(&l);
   TIME_END(forward_convolutional_layer_nnpack);
@@ -507,12 +663,15 @@ void forward_convolutional_layer(convolutional_layer l, network net) {
   for (i = 0; i < l.batch; ++i) {
     for (j = 0; j < l.groups; j++) {
       float *aoffset = a + j * k;
-      float *boffset = net.workspace;
       float *coffset = c + j * n * group_size;
       float *inputoffset = net.input + group_step * j;
-      im2col_cpu(inputoffset, group_size, l.h, l.w, l.size, l.stride, l.pad,
-                 boffset);
-      gemm(0, 0, m, n, k, 1, aoffset, k, boffset, n, 1, coffset, n);
+      if (1 == l.size && 1 == l.stride && 0 == l.pad) {
+        gemm(0, 0, m, n, k, 1, aoffset, k, inputoffset, n, 1, coffset, n);
+      } else {
+        im2col_matrix col = {inputoffset, group_size, l.h,  l.w,
+                             l.size,      l.stride,   l.pad};
+        gemm_im2col_cpu(0, 0, m, n, k, 1, aoffset, k, &col, 1, coffset, n);
+      }
     }
 
     c += l.out_h * l.out_w * l.n;
@@ -554,6 +713,9 @@ void backward_convolutional_layer(convolutional_layer l, network net) {
 
   int group_size = l.c / l.groups;
   int group_step = l.h * l.w * group_size;
+  int ksize = l.size * l.size;
+  int block_channels, block_rows;
+  get_col2im_block(l, &block_channels, &block_rows);
   n = n / l.groups;
   m = m / l.groups;
   for (i = 0; i < l.batch; ++i) {
@@ -563,21 +725,29 @@ void backward_convolutional_layer(convolutional_layer l, network net) {
     for (j = 0; j < l.groups; j++) {
       float *im = input_data + j * group_step;
       float *aoffset = deltas + j * group_size * k;
-      float *boffset = net.workspace;
       float *coffset = l.weight_updates + j * n;
 
       //得到权重的更新
-      im2col_cpu(im, group_size, l.h, l.w, l.size, l.stride, l.pad, boffset);
-      gemm(0, 1, m, n, k, 1, aoffset, k, boffset, k, 1, coffset, n);
+      im2col_matrix col = {im, group_size, l.h, l.w, l.size, l.stride, l.pad};
+      gemm_im2col_cpu(0, 1, m, n, k, 1, aoffset, k, &col, 1, coffset, n);
 
       if (net.delta) {
-        aoffset = l.weights + j * n;
-        boffset = deltas + j * group_size * k;
-        coffset = net.workspace;
-
-        gemm(1, 0, n, k, m, 1, aoffset, n, boffset, k, 0, coffset, k);
-        col2im_cpu(net.workspace, group_size, l.h, l.w, l.size, l.stride, l.pad,
-                   outdeltas + j * group_step);
+        int c0, r0;
+        for (c0 = 0; c0 < group_size; c0 += block_channels) {
+          int channels = group_size - c0 < block_channels ? group_size - c0
+                                                          : block_channels;
+          for (r0 = 0; r0 < l.out_h; r0 += block_rows) {
+            int rows = l.out_h - r0 < block_rows ? l.out_h - r0 : block_rows;
+            aoffset = l.weights + j * n + c0 * ksize;
+            float *boffset = deltas + j * group_size * k + r0 * l.out_w;
+
+            gemm(1, 0, channels * ksize, rows * l.out_w, m, 1, aoffset, n,
+                 boffset, k, 0, net.workspace, rows * l.out_w);
+            col2im_rows_cpu(net.workspace, channels, l.h, l.w, l.size,
+                            l.stride, l.pad, r0, r0 + rows,
+                            outdeltas + j * group_step + c0 * l.h * l.w);
+          }
+        }
       }
     }
   }
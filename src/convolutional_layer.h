@@ -25,10 +25,12 @@ void cudnn_convolutional_setup(layer *l);
 #endif
 #endif
 
-convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int n, int size, int stride, int padding, int groups, ACTIVATION activation, int batch_normalize, int binary, int xnor, int adam);
+convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int n, int size, int stride, int padding, int groups, ACTIVATION activation, int batch_normalize, int binary, int xnor, int adam, int train);
 void resize_convolutional_layer(convolutional_layer *layer, int w, int h);
 #ifdef NNPACK
 void forward_convolutional_layer_nnpack(const convolutional_layer layer, network net);
+void winograd_convolutional_weights(convolutional_layer layer);
+void conv1x1_convolutional_weights(convolutional_layer layer);
 #endif
 void forward_convolutional_layer(const convolutional_layer layer, network net);
 void update_convolutional_layer(convolutional_layer layer, update_args a);
@@ -6,6 +6,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 
@@ -53,6 +58,14 @@ char **get_random_paths(char **paths, int n, int m)
     return random_paths;
 }
 
+static int get_random_index(int m)
+{
+    pthread_mutex_lock(&mutex);
+    int index = rand()%m;
+    pthread_mutex_unlock(&mutex);
+    return index;
+}
+
 char **find_replace_paths(char **paths, int n, char *find, char *replace)
 {
     char **replace_paths = calloc(n, sizeof(char*));
@@ -102,6 +115,33 @@ matrix load_image_paths(char **paths, int n, int w, int h)
     return X;
 }
 
+static image augment_image_crop(image im, int min, int max, int size, float angle, float aspect, float hue, float saturation, float exposure, int center)
+{
+    image crop;
+    if(center){
+        crop = center_crop_image(im, size, size);
+    } else {
+        crop = random_augment_image(im, angle, aspect, min, max, size, size);
+    }
+    int flip = rand()%2;
+    random_distort_flip_image(crop, hue, saturation, exposure, flip);
+
+    /*
+    show_image(im, "orig");
+    show_image(crop, "crop");
+    cvWaitKey(0);
+    */
+    return crop;
+}
+
+image load_image_augment(char *path, int min, int max, int size, float angle, float aspect, float hue, float saturation, float exposure, int center)
+{
+    image im = load_image_color(path, 0, 0);
+    image crop = augment_image_crop(im, min, max, size, angle, aspect, hue, saturation, exposure, center);
+    free_image(im);
+    return crop;
+}
+
 matrix load_image_augment_paths(char **paths, int n, int min, int max, int size, float angle, float aspect, float hue, float saturation, float exposure, int center)
 {
     int i;
@@ -111,30 +151,13 @@ matrix load_image_augment_paths(char **paths, int n, int min, int max, int size,
     X.cols = 0;
 
     for(i = 0; i < n; ++i){
-        image im = load_image_color(paths[i], 0, 0);
-        image crop;
-        if(center){
-            crop = center_crop_image(im, size, size);
-        } else {
-            crop = random_augment_image(im, angle, aspect, min, max, size, size);
-        }
-        int flip = rand()%2;
-        if (flip) flip_image(crop);
-        random_distort_image(crop, hue, saturation, exposure);
-
-        /*
-        show_image(im, "orig");
-        show_image(crop, "crop");
-        cvWaitKey(0);
-        */
-        free_image(im);
+        image crop = load_image_augment(paths[i], min, max, size, angle, aspect, hue, saturation, exposure, center);
         X.vals[i] = crop.data;
         X.cols = crop.h*crop.w*crop.c;
     }
     return X;
 }
 
-
 box_label *read_boxes(char *filename, int *n)
 {
     box_label *boxes = calloc(1, sizeof(box_label));
@@ -401,9 +424,8 @@ void fill_truth_iseg(char *path, int num_boxes, float *truth, int classes, int w
 }
 
 
-void fill_truth_detection(char *path, int num_boxes, float *truth, int classes, int flip, float dx, float dy, float sx, float sy)
+static void get_detection_label_path(char *path, char *labelpath)
 {
-    char labelpath[4096];
     find_replace(path, "images", "labels", labelpath);
     find_replace(labelpath, "JPEGImages", "labels", labelpath);
 
@@ -412,8 +434,13 @@ void fill_truth_detection(char *path, int num_boxes, float *truth, int classes,
     find_replace(labelpath, ".png", ".txt", labelpath);
     find_replace(labelpath, ".JPG", ".txt", labelpath);
     find_replace(labelpath, ".JPEG", ".txt", labelpath);
-    int count = 0;
-    box_label *boxes = read_boxes(labelpath, &count);
+}
+
+/**
+ * @brief  把标注框随机排序并按裁剪及翻转修正后写入 truth, boxes 会被修改
+ */
+static void fill_truth_boxes(box_label *boxes, int count, int num_boxes, float *truth, int classes, int flip, float dx, float dy, float sx, float sy)
+{
     randomize_boxes(boxes, count);
     correct_boxes(boxes, count, dx, dy, sx, sy, flip);
     if(count > num_boxes) count = num_boxes;
@@ -436,6 +463,15 @@ void fill_truth_detection(char *path, int num_boxes, float *truth, int classes,
         truth[i*5+3] = h;
         truth[i*5+4] = id;
     }
+}
+
+void fill_truth_detection(char *path, int num_boxes, float *truth, int classes, int flip, float dx, float dy, float sx, float sy)
+{
+    char labelpath[4096];
+    get_detection_label_path(path, labelpath);
+    int count = 0;
+    box_label *boxes = read_boxes(labelpath, &count);
+    fill_truth_boxes(boxes, count, num_boxes, truth, classes, flip, dx, dy, sx, sy);
     free(boxes);
 }
 
@@ -700,8 +736,7 @@ data load_data_seg(int n, char **paths, int m, int w, int h, int classes, int mi
         image sized = rotate_crop_image(orig, a.rad, a.scale, a.w, a.h, a.dx, a.dy, a.aspect);
 
         int flip = rand()%2;
-        if(flip) flip_image(sized);
-        random_distort_image(sized, hue, saturation, exposure);
+        random_distort_flip_image(sized, hue, saturation, exposure, flip);
         d.X.vals[i] = sized.data;
 
         image mask = get_segmentation_image(random_paths[i], orig.w, orig.h, classes);
@@ -745,8 +780,7 @@ data load_data_iseg(int n, char **paths, int m, int w, int h, int classes, int b
         image sized = rotate_crop_image(orig, a.rad, a.scale, a.w, a.h, a.dx, a.dy, a.aspect);
 
         int flip = rand()%2;
-        if(flip) flip_image(sized);
-        random_distort_image(sized, hue, saturation, exposure);
+        random_distort_flip_image(sized, hue, saturation, exposure, flip);
         d.X.vals[i] = sized.data;
         //show_image(sized, "image");
 
@@ -807,8 +841,7 @@ data load_data_region(int n, char **paths, int m, int w, int h, int size, int cl
         float dy = ((float)ptop /oh)/sy;
 
         image sized = resize_image(cropped, w, h);
-        if(flip) flip_image(sized);
-        random_distort_image(sized, hue, saturation, exposure);
+        random_distort_flip_image(sized, hue, saturation, exposure, flip);
         d.X.vals[i] = sized.data;
 
         fill_truth_region(random_paths[i], d.y.vals[i], classes, size, flip, dx, dy, 1./sx, 1./sy);
@@ -937,53 +970,79 @@ data load_data_swag(char **paths, int n, int classes, float jitter)
     return d;
 }
 
-data load_data_detection(int n, char **paths, int m, int w, int h, int boxes, int classes, float jitter, float hue, float saturation, float exposure)
+/**
+ * @brief  检测训练图像的数据增强: 随机缩放及平移 orig 后放入 w x h 的图像 X
+ *         (3 通道), 并把修正后的标注框写入 truth
+ * @note   X 及 truth 由调用者分配, truth 需预先清零, boxes 会被修改
+ */
+static void augment_detection_sample(image orig, box_label *boxes, int count, float *X, float *truth, int w, int h, int num_boxes, int classes, float jitter, float hue, float saturation, float exposure)
 {
-    char **random_paths = get_random_paths(paths, n, m);
-    int i;
-    data d = {0};
-    d.shallow = 0;
+    image sized = float_to_image(w, h, orig.c, X);
+    fill_image(sized, .5);
 
-    d.X.rows = n;
-    d.X.vals = calloc(d.X.rows, sizeof(float*));
-    d.X.cols = h*w*3;
+    float dw = jitter * orig.w;
+    float dh = jitter * orig.h;
 
-    d.y = make_matrix(n, 5*boxes);
-    for(i = 0; i < n; ++i){
-        image orig = load_image_color(random_paths[i], 0, 0);
-        image sized = make_image(w, h, orig.c);
-        fill_image(sized, .5);
+    float new_ar = (orig.w + rand_uniform(-dw, dw)) / (orig.h + rand_uniform(-dh, dh));
+    float scale = rand_uniform(.25, 2);
 
-        float dw = jitter * orig.w;
-        float dh = jitter * orig.h;
+    float nw, nh;
 
-        float new_ar = (orig.w + rand_uniform(-dw, dw)) / (orig.h + rand_uniform(-dh, dh));
-        float scale = rand_uniform(.25, 2);
+    if(new_ar < 1){
+        nh = scale * h;
+        nw = nh * new_ar;
+    } else {
+        nw = scale * w;
+        nh = nw / new_ar;
+    }
 
-        float nw, nh;
+    float dx = rand_uniform(0, w - nw);
+    float dy = rand_uniform(0, h - nh);
 
-        if(new_ar < 1){
-            nh = scale * h;
-            nw = nh * new_ar;
-        } else {
-            nw = scale * w;
-            nh = nw / new_ar;
-        }
+    place_image(orig, nw, nh, dx, dy, sized);
 
-        float dx = rand_uniform(0, w - nw);
-        float dy = rand_uniform(0, h - nh);
+    float dhue = rand_uniform(-hue, hue);
+    float dsat = rand_scale(saturation);
+    float dexp = rand_scale(exposure);
+    int flip = rand()%2;
+    distort_flip_image(sized, dhue, dsat, dexp, flip);
 
-        place_image(orig, nw, nh, dx, dy, sized);
+    fill_truth_boxes(boxes, count, num_boxes, truth, classes, flip, -dx/w, -dy/h, nw/w, nh/h);
+}
 
-        random_distort_image(sized, hue, saturation, exposure);
-        int flip = rand()%2;
-        if(flip) flip_image(sized);
-        d.X.vals[i] = sized.data;
+/**
+ * @brief  加载一张检测训练图像及其标注文件, 数据增强后写入 X 及 truth
+ * @note   X 及 truth 由调用者分配, truth 需预先清零
+ */
+void load_detection_sample(char *path, float *X, float *truth, int w, int h, int boxes, int classes, float jitter, float hue, float saturation, float exposure)
+{
+    image orig = load_image_color(path, 0, 0);
+    char labelpath[4096];
+    get_detection_label_path(path, labelpath);
+    int count = 0;
+    box_label *labels = read_boxes(labelpath, &count);
 
+    augment_detection_sample(orig, labels, count, X, truth, w, h, boxes, classes, jitter, hue, saturation, exposure);
 
-        fill_truth_detection(random_paths[i], boxes, d.y.vals[i], classes, flip, -dx/w, -dy/h, nw/w, nh/h);
+    free(labels);
+    free_image(orig);
+}
 
-        free_image(orig);
+data load_data_detection(int n, char **paths, int m, int w, int h, int boxes, int classes, float jitter, float hue, float saturation, float exposure)
+{
+    char **random_paths = get_random_paths(paths, n, m);
+    int i;
+    data d = {0};
+    d.shallow = 0;
+
+    d.X.rows = n;
+    d.X.vals = calloc(d.X.rows, sizeof(float*));
+    d.X.cols = h*w*3;
+
+    d.y = make_matrix(n, 5*boxes);
+    for(i = 0; i < n; ++i){
+        d.X.vals[i] = calloc(d.X.cols, sizeof(float));
+        load_detection_sample(random_paths[i], d.X.vals[i], d.y.vals[i], w, h, boxes, classes, jitter, hue, saturation, exposure);
     }
     free(random_paths);
     return d;
@@ -1086,6 +1145,498 @@ pthread_t load_data(load_args args)
     return thread;
 }
 
+/**
+ * 预解码的数据集分片文件, 用 mmap 映射后直接读取, 训练时不再解码图像及解析标注.
+ * 文件结构:
+ *   dataset_shard_header
+ *   每张图像: 8 位 CHW 像素 | 标注框 float[num_boxes][5] (id x y w h) | 原始路径
+ *   索引: dataset_shard_record[count]
+ * 像素及标注框均按 DATASET_SHARD_ALIGN 字节对齐, 数据按本机字节序保存
+ */
+#define DATASET_SHARD_MAGIC "DKSHARD1"
+#define DATASET_SHARD_VERSION 1
+#define DATASET_SHARD_ALIGN 64
+
+typedef struct {
+    char magic[8];
+    int version;
+    int count;
+    int max_side;
+    int reserved;
+    uint64_t index_offset;
+} dataset_shard_header;
+
+typedef struct {
+    uint64_t offset;
+    uint64_t boxes_offset;
+    uint64_t path_offset;
+    int w, h, c;
+    int num_boxes;
+} dataset_shard_record;
+
+struct dataset_shard {
+    unsigned char *map;
+    size_t size;
+    int count;
+    const dataset_shard_record *index;
+};
+
+static uint64_t dataset_shard_pad(FILE *fp, uint64_t pos)
+{
+    static const char zeros[DATASET_SHARD_ALIGN] = {0};
+    uint64_t aligned = (pos + DATASET_SHARD_ALIGN - 1) / DATASET_SHARD_ALIGN * DATASET_SHARD_ALIGN;
+    if(aligned > pos) fwrite(zeros, 1, aligned - pos, fp);
+    return aligned;
+}
+
+/**
+ * @brief  把图像列表打包为数据集分片文件
+ * @note   长边超过 max_side 的图像按比例缩小 (max_side <= 0 时不缩小),
+ *         标注文件的查找规则与 fill_truth_detection 相同, 没有标注文件时不保存标注框
+ */
+void pack_dataset_shard(char *listfile, char *filename, int max_side)
+{
+    list *plist = get_paths(listfile);
+    char **paths = (char **)list_to_array(plist);
+    int count = plist->size;
+    FILE *fp = fopen(filename, "wb");
+    if(!fp) file_error(filename);
+
+    dataset_shard_header header = {{0}};
+    memcpy(header.magic, DATASET_SHARD_MAGIC, sizeof(header.magic));
+    header.version = DATASET_SHARD_VERSION;
+    header.count = count;
+    header.max_side = max_side;
+    fwrite(&header, sizeof(header), 1, fp);
+    uint64_t pos = sizeof(header);
+
+    dataset_shard_record *index = calloc(count, sizeof(dataset_shard_record));
+    unsigned char *pixels = 0;
+    size_t pixels_size = 0;
+    int i, j;
+    double start = what_time_is_it_now();
+    for(i = 0; i < count; ++i){
+        image im = load_image_color(paths[i], 0, 0);
+        int side = im.w > im.h ? im.w : im.h;
+        if(max_side > 0 && side > max_side){
+            int w = (int)((float)im.w * max_side / side + .5f);
+            int h = (int)((float)im.h * max_side / side + .5f);
+            image sized = resize_image(im, w > 0 ? w : 1, h > 0 ? h : 1);
+            free_image(im);
+            im = sized;
+        }
+        size_t n = (size_t)im.w*im.h*im.c;
+        if(n > pixels_size){
+            pixels = realloc(pixels, n);
+            pixels_size = n;
+        }
+        for(j = 0; j < n; ++j){
+            float v = im.data[j]*255.f + .5f;
+            pixels[j] = v < 0 ? 0 : (v > 255 ? 255 : (unsigned char)v);
+        }
+
+        char labelpath[4096];
+        get_detection_label_path(paths[i], labelpath);
+        int num_boxes = 0;
+        box_label *boxes = 0;
+        FILE *label = fopen(labelpath, "r");
+        if(label){
+            fclose(label);
+            boxes = read_boxes(labelpath, &num_boxes);
+        }
+
+        dataset_shard_record *r = index + i;
+        r->w = im.w;
+        r->h = im.h;
+        r->c = im.c;
+        r->num_boxes = num_boxes;
+        pos = dataset_shard_pad(fp, pos);
+        r->offset = pos;
+        fwrite(pixels, 1, n, fp);
+        pos += n;
+        pos = dataset_shard_pad(fp, pos);
+        r->boxes_offset = pos;
+        for(j = 0; j < num_boxes; ++j){
+            float b[5] = {boxes[j].id, boxes[j].x, boxes[j].y, boxes[j].w, boxes[j].h};
+            fwrite(b, sizeof(float), 5, fp);
+        }
+        pos += num_boxes*5*sizeof(float);
+        r->path_offset = pos;
+        fwrite(paths[i], 1, strlen(paths[i]) + 1, fp);
+        pos += strlen(paths[i]) + 1;
+
+        free(boxes);
+        free_image(im);
+        if((i + 1) % 1000 == 0) fprintf(stderr, "%d/%d images, %.1f seconds\n", i + 1, count, what_time_is_it_now() - start);
+    }
+    pos = dataset_shard_pad(fp, pos);
+    header.index_offset = pos;
+    fwrite(index, sizeof(dataset_shard_record), count, fp);
+    fseek(fp, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, fp);
+    if(fclose(fp)) file_error(filename);
+    fprintf(stderr, "Packed %d images into %s, %.1f MB\n", count, filename,
+            (pos + (double)count*sizeof(dataset_shard_record))/(1024*1024));
+
+    free(pixels);
+    free(index);
+    free_ptrs((void **)paths, count);
+    free_list(plist);
+}
+
+/**
+ * @brief  检查一条索引记录引用的像素, 标注框及路径是否都在文件范围内
+ * @retval 1: 有效, 0: 越界或字段无效
+ */
+static int dataset_shard_record_valid(const dataset_shard_record *r, const unsigned char *map, uint64_t size)
+{
+    if(r->w <= 0 || r->h <= 0 || r->c <= 0 || r->num_boxes < 0) return 0;
+    uint64_t pixels = (uint64_t)r->w*r->h*r->c;
+    uint64_t boxes = (uint64_t)r->num_boxes*5*sizeof(float);
+    if(r->offset > size || pixels > size - r->offset) return 0;
+    if(r->boxes_offset % sizeof(float) || r->boxes_offset > size || boxes > size - r->boxes_offset) return 0;
+    if(r->path_offset >= size || !memchr(map + r->path_offset, 0, size - r->path_offset)) return 0;
+    return 1;
+}
+
+dataset_shard *load_dataset_shard(char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0) file_error(filename);
+    struct stat st;
+    if(fstat(fd, &st)) file_error(filename);
+    void *map = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(MAP_FAILED == map) file_error(filename);
+
+    const dataset_shard_header *header = map;
+    if((size_t)st.st_size < sizeof(*header) || memcmp(header->magic, DATASET_SHARD_MAGIC, sizeof(header->magic))
+            || header->version != DATASET_SHARD_VERSION || header->count < 0
+            || header->index_offset % sizeof(uint64_t) || header->index_offset > (uint64_t)st.st_size
+            || (uint64_t)header->count*sizeof(dataset_shard_record) > (uint64_t)st.st_size - header->index_offset){
+        fprintf(stderr, "Not a valid dataset shard: %s\n", filename);
+        exit(0);
+    }
+    const dataset_shard_record *index = (const dataset_shard_record *)((unsigned char *)map + header->index_offset);
+    int i;
+    for(i = 0; i < header->count; ++i){
+        if(!dataset_shard_record_valid(index + i, map, st.st_size)){
+            fprintf(stderr, "Corrupt dataset shard %s: record %d is out of range\n", filename, i);
+            exit(0);
+        }
+    }
+    dataset_shard *shard = calloc(1, sizeof(dataset_shard));
+    shard->map = map;
+    shard->size = st.st_size;
+    shard->count = header->count;
+    shard->index = index;
+    return shard;
+}
+
+void free_dataset_shard(dataset_shard *shard)
+{
+    munmap(shard->map, shard->size);
+    free(shard);
+}
+
+int dataset_shard_size(dataset_shard *shard)
+{
+    return shard->count;
+}
+
+/**
+ * @brief  是否为数据集分片文件, 按扩展名 .shard 判断
+ */
+int is_dataset_shard(char *filename)
+{
+    size_t len = strlen(filename);
+    return len > 6 && 0 == strcmp(filename + len - 6, ".shard");
+}
+
+static image load_dataset_shard_image(dataset_shard *shard, int i)
+{
+    const dataset_shard_record *r = shard->index + i;
+    const unsigned char *src = shard->map + r->offset;
+    image im = make_image(r->w, r->h, r->c);
+    size_t j, n = (size_t)r->w*r->h*r->c;
+    for(j = 0; j < n; ++j){
+        im.data[j] = src[j]/255.f;
+    }
+    return im;
+}
+
+static box_label *load_dataset_shard_boxes(dataset_shard *shard, int i, int *n)
+{
+    const dataset_shard_record *r = shard->index + i;
+    const float *src = (const float *)(shard->map + r->boxes_offset);
+    box_label *boxes = calloc(r->num_boxes + 1, sizeof(box_label));
+    int j;
+    for(j = 0; j < r->num_boxes; ++j, src += 5){
+        boxes[j].id = src[0];
+        boxes[j].x = src[1];
+        boxes[j].y = src[2];
+        boxes[j].w = src[3];
+        boxes[j].h = src[4];
+        boxes[j].left   = boxes[j].x - boxes[j].w/2;
+        boxes[j].right  = boxes[j].x + boxes[j].w/2;
+        boxes[j].top    = boxes[j].y - boxes[j].h/2;
+        boxes[j].bottom = boxes[j].y + boxes[j].h/2;
+    }
+    *n = r->num_boxes;
+    return boxes;
+}
+
+static char *dataset_shard_path(dataset_shard *shard, int i)
+{
+    return (char *)(shard->map + shard->index[i].path_offset);
+}
+
+/**
+ * 常驻的数据加载线程池. 预先分配 depth 个 batch 的缓冲区组成环形队列,
+ * 工作线程按样本领取任务, 第 b 个 batch 的样本直接写入第 b % depth 个缓冲区
+ * 的对应行, batch 的样本全部写完后即可由 data_loader_next 取走.
+ * 缓冲区只在 data_loader_resize 改变输入大小时重新分配.
+ */
+struct data_loader {
+    load_args args;
+    int depth;
+    data *slots;
+    int *filled;
+    size_t produced;
+    size_t consumed;
+    size_t released;
+    int busy;
+    int paused;
+    int running;
+    int nthreads;
+    pthread_t *threads;
+    pthread_mutex_t mutex;
+    pthread_cond_t ready;
+    pthread_cond_t space;
+};
+
+static int data_loader_x_cols(load_args a)
+{
+    if (a.type == CLASSIFICATION_DATA) return a.size*a.size*3;
+    return a.w*a.h*3;
+}
+
+static int data_loader_y_cols(load_args a)
+{
+    if (a.type == CLASSIFICATION_DATA) return a.classes;
+    return 5*a.num_boxes;
+}
+
+/**
+ * 一个 batch 的 X 及 y 各使用一块连续内存, 行指针指向其中
+ */
+static matrix make_matrix_contiguous(int rows, int cols)
+{
+    int i;
+    matrix m;
+    m.rows = rows;
+    m.cols = cols;
+    m.vals = calloc(rows, sizeof(float *));
+    m.vals[0] = calloc((size_t)rows*cols, sizeof(float));
+    for(i = 1; i < rows; ++i){
+        m.vals[i] = m.vals[0] + (size_t)i*cols;
+    }
+    return m;
+}
+
+static void free_matrix_contiguous(matrix m)
+{
+    free(m.vals[0]);
+    free(m.vals);
+}
+
+static void data_loader_alloc_slots(data_loader *loader)
+{
+    int i;
+    for(i = 0; i < loader->depth; ++i){
+        data d = {0};
+        d.shallow = 1;
+        d.X = make_matrix_contiguous(loader->args.n, data_loader_x_cols(loader->args));
+        d.y = make_matrix_contiguous(loader->args.n, data_loader_y_cols(loader->args));
+        loader->slots[i] = d;
+        loader->filled[i] = 0;
+    }
+}
+
+static void data_loader_free_slots(data_loader *loader)
+{
+    int i;
+    for(i = 0; i < loader->depth; ++i){
+        free_matrix_contiguous(loader->slots[i].X);
+        free_matrix_contiguous(loader->slots[i].y);
+    }
+}
+
+static void data_loader_load_sample(load_args a, float *X, float *y)
+{
+    int index = get_random_index(a.m);
+    memset(y, 0, data_loader_y_cols(a)*sizeof(float));
+    if (a.shard){
+        image orig = load_dataset_shard_image(a.shard, index);
+        char *path = dataset_shard_path(a.shard, index);
+        if (a.type == DETECTION_DATA){
+            int count = 0;
+            box_label *boxes = load_dataset_shard_boxes(a.shard, index, &count);
+            augment_detection_sample(orig, boxes, count, X, y, a.w, a.h, a.num_boxes, a.classes, a.jitter, a.hue, a.saturation, a.exposure);
+            free(boxes);
+        } else {
+            image crop = augment_image_crop(orig, a.min, a.max, a.size, a.angle, a.aspect, a.hue, a.saturation, a.exposure, a.center);
+            memcpy(X, crop.data, data_loader_x_cols(a)*sizeof(float));
+            free_image(crop);
+            if(a.labels) fill_truth(path, a.labels, a.classes, y);
+            if(a.labels && a.hierarchy) fill_hierarchy(y, a.classes, a.hierarchy);
+        }
+        free_image(orig);
+        return;
+    }
+
+    char *path = a.paths[index];
+    if (a.type == DETECTION_DATA){
+        load_detection_sample(path, X, y, a.w, a.h, a.num_boxes, a.classes, a.jitter, a.hue, a.saturation, a.exposure);
+    } else {
+        image crop = load_image_augment(path, a.min, a.max, a.size, a.angle, a.aspect, a.hue, a.saturation, a.exposure, a.center);
+        memcpy(X, crop.data, data_loader_x_cols(a)*sizeof(float));
+        free_image(crop);
+        if(a.labels) fill_truth(path, a.labels, a.classes, y);
+        if(a.labels && a.hierarchy) fill_hierarchy(y, a.classes, a.hierarchy);
+    }
+}
+
+static void *data_loader_thread(void *ptr)
+{
+    data_loader *loader = ptr;
+    pthread_mutex_lock(&loader->mutex);
+    while(1){
+        while(loader->running && (loader->paused ||
+                    loader->produced / loader->args.n >= loader->released + loader->depth)){
+            pthread_cond_wait(&loader->space, &loader->mutex);
+        }
+        if(!loader->running) break;
+
+        size_t sample = loader->produced++;
+        int slot = sample / loader->args.n % loader->depth;
+        int row = sample % loader->args.n;
+        load_args a = loader->args;
+        float *X = loader->slots[slot].X.vals[row];
+        float *y = loader->slots[slot].y.vals[row];
+        ++loader->busy;
+        pthread_mutex_unlock(&loader->mutex);
+
+        data_loader_load_sample(a, X, y);
+
+        pthread_mutex_lock(&loader->mutex);
+        --loader->busy;
+        if(++loader->filled[slot] == loader->args.n) pthread_cond_broadcast(&loader->ready);
+        if(loader->paused && !loader->busy) pthread_cond_broadcast(&loader->ready);
+    }
+    pthread_mutex_unlock(&loader->mutex);
+    return 0;
+}
+
+/**
+ * @brief  创建常驻的数据加载线程池, 启动后立即开始预取
+ * @note   args.threads 为工作线程数, depth 为环形队列中的 batch 数 (至少 2),
+ *         支持 DETECTION_DATA 及 CLASSIFICATION_DATA. args.shard 不为 NULL 时
+ *         从数据集分片中读取图像, args.m 为分片中的图像数
+ */
+data_loader *make_data_loader(load_args args, int depth)
+{
+    if (args.type != DETECTION_DATA && args.type != CLASSIFICATION_DATA) error("data loader: unsupported data type");
+    if (args.threads < 1) args.threads = 1;
+    if (depth < 2) depth = 2;
+    if (args.exposure == 0) args.exposure = 1;
+    if (args.saturation == 0) args.saturation = 1;
+    if (args.aspect == 0) args.aspect = 1;
+
+    data_loader *loader = calloc(1, sizeof(data_loader));
+    loader->args = args;
+    loader->depth = depth;
+    loader->slots = calloc(depth, sizeof(data));
+    loader->filled = calloc(depth, sizeof(int));
+    data_loader_alloc_slots(loader);
+    pthread_mutex_init(&loader->mutex, 0);
+    pthread_cond_init(&loader->ready, 0);
+    pthread_cond_init(&loader->space, 0);
+    loader->running = 1;
+
+    int i;
+    loader->nthreads = args.threads;
+    loader->threads = calloc(loader->nthreads, sizeof(pthread_t));
+    for(i = 0; i < loader->nthreads; ++i){
+        if(pthread_create(loader->threads + i, 0, data_loader_thread, loader)) error("Thread creation failed");
+    }
+    return loader;
+}
+
+/**
+ * @brief  取下一个 batch, 未加载完成时等待
+ * @note   返回的数据属于 loader, 不能调用 free_data, 在下一次调用
+ *         data_loader_next 或 data_loader_resize 之前有效
+ */
+data data_loader_next(data_loader *loader)
+{
+    pthread_mutex_lock(&loader->mutex);
+    if(loader->released < loader->consumed){
+        loader->filled[loader->released % loader->depth] = 0;
+        loader->released = loader->consumed;
+        pthread_cond_broadcast(&loader->space);
+    }
+    int slot = loader->consumed % loader->depth;
+    while(loader->filled[slot] < loader->args.n){
+        pthread_cond_wait(&loader->ready, &loader->mutex);
+    }
+    ++loader->consumed;
+    data d = loader->slots[slot];
+    pthread_mutex_unlock(&loader->mutex);
+    return d;
+}
+
+/**
+ * @brief  修改输入大小, 丢弃已预取的 batch 后按新的大小重新加载
+ */
+void data_loader_resize(data_loader *loader, int w, int h)
+{
+    pthread_mutex_lock(&loader->mutex);
+    loader->paused = 1;
+    while(loader->busy){
+        pthread_cond_wait(&loader->ready, &loader->mutex);
+    }
+    data_loader_free_slots(loader);
+    loader->args.w = w;
+    loader->args.h = h;
+    data_loader_alloc_slots(loader);
+    loader->released = loader->consumed;
+    loader->produced = loader->consumed * loader->args.n;
+    loader->paused = 0;
+    pthread_cond_broadcast(&loader->space);
+    pthread_mutex_unlock(&loader->mutex);
+}
+
+void free_data_loader(data_loader *loader)
+{
+    int i;
+    pthread_mutex_lock(&loader->mutex);
+    loader->running = 0;
+    pthread_cond_broadcast(&loader->space);
+    pthread_mutex_unlock(&loader->mutex);
+    for(i = 0; i < loader->nthreads; ++i){
+        pthread_join(loader->threads[i], 0);
+    }
+    data_loader_free_slots(loader);
+    pthread_mutex_destroy(&loader->mutex);
+    pthread_cond_destroy(&loader->ready);
+    pthread_cond_destroy(&loader->space);
+    free(loader->threads);
+    free(loader->slots);
+    free(loader->filled);
+    free(loader);
+}
+
 data load_data_writing(char **paths, int n, int m, int w, int h, int out_w, int out_h)
 {
     if(m) paths = get_random_paths(paths, n, m);
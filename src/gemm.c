@@ -4,6 +4,13 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define GEMM_X86 1
+#include <immintrin.h>
+#endif
 
 void gemm_bin(int M, int N, int K, float ALPHA, 
         char  *A, int lda, 
@@ -37,31 +44,6 @@ float *random_matrix(int rows, int cols)
     return m;
 }
 
-void time_random_matrix(int TA, int TB, int m, int k, int n)
-{
-    float *a;
-    if(!TA) a = random_matrix(m,k);
-    else a = random_matrix(k,m);
-    int lda = (!TA)?k:m;
-    float *b;
-    if(!TB) b = random_matrix(k,n);
-    else b = random_matrix(n,k);
-    int ldb = (!TB)?n:k;
-
-    float *c = random_matrix(m,n);
-    int i;
-    clock_t start = clock(), end;
-    for(i = 0; i<10; ++i){
-        gemm_cpu(TA,TB,m,n,k,1,a,lda,b,ldb,1,c,n);
-    }
-    end = clock();
-    printf("Matrix Multiplication %dx%d * %dx%d, TA=%d, TB=%d: %lf ms\n",m,k,k,n, TA, TB, (float)(end-start)/CLOCKS_PER_SEC);
-    free(a);
-    free(b);
-    free(c);
-}
-
-
 void gemm(int TA, int TB, int M, int N, int K, float ALPHA, 
         float *A, int lda, 
         float *B, int ldb,
@@ -142,6 +124,361 @@ void gemm_tt(int M, int N, int K, float ALPHA,
 }
 
 
+/**
+ * 分块打包的矩阵乘法 (BLIS 方式)
+ *   C[M][N] += ALPHA * op(A)[M][K] x op(B)[K][N]
+ * K 按 GEMM_KC 分段, N 按 GEMM_NC 分段. 每段先把 op(B) 按 GEMM_NR 列一组打包为
+ * [N/NR][KC][NR], 把 ALPHA * op(A) 按 GEMM_MR 行一组打包为 [M/MR][KC][MR],
+ * 转置及 ALPHA 在打包时完成, 不足一组的行列填 0, 因此四种转置组合共用同一个计算核.
+ * 计算时每个任务处理 GEMM_MC 行 x GEMM_NR 列, 打包后的 B 列块在 L1 缓存中被
+ * 这 GEMM_MC 行重复使用, A 行块在 L2 缓存中被相邻的列块重复使用.
+ */
+#define GEMM_MR 6
+#define GEMM_NR 16
+#define GEMM_MC (GEMM_MR * 16)
+#define GEMM_KC 256
+#define GEMM_NC (GEMM_NR * 256)
+
+/**
+ * 运算量小于该值或行列不足一组时使用未分块的实现, 打包的开销大于收益
+ */
+#define GEMM_PACK_MIN_OPS (64 * 64 * 16)
+
+typedef void (*gemm_task_1d_t)(void *, size_t);
+typedef void (*gemm_task_2d_t)(void *, size_t, size_t);
+
+typedef struct {
+    int TA, TB;
+    int M, N;
+    float ALPHA;
+    float *A; int lda;
+    float *B; int ldb;
+    float *C; int ldc;
+    int pc, kc;
+    int jc, nc;
+    const im2col_matrix *col;
+    int out_w;
+    gemm_task_1d_t pack_b;
+    float *packed_a;
+    float *packed_b;
+    void (*kernel)(int, const float *, const float *, float *, int, int, int);
+} gemm_pack_args;
+
+/**
+ * 打包缓冲区按线程分配并重复使用, 线程退出时释放
+ */
+typedef struct {
+    float *data;
+    size_t size;
+} gemm_workspace;
+
+static pthread_key_t gemm_workspace_key;
+static pthread_once_t gemm_workspace_once = PTHREAD_ONCE_INIT;
+
+static void gemm_workspace_free(void *ptr)
+{
+    gemm_workspace *ws = ptr;
+    free(ws->data);
+    free(ws);
+}
+
+static void gemm_workspace_init()
+{
+    pthread_key_create(&gemm_workspace_key, gemm_workspace_free);
+}
+
+static float *gemm_get_workspace(size_t size)
+{
+    pthread_once(&gemm_workspace_once, gemm_workspace_init);
+    gemm_workspace *ws = pthread_getspecific(gemm_workspace_key);
+    if(!ws){
+        ws = calloc(1, sizeof(gemm_workspace));
+        pthread_setspecific(gemm_workspace_key, ws);
+    }
+    if(ws->size < size){
+        free(ws->data);
+        ws->data = 0;
+        if(posix_memalign((void **)&ws->data, 64, size*sizeof(float))) malloc_error();
+        ws->size = size;
+    }
+    return ws->data;
+}
+
+#ifdef NNPACK
+static __thread pthreadpool_t gemm_threadpool = 0;
+
+pthreadpool_t gemm_set_threadpool(pthreadpool_t threadpool)
+{
+    pthreadpool_t prev = gemm_threadpool;
+    gemm_threadpool = threadpool;
+    return prev;
+}
+#endif
+
+static void gemm_compute_1d(gemm_task_1d_t task, void *args, size_t range)
+{
+#ifdef NNPACK
+    pthreadpool_compute_1d(gemm_threadpool, (pthreadpool_function_1d_t)task, args, range);
+#else
+    int i;
+    #pragma omp parallel for
+    for(i = 0; i < (int)range; ++i){
+        task(args, i);
+    }
+#endif
+}
+
+static void gemm_compute_2d(gemm_task_2d_t task, void *args, size_t range_i, size_t range_j)
+{
+#ifdef NNPACK
+    pthreadpool_compute_2d(gemm_threadpool, (pthreadpool_function_2d_t)task, args, range_i, range_j);
+#else
+    int t;
+    #pragma omp parallel for
+    for(t = 0; t < (int)(range_i*range_j); ++t){
+        task(args, t / range_j, t % range_j);
+    }
+#endif
+}
+
+static void gemm_pack_a_thread(gemm_pack_args *p, size_t panel)
+{
+    float *dst = p->packed_a + panel*p->kc*GEMM_MR;
+    int m0 = panel*GEMM_MR;
+    int r, k;
+    for(r = 0; r < GEMM_MR; ++r){
+        int m = m0 + r;
+        if(m >= p->M){
+            for(k = 0; k < p->kc; ++k) dst[k*GEMM_MR + r] = 0;
+        } else if(!p->TA){
+            float *src = p->A + m*p->lda + p->pc;
+            for(k = 0; k < p->kc; ++k) dst[k*GEMM_MR + r] = p->ALPHA*src[k];
+        } else {
+            float *src = p->A + p->pc*p->lda + m;
+            for(k = 0; k < p->kc; ++k) dst[k*GEMM_MR + r] = p->ALPHA*src[k*p->lda];
+        }
+    }
+}
+
+static void gemm_pack_b_thread(gemm_pack_args *p, size_t panel)
+{
+    float *dst = p->packed_b + panel*p->kc*GEMM_NR;
+    int n0 = p->jc + panel*GEMM_NR;
+    int cols = p->N - n0;
+    if(cols > GEMM_NR) cols = GEMM_NR;
+    int j, k;
+    if(!p->TB){
+        float *src = p->B + p->pc*p->ldb + n0;
+        for(k = 0; k < p->kc; ++k, dst += GEMM_NR, src += p->ldb){
+            for(j = 0; j < cols; ++j) dst[j] = src[j];
+            for(; j < GEMM_NR; ++j) dst[j] = 0;
+        }
+    } else {
+        for(j = 0; j < GEMM_NR; ++j){
+            if(j < cols){
+                float *src = p->B + (n0 + j)*p->ldb + p->pc;
+                for(k = 0; k < p->kc; ++k) dst[k*GEMM_NR + j] = src[k];
+            } else {
+                for(k = 0; k < p->kc; ++k) dst[k*GEMM_NR + j] = 0;
+            }
+        }
+    }
+}
+
+/**
+ * 从输入图像直接打包 im2col 矩阵的一个列块, 列为输出像素, 行为卷积核元素,
+ * 步长为 1 且一组列位于同一输出行并完全在图像内时整段复制
+ */
+static void gemm_pack_im2col_thread(gemm_pack_args *p, size_t panel)
+{
+    const im2col_matrix *col = p->col;
+    float *dst = p->packed_b + panel*p->kc*GEMM_NR;
+    int n0 = p->jc + panel*GEMM_NR;
+    int cols = p->N - n0;
+    if(cols > GEMM_NR) cols = GEMM_NR;
+
+    int y0[GEMM_NR], x0[GEMM_NR];
+    int j, k;
+    for(j = 0; j < cols; ++j){
+        y0[j] = (n0 + j)/p->out_w*col->stride - col->pad;
+        x0[j] = (n0 + j)%p->out_w*col->stride - col->pad;
+    }
+    int contiguous = GEMM_NR == cols && 1 == col->stride && y0[0] == y0[GEMM_NR - 1];
+
+    for(k = 0; k < p->kc; ++k, dst += GEMM_NR){
+        int r = p->pc + k;
+        int w_offset = r % col->ksize;
+        int h_offset = r / col->ksize % col->ksize;
+        const float *im = col->im + r / col->ksize / col->ksize * col->height * col->width;
+        if(contiguous){
+            int y = y0[0] + h_offset;
+            int x = x0[0] + w_offset;
+            if(y >= 0 && y < col->height && x >= 0 && x + GEMM_NR <= col->width){
+                memcpy(dst, im + y*col->width + x, sizeof(float)*GEMM_NR);
+                continue;
+            }
+        }
+        for(j = 0; j < cols; ++j){
+            int y = y0[j] + h_offset;
+            int x = x0[j] + w_offset;
+            dst[j] = (y >= 0 && y < col->height && x >= 0 && x < col->width) ? im[y*col->width + x] : 0;
+        }
+        for(; j < GEMM_NR; ++j) dst[j] = 0;
+    }
+}
+
+/**
+ * 打包转置后的 im2col 矩阵, 列为卷积核元素, 行为输出像素
+ */
+static void gemm_pack_im2col_t_thread(gemm_pack_args *p, size_t panel)
+{
+    const im2col_matrix *col = p->col;
+    float *dst = p->packed_b + panel*p->kc*GEMM_NR;
+    int n0 = p->jc + panel*GEMM_NR;
+    int cols = p->N - n0;
+    if(cols > GEMM_NR) cols = GEMM_NR;
+    int j, k;
+    for(j = 0; j < GEMM_NR; ++j){
+        if(j >= cols){
+            for(k = 0; k < p->kc; ++k) dst[k*GEMM_NR + j] = 0;
+            continue;
+        }
+        int r = n0 + j;
+        int w_offset = r % col->ksize - col->pad;
+        int h_offset = r / col->ksize % col->ksize - col->pad;
+        const float *im = col->im + r / col->ksize / col->ksize * col->height * col->width;
+        int oy = p->pc / p->out_w;
+        int ox = p->pc % p->out_w;
+        for(k = 0; k < p->kc; ++k){
+            int y = oy*col->stride + h_offset;
+            int x = ox*col->stride + w_offset;
+            dst[k*GEMM_NR + j] = (y >= 0 && y < col->height && x >= 0 && x < col->width) ? im[y*col->width + x] : 0;
+            if(++ox == p->out_w){
+                ox = 0;
+                ++oy;
+            }
+        }
+    }
+}
+
+/**
+ * 计算核: C[rows][cols] += a[kc][MR] x b[kc][NR], rows <= MR, cols <= NR
+ */
+static void gemm_kernel_cpu(int kc, const float *a, const float *b,
+        float *c, int ldc, int rows, int cols)
+{
+    float sum[GEMM_MR][GEMM_NR] = {{0}};
+    int k, r, j;
+    for(k = 0; k < kc; ++k, a += GEMM_MR, b += GEMM_NR){
+        for(r = 0; r < GEMM_MR; ++r){
+            for(j = 0; j < GEMM_NR; ++j){
+                sum[r][j] += a[r]*b[j];
+            }
+        }
+    }
+    for(r = 0; r < rows; ++r){
+        for(j = 0; j < cols; ++j){
+            c[r*ldc + j] += sum[r][j];
+        }
+    }
+}
+
+#ifdef GEMM_X86
+static const int gemm_tail_mask[16] = {-1, -1, -1, -1, -1, -1, -1, -1,
+                                        0,  0,  0,  0,  0,  0,  0,  0};
+
+/**
+ * gemm_kernel_cpu 的 AVX2/FMA 版本, 6 行 x 16 列共 12 个累加寄存器,
+ * 列不足 16 时使用掩码读写 C
+ */
+__attribute__((target("avx2,fma")))
+static void gemm_kernel_avx(int kc, const float *a, const float *b,
+        float *c, int ldc, int rows, int cols)
+{
+    __m256 sum0[GEMM_MR];
+    __m256 sum1[GEMM_MR];
+    int k, r;
+    for(r = 0; r < GEMM_MR; ++r){
+        sum0[r] = _mm256_setzero_ps();
+        sum1[r] = _mm256_setzero_ps();
+    }
+    for(k = 0; k < kc; ++k, a += GEMM_MR, b += GEMM_NR){
+        __m256 b0 = _mm256_load_ps(b);
+        __m256 b1 = _mm256_load_ps(b + 8);
+        for(r = 0; r < GEMM_MR; ++r){
+            __m256 w = _mm256_broadcast_ss(a + r);
+            sum0[r] = _mm256_fmadd_ps(b0, w, sum0[r]);
+            sum1[r] = _mm256_fmadd_ps(b1, w, sum1[r]);
+        }
+    }
+
+    if(GEMM_NR == cols){
+        for(r = 0; r < rows; ++r, c += ldc){
+            _mm256_storeu_ps(c, _mm256_add_ps(_mm256_loadu_ps(c), sum0[r]));
+            _mm256_storeu_ps(c + 8, _mm256_add_ps(_mm256_loadu_ps(c + 8), sum1[r]));
+        }
+    } else {
+        int r0 = cols < 8 ? cols : 8;
+        int r1 = cols - r0;
+        __m256i mask0 = _mm256_loadu_si256((const __m256i *)(gemm_tail_mask + 8 - r0));
+        __m256i mask1 = _mm256_loadu_si256((const __m256i *)(gemm_tail_mask + 8 - r1));
+        for(r = 0; r < rows; ++r, c += ldc){
+            _mm256_maskstore_ps(c, mask0, _mm256_add_ps(_mm256_maskload_ps(c, mask0), sum0[r]));
+            _mm256_maskstore_ps(c + 8, mask1, _mm256_add_ps(_mm256_maskload_ps(c + 8, mask1), sum1[r]));
+        }
+    }
+}
+#endif
+
+static void gemm_block_thread(gemm_pack_args *p, size_t block, size_t panel)
+{
+    int n0 = p->jc + panel*GEMM_NR;
+    int cols = p->N - n0;
+    if(cols > GEMM_NR) cols = GEMM_NR;
+    int m0 = block*GEMM_MC;
+    int m1 = m0 + GEMM_MC;
+    if(m1 > p->M) m1 = p->M;
+
+    const float *b = p->packed_b + panel*p->kc*GEMM_NR;
+    int m;
+    for(m = m0; m < m1; m += GEMM_MR){
+        int rows = m1 - m;
+        if(rows > GEMM_MR) rows = GEMM_MR;
+        p->kernel(p->kc, p->packed_a + m*p->kc, b, p->C + m*p->ldc + n0, p->ldc, rows, cols);
+    }
+}
+
+/**
+ * 分块计算 p->C += ALPHA * op(A) x op(B), 调用前需设置 p 中的矩阵参数及 B 的打包函数
+ */
+static void gemm_packed(gemm_pack_args *p, int K)
+{
+    int M = p->M;
+    int N = p->N;
+    int mpanels = (M + GEMM_MR - 1)/GEMM_MR;
+    int blocks = (M + GEMM_MC - 1)/GEMM_MC;
+    int kc_max = K < GEMM_KC ? K : GEMM_KC;
+    int nc_max = N < GEMM_NC ? (N + GEMM_NR - 1)/GEMM_NR*GEMM_NR : GEMM_NC;
+    p->packed_b = gemm_get_workspace((size_t)(nc_max + mpanels*GEMM_MR)*kc_max);
+    p->packed_a = p->packed_b + (size_t)nc_max*kc_max;
+    p->kernel = gemm_kernel_cpu;
+#ifdef GEMM_X86
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) p->kernel = gemm_kernel_avx;
+#endif
+
+    for(p->jc = 0; p->jc < N; p->jc += GEMM_NC){
+        p->nc = N - p->jc < GEMM_NC ? N - p->jc : GEMM_NC;
+        int npanels = (p->nc + GEMM_NR - 1)/GEMM_NR;
+        for(p->pc = 0; p->pc < K; p->pc += GEMM_KC){
+            p->kc = K - p->pc < GEMM_KC ? K - p->pc : GEMM_KC;
+            gemm_compute_1d(p->pack_b, p, npanels);
+            gemm_compute_1d((gemm_task_1d_t)gemm_pack_a_thread, p, mpanels);
+            gemm_compute_2d((gemm_task_2d_t)gemm_block_thread, p, blocks, npanels);
+        }
+    }
+}
+
+
 void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA, 
         float *A, int lda, 
         float *B, int ldb,
@@ -150,12 +487,25 @@ void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA,
 {
     //printf("cpu: %d %d %d %d %d %f %d %d %f %d\n",TA, TB, M, N, K, ALPHA, lda, ldb, BETA, ldc);
     int i, j;
-    for(i = 0; i < M; ++i){
-        for(j = 0; j < N; ++j){
-            C[i*ldc + j] *= BETA;
+    if(BETA != 1){
+        for(i = 0; i < M; ++i){
+            for(j = 0; j < N; ++j){
+                C[i*ldc + j] *= BETA;
+            }
         }
     }
-    if(!TA && !TB)
+    if(M >= GEMM_MR && N >= GEMM_NR && (double)M*N*K >= GEMM_PACK_MIN_OPS){
+        gemm_pack_args p = {0};
+        p.TA = TA; p.TB = TB;
+        p.M = M; p.N = N;
+        p.ALPHA = ALPHA;
+        p.A = A; p.lda = lda;
+        p.B = B; p.ldb = ldb;
+        p.C = C; p.ldc = ldc;
+        p.pack_b = (gemm_task_1d_t)gemm_pack_b_thread;
+        gemm_packed(&p, K);
+    }
+    else if(!TA && !TB)
         gemm_nn(M, N, K, ALPHA,A,lda, B, ldb,C,ldc);
     else if(TA && !TB)
         gemm_tn(M, N, K, ALPHA,A,lda, B, ldb,C,ldc);
@@ -165,6 +515,81 @@ void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA,
         gemm_tt(M, N, K, ALPHA,A,lda, B, ldb,C,ldc);
 }
 
+/**
+ * @brief  C = ALPHA * op(A) x op(B) + BETA * C, B 为 im2col_cpu 展开后的矩阵
+ * @note   卷积的输入块在打包时直接从图像中读取, 不需要展开矩阵的缓冲区.
+ *         TB 为 0 时 B 为 [channels*ksize*ksize][out_h*out_w], 为 1 时使用其转置
+ */
+void gemm_im2col_cpu(int TA, int TB, int M, int N, int K, float ALPHA,
+        float *A, int lda,
+        const im2col_matrix *B,
+        float BETA,
+        float *C, int ldc)
+{
+    int i, j;
+    if(BETA != 1){
+        for(i = 0; i < M; ++i){
+            for(j = 0; j < N; ++j){
+                C[i*ldc + j] *= BETA;
+            }
+        }
+    }
+    if(M <= 0 || N <= 0 || K <= 0) return;
+    gemm_pack_args p = {0};
+    p.TA = TA; p.TB = TB;
+    p.M = M; p.N = N;
+    p.ALPHA = ALPHA;
+    p.A = A; p.lda = lda;
+    p.C = C; p.ldc = ldc;
+    p.col = B;
+    p.out_w = (B->width + 2*B->pad - B->ksize)/B->stride + 1;
+    p.pack_b = TB ? (gemm_task_1d_t)gemm_pack_im2col_t_thread : (gemm_task_1d_t)gemm_pack_im2col_thread;
+    gemm_packed(&p, K);
+}
+
+/**
+ * @brief  测试 gemm_cpu 的速度, 输出每次调用的时间及 GFLOPS,
+ *         并与未分块的实现比较, 输出结果的最大误差
+ */
+void time_random_matrix(int TA, int TB, int m, int k, int n)
+{
+    float *a;
+    if(!TA) a = random_matrix(m,k);
+    else a = random_matrix(k,m);
+    int lda = (!TA)?k:m;
+    float *b;
+    if(!TB) b = random_matrix(k,n);
+    else b = random_matrix(n,k);
+    int ldb = (!TB)?n:k;
+
+    float *c = calloc(m*n, sizeof(float));
+    float *c_ref = calloc(m*n, sizeof(float));
+    if(!TA && !TB) gemm_nn(m,n,k,1,a,lda,b,ldb,c_ref,n);
+    else if(TA && !TB) gemm_tn(m,n,k,1,a,lda,b,ldb,c_ref,n);
+    else if(!TA && TB) gemm_nt(m,n,k,1,a,lda,b,ldb,c_ref,n);
+    else gemm_tt(m,n,k,1,a,lda,b,ldb,c_ref,n);
+    gemm_cpu(TA,TB,m,n,k,1,a,lda,b,ldb,0,c,n);
+    float max_diff = 0;
+    int i;
+    for(i = 0; i < m*n; ++i){
+        float diff = fabs(c[i] - c_ref[i]);
+        if(diff > max_diff) max_diff = diff;
+    }
+
+    int iters = 10;
+    double start = what_time_is_it_now();
+    for(i = 0; i < iters; ++i){
+        gemm_cpu(TA,TB,m,n,k,1,a,lda,b,ldb,1,c,n);
+    }
+    double t = (what_time_is_it_now() - start)/iters;
+    printf("Matrix Multiplication %dx%d * %dx%d, TA=%d, TB=%d: %lf ms, %.2f GFLOPS, max diff %g\n",
+            m,k,k,n, TA, TB, t*1000, 2.0*m*n*k/t/1e9, max_diff);
+    free(a);
+    free(b);
+    free(c);
+    free(c_ref);
+}
+
 #ifdef GPU
 
 #include <math.h>
@@ -1,6 +1,12 @@
 #ifndef GEMM_H
 #define GEMM_H
 
+#include "im2col.h"
+
+#ifdef NNPACK
+#include <pthreadpool.h>
+#endif
+
 void gemm_bin(int M, int N, int K, float ALPHA, 
         char  *A, int lda, 
         float *B, int ldb,
@@ -18,6 +24,23 @@ void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA,
         float BETA,
         float *C, int ldc);
 
+void gemm_im2col_cpu(int TA, int TB, int M, int N, int K, float ALPHA,
+        float *A, int lda,
+        const im2col_matrix *B,
+        float BETA,
+        float *C, int ldc);
+
+void time_random_matrix(int TA, int TB, int m, int k, int n);
+
+#ifdef NNPACK
+/**
+ * @brief  设置当前线程调用 gemm_cpu 时使用的线程池
+ * @note   线程池只对调用线程有效, 为 NULL 时单线程计算
+ * @retval 之前设置的线程池
+ */
+pthreadpool_t gemm_set_threadpool(pthreadpool_t threadpool);
+#endif
+
 #ifdef GPU
 void gemm_gpu(int TA, int TB, int M, int N, int K, float ALPHA, 
         float *A_gpu, int lda, 
@@ -1,6 +1,16 @@
 #ifndef IM2COL_H
 #define IM2COL_H
 
+/**
+ * im2col_cpu 展开的矩阵, 行为 channels*ksize*ksize 个卷积核元素, 列为输出像素,
+ * 供 gemm_im2col_cpu 在打包时直接从 im 中读取
+ */
+typedef struct {
+    float *im;
+    int channels, height, width;
+    int ksize, stride, pad;
+} im2col_matrix;
+
 void im2col_cpu(float* data_im,
         int channels, int height, int width,
         int ksize, int stride, int pad, float* data_col);
@@ -10,6 +10,15 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
+#ifdef NNPACK
+#include "imgproc/imgproc.h"
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#define IMAGE_X86 1
+#include <immintrin.h>
+#endif
+
 int windows = 0;
 
 float colors[6][3] = {{1, 0, 1}, {0, 0, 1}, {0, 1, 1},
@@ -631,6 +640,17 @@ void save_image_png(image im, const char *name) {
     fprintf(stderr, "Failed to write image %s\n", buff);
 }
 
+/**
+ * @brief  保存 8 位交错排列的图像数据为 png, 不经过浮点图片
+ */
+void save_image_data(const unsigned char *data, int w, int h, int c,
+                     const char *name) {
+  char buff[256];
+  snprintf(buff, sizeof(buff), "%s.png", name);
+  if (!stbi_write_png(buff, w, h, c, data, w * c))
+    fprintf(stderr, "Failed to write image %s\n", buff);
+}
+
 void save_image(image im, const char *name) {
 #ifdef OPENCV
   save_image_jpg(im, name);
@@ -916,23 +936,36 @@ void resize_image_compute_h(struct resize_image_params *params, size_t k,
   }
 }
 
-image resize_image_thread(image im, int w, int h, pthreadpool_t threadpool) {
-  image resized = make_image(w, h, im.c);
-  image part = make_image(w, im.h, im.c);
-
-  struct resize_image_params params = {im, resized, part, w, h};
+/**
+ * @brief  缩放结果写入 resized, part 为水平缩放后的中间结果, 大小为 resized.w x im.h
+ */
+static void resize_image_into_thread(image im, image resized, image part,
+                                     pthreadpool_t threadpool) {
+  struct resize_image_params params = {im, resized, part, resized.w, resized.h};
   pthreadpool_compute_2d(threadpool,
                          (pthreadpool_function_2d_t)resize_image_compute_w,
                          &params, im.c, im.h);
   pthreadpool_compute_2d(threadpool,
                          (pthreadpool_function_2d_t)resize_image_compute_h,
-                         &params, im.c, h);
+                         &params, im.c, resized.h);
+}
 
+image resize_image_thread(image im, int w, int h, pthreadpool_t threadpool) {
+  image resized = make_image(w, h, im.c);
+  image part = make_image(w, im.h, im.c);
+  resize_image_into_thread(im, resized, part, threadpool);
   free_image(part);
   return resized;
 }
 
-image letterbox_image_thread(image im, int w, int h, pthreadpool_t threadpool) {
+/**
+ * @brief  letterbox_image_thread 的结果直接写入 boxed, boxed 已分配且大小为 w x h
+ * @note   用于把多张图片放入同一个批量输入中, 不缩放的区域填 .5;
+ *         plans 不为空时缩放的中间结果使用其中的临时缓冲区, 不再申请内存
+ */
+void letterbox_image_into_thread(image im, int w, int h, image boxed,
+                                 struct resize_plan_cache *plans,
+                                 pthreadpool_t threadpool) {
   int new_w = im.w;
   int new_h = im.h;
   if (((float)w / im.w) < ((float)h / im.h)) {
@@ -942,13 +975,31 @@ image letterbox_image_thread(image im, int w, int h, pthreadpool_t threadpool) {
     new_h = h;
     new_w = (im.w * h) / im.h;
   }
-  image resized = resize_image_thread(im, new_w, new_h, threadpool);
-  image boxed = make_image(w, h, im.c);
+
+  float *scratch = NULL;
+  if (plans)
+    scratch = resize_plan_cache_scratch(
+        plans, sizeof(float) * new_w * (new_h + im.h) * im.c);
+  image resized, part;
+  if (scratch) {
+    resized = float_to_image(new_w, new_h, im.c, scratch);
+    part = float_to_image(new_w, im.h, im.c, scratch + new_w * new_h * im.c);
+  } else {
+    resized = make_image(new_w, new_h, im.c);
+    part = make_image(new_w, im.h, im.c);
+  }
+  resize_image_into_thread(im, resized, part, threadpool);
   fill_image(boxed, .5);
-  // int i;
-  // for(i = 0; i < boxed.w*boxed.h*boxed.c; ++i) boxed.data[i] = 0;
   embed_image(resized, boxed, (w - new_w) / 2, (h - new_h) / 2);
-  free_image(resized);
+  if (!scratch) {
+    free_image(resized);
+    free_image(part);
+  }
+}
+
+image letterbox_image_thread(image im, int w, int h, pthreadpool_t threadpool) {
+  image boxed = make_image(w, h, im.c);
+  letterbox_image_into_thread(im, w, h, boxed, NULL, threadpool);
   return boxed;
 }
 #endif
@@ -1308,28 +1359,261 @@ void exposure_image(image im, float sat) {
   constrain_image(im);
 }
 
-void distort_image(image im, float hue, float sat, float val) {
-  rgb_to_hsv(im);
-  scale_image_channel(im, 1, sat);
-  scale_image_channel(im, 2, val);
+/**
+ * HSV 空间的色调/饱和度/曝光调整按像素融合计算: 每个像素转换到 HSV, 调整后
+ * 转换回 RGB 并截断到 [0, 1], 结果与 rgb_to_hsv, scale_image_channel,
+ * hsv_to_rgb 及 constrain_image 依次处理相同, 只需遍历一次图像.
+ * 水平翻转在同一次遍历中完成: 对称的两个像素 (块) 一起读入, 调整后交换写回.
+ */
+struct distort_params {
+  float hue;
+  float sat;
+  float val;
+};
+
+static inline void distort_pixel(float *pr, float *pg, float *pb,
+                                 const struct distort_params *p) {
+  float r = *pr, g = *pg, b = *pb;
+  float max = three_way_max(r, g, b);
+  float min = three_way_min(r, g, b);
+  float delta = max - min;
+  float h = 0, s = 0, v = max;
+  if (max != 0 && delta != 0) {
+    s = delta / max;
+    if (r == max) {
+      h = (g - b) / delta;
+    } else if (g == max) {
+      h = 2 + (b - r) / delta;
+    } else {
+      h = 4 + (r - g) / delta;
+    }
+    if (h < 0)
+      h += 6;
+    h = h / 6.f;
+  }
+  s *= p->sat;
+  v *= p->val;
+  h += p->hue;
+  if (h > 1)
+    h -= 1;
+  if (h < 0)
+    h += 1;
+
+  if (s == 0) {
+    r = g = b = v;
+  } else {
+    h = 6 * h;
+    int index = floorf(h);
+    float f = h - index;
+    float q0 = v * (1 - s);
+    float q1 = v * (1 - s * f);
+    float q2 = v * (1 - s * (1 - f));
+    if (index == 0) {
+      r = v, g = q2, b = q0;
+    } else if (index == 1) {
+      r = q1, g = v, b = q0;
+    } else if (index == 2) {
+      r = q0, g = v, b = q2;
+    } else if (index == 3) {
+      r = q0, g = q1, b = v;
+    } else if (index == 4) {
+      r = q2, g = q0, b = v;
+    } else {
+      r = v, g = q0, b = q1;
+    }
+  }
+  *pr = constrain(0, 1, r);
+  *pg = constrain(0, 1, g);
+  *pb = constrain(0, 1, b);
+}
+
+static void distort_row_cpu(float *r, float *g, float *b, int n, int flip,
+                            const struct distort_params *p) {
   int i;
-  for (i = 0; i < im.w * im.h; ++i) {
-    im.data[i] = im.data[i] + hue;
-    if (im.data[i] > 1)
-      im.data[i] -= 1;
-    if (im.data[i] < 0)
-      im.data[i] += 1;
+  if (!flip) {
+    for (i = 0; i < n; ++i)
+      distort_pixel(r + i, g + i, b + i, p);
+    return;
   }
-  hsv_to_rgb(im);
-  constrain_image(im);
+  for (i = 0; i < n / 2; ++i) {
+    int j = n - 1 - i;
+    distort_pixel(r + i, g + i, b + i, p);
+    distort_pixel(r + j, g + j, b + j, p);
+    float t;
+    t = r[i], r[i] = r[j], r[j] = t;
+    t = g[i], g[i] = g[j], g[j] = t;
+    t = b[i], b[i] = b[j], b[j] = t;
+  }
+  if (n % 2)
+    distort_pixel(r + n / 2, g + n / 2, b + n / 2, p);
+}
+
+#ifdef IMAGE_X86
+/**
+ * distort_pixel 的 AVX2 版本, 一次处理 8 个像素, 分支改为按掩码选择
+ */
+__attribute__((target("avx2,fma"))) static inline void
+distort_pixels_avx(__m256 *pr, __m256 *pg, __m256 *pb,
+                   const struct distort_params *p) {
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 one = _mm256_set1_ps(1.f);
+  const __m256 six = _mm256_set1_ps(6.f);
+  __m256 r = *pr, g = *pg, b = *pb;
+
+  __m256 max = _mm256_max_ps(r, _mm256_max_ps(g, b));
+  __m256 min = _mm256_min_ps(r, _mm256_min_ps(g, b));
+  __m256 delta = _mm256_sub_ps(max, min);
+  __m256 valid = _mm256_and_ps(_mm256_cmp_ps(max, zero, _CMP_NEQ_OQ),
+                               _mm256_cmp_ps(delta, zero, _CMP_NEQ_OQ));
+  __m256 safe_max = _mm256_blendv_ps(one, max, valid);
+  __m256 safe_delta = _mm256_blendv_ps(one, delta, valid);
+
+  __m256 s = _mm256_and_ps(_mm256_div_ps(delta, safe_max), valid);
+  __m256 hr = _mm256_div_ps(_mm256_sub_ps(g, b), safe_delta);
+  __m256 hg = _mm256_add_ps(_mm256_set1_ps(2.f),
+                            _mm256_div_ps(_mm256_sub_ps(b, r), safe_delta));
+  __m256 hb = _mm256_add_ps(_mm256_set1_ps(4.f),
+                            _mm256_div_ps(_mm256_sub_ps(r, g), safe_delta));
+  __m256 h = _mm256_blendv_ps(hb, hg, _mm256_cmp_ps(g, max, _CMP_EQ_OQ));
+  h = _mm256_blendv_ps(h, hr, _mm256_cmp_ps(r, max, _CMP_EQ_OQ));
+  h = _mm256_add_ps(h, _mm256_and_ps(six, _mm256_cmp_ps(h, zero, _CMP_LT_OQ)));
+  h = _mm256_and_ps(_mm256_div_ps(h, six), valid);
+
+  s = _mm256_mul_ps(s, _mm256_set1_ps(p->sat));
+  __m256 v = _mm256_mul_ps(max, _mm256_set1_ps(p->val));
+  h = _mm256_add_ps(h, _mm256_set1_ps(p->hue));
+  h = _mm256_sub_ps(h, _mm256_and_ps(one, _mm256_cmp_ps(h, one, _CMP_GT_OQ)));
+  h = _mm256_add_ps(h, _mm256_and_ps(one, _mm256_cmp_ps(h, zero, _CMP_LT_OQ)));
+
+  h = _mm256_mul_ps(h, six);
+  __m256 index = _mm256_floor_ps(h);
+  __m256 f = _mm256_sub_ps(h, index);
+  __m256 q0 = _mm256_mul_ps(v, _mm256_sub_ps(one, s));
+  __m256 q1 = _mm256_mul_ps(v, _mm256_sub_ps(one, _mm256_mul_ps(s, f)));
+  __m256 q2 = _mm256_mul_ps(
+      v, _mm256_sub_ps(one, _mm256_mul_ps(s, _mm256_sub_ps(one, f))));
+
+  /* 默认为 index >= 5 的情况, 再依次覆盖 index 为 4..0 的像素 */
+  __m256 rr = v, rg = q0, rb = q1;
+  __m256 m = _mm256_cmp_ps(index, _mm256_set1_ps(4.f), _CMP_EQ_OQ);
+  rr = _mm256_blendv_ps(rr, q2, m);
+  rg = _mm256_blendv_ps(rg, q0, m);
+  rb = _mm256_blendv_ps(rb, v, m);
+  m = _mm256_cmp_ps(index, _mm256_set1_ps(3.f), _CMP_EQ_OQ);
+  rr = _mm256_blendv_ps(rr, q0, m);
+  rg = _mm256_blendv_ps(rg, q1, m);
+  rb = _mm256_blendv_ps(rb, v, m);
+  m = _mm256_cmp_ps(index, _mm256_set1_ps(2.f), _CMP_EQ_OQ);
+  rr = _mm256_blendv_ps(rr, q0, m);
+  rg = _mm256_blendv_ps(rg, v, m);
+  rb = _mm256_blendv_ps(rb, q2, m);
+  m = _mm256_cmp_ps(index, one, _CMP_EQ_OQ);
+  rr = _mm256_blendv_ps(rr, q1, m);
+  rg = _mm256_blendv_ps(rg, v, m);
+  rb = _mm256_blendv_ps(rb, q0, m);
+  m = _mm256_cmp_ps(index, zero, _CMP_EQ_OQ);
+  rr = _mm256_blendv_ps(rr, v, m);
+  rg = _mm256_blendv_ps(rg, q2, m);
+  rb = _mm256_blendv_ps(rb, q0, m);
+
+  m = _mm256_cmp_ps(s, zero, _CMP_EQ_OQ);
+  rr = _mm256_blendv_ps(rr, v, m);
+  rg = _mm256_blendv_ps(rg, v, m);
+  rb = _mm256_blendv_ps(rb, v, m);
+
+  *pr = _mm256_min_ps(_mm256_max_ps(rr, zero), one);
+  *pg = _mm256_min_ps(_mm256_max_ps(rg, zero), one);
+  *pb = _mm256_min_ps(_mm256_max_ps(rb, zero), one);
+}
+
+__attribute__((target("avx2,fma"))) static inline __m256
+reverse_ps_avx(__m256 x) {
+  return _mm256_permutevar8x32_ps(x, _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+}
+
+__attribute__((target("avx2,fma"))) static void
+distort_row_avx(float *r, float *g, float *b, int n, int flip,
+                const struct distort_params *p) {
+  int i = 0;
+  if (!flip) {
+    for (; i + 8 <= n; i += 8) {
+      __m256 vr = _mm256_loadu_ps(r + i);
+      __m256 vg = _mm256_loadu_ps(g + i);
+      __m256 vb = _mm256_loadu_ps(b + i);
+      distort_pixels_avx(&vr, &vg, &vb, p);
+      _mm256_storeu_ps(r + i, vr);
+      _mm256_storeu_ps(g + i, vg);
+      _mm256_storeu_ps(b + i, vb);
+    }
+    distort_row_cpu(r + i, g + i, b + i, n - i, 0, p);
+    return;
+  }
+  /* 左侧 [i, i+8) 与右侧 [n-i-8, n-i) 两块一起处理, 反转后交换写回 */
+  for (; 2 * i + 16 <= n; i += 8) {
+    int j = n - i - 8;
+    __m256 lr = _mm256_loadu_ps(r + i);
+    __m256 lg = _mm256_loadu_ps(g + i);
+    __m256 lb = _mm256_loadu_ps(b + i);
+    __m256 rr = _mm256_loadu_ps(r + j);
+    __m256 rg = _mm256_loadu_ps(g + j);
+    __m256 rb = _mm256_loadu_ps(b + j);
+    distort_pixels_avx(&lr, &lg, &lb, p);
+    distort_pixels_avx(&rr, &rg, &rb, p);
+    _mm256_storeu_ps(r + i, reverse_ps_avx(rr));
+    _mm256_storeu_ps(g + i, reverse_ps_avx(rg));
+    _mm256_storeu_ps(b + i, reverse_ps_avx(rb));
+    _mm256_storeu_ps(r + j, reverse_ps_avx(lr));
+    _mm256_storeu_ps(g + j, reverse_ps_avx(lg));
+    _mm256_storeu_ps(b + j, reverse_ps_avx(lb));
+  }
+  distort_row_cpu(r + i, g + i, b + i, n - 2 * i, 1, p);
+}
+#endif
+
+/**
+ * @brief  HSV 空间的色调/饱和度/曝光调整, flip 不为 0 时同时水平翻转
+ * @note   结果与 distort_image 后再 flip_image 相同, 只支持 3 通道图像
+ */
+void distort_flip_image(image im, float hue, float sat, float val, int flip) {
+  assert(im.c == 3);
+  struct distort_params p = {hue, sat, val};
+  void (*row)(float *, float *, float *, int, int,
+              const struct distort_params *) = distort_row_cpu;
+#ifdef IMAGE_X86
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    row = distort_row_avx;
+#endif
+  int size = im.w * im.h;
+  float *r = im.data;
+  float *g = im.data + size;
+  float *b = im.data + 2 * size;
+  if (!flip) {
+    row(r, g, b, size, 0, &p);
+    return;
+  }
+  int j;
+  for (j = 0; j < im.h; ++j)
+    row(r + j * im.w, g + j * im.w, b + j * im.w, im.w, 1, &p);
+}
+
+void distort_image(image im, float hue, float sat, float val) {
+  distort_flip_image(im, hue, sat, val, 0);
 }
 
 void random_distort_image(image im, float hue, float saturation,
                           float exposure) {
+  random_distort_flip_image(im, hue, saturation, exposure, 0);
+}
+
+/**
+ * @brief  随机的色调/饱和度/曝光调整及水平翻转, 在一次遍历中完成
+ */
+void random_distort_flip_image(image im, float hue, float saturation,
+                               float exposure, int flip) {
   float dhue = rand_uniform(-hue, hue);
   float dsat = rand_scale(saturation);
   float dexp = rand_scale(exposure);
-  distort_image(im, dhue, dsat, dexp);
+  distort_flip_image(im, dhue, dsat, dexp, flip);
 }
 
 void saturate_exposure_image(image im, float sat, float exposure) {
@@ -1463,6 +1747,15 @@ void load_image_compute(struct load_image_params *params, size_t k, size_t j) {
   }
 }
 
+static image image_from_data_thread(unsigned char *data, int w, int h, int c,
+                                    pthreadpool_t threadpool) {
+  image im = make_image(w, h, c);
+  struct load_image_params params = {im, data, w, h, c};
+  pthreadpool_compute_2d(
+      threadpool, (pthreadpool_function_2d_t)load_image_compute, &params, c, h);
+  return im;
+}
+
 image load_image_stb_thread(char *filename, int channels,
                             pthreadpool_t threadpool) {
   int w, h, c;
@@ -1475,15 +1768,148 @@ image load_image_stb_thread(char *filename, int channels,
 
   if (channels)
     c = channels;
-  image im = make_image(w, h, c);
-  struct load_image_params params = {im, data, w, h, c};
-  pthreadpool_compute_2d(
-      threadpool, (pthreadpool_function_2d_t)load_image_compute, &params, c, h);
+  image im = image_from_data_thread(data, w, h, c, threadpool);
   free(data);
   return im;
 }
+
+/**
+ * @brief  8 位交错排列的图像数据 letterbox 后直接写入 boxed
+ * @note   三通道数据通过 imgproc 的定点双线性缩放一次写入 boxed, 不生成原始
+ *         大小的浮点图片. 采样位置与 letterbox_image 相同 (首尾像素对齐),
+ *         结果量化为 8 位, 与 letterbox_image_into_thread 相差不超过 1/255;
+ *         其他通道数或宽高小于 2 的图片先转为浮点图片再缩放
+ */
+void letterbox_image_data_into_thread(const unsigned char *data, int w, int h,
+                                      int c, image boxed,
+                                      struct resize_plan_cache *plans,
+                                      pthreadpool_t threadpool) {
+  int new_w = w;
+  int new_h = h;
+  if (((float)boxed.w / w) < ((float)boxed.h / h)) {
+    new_w = boxed.w;
+    new_h = (h * boxed.w) / w;
+  } else {
+    new_h = boxed.h;
+    new_w = (w * boxed.h) / h;
+  }
+
+  if (3 != c || 3 != boxed.c || w < 2 || h < 2 || w > UINT16_MAX ||
+      h > UINT16_MAX || new_w < 1 || new_h < 1) {
+    image im = image_from_data_thread((unsigned char *)data, w, h, c, threadpool);
+    letterbox_image_into_thread(im, boxed.w, boxed.h, boxed, plans, threadpool);
+    free_image(im);
+    return;
+  }
+
+  struct resize_params local;
+  struct resize_params *resize = &local;
+  struct embed_box box = {(boxed.w - new_w) / 2, (boxed.h - new_h) / 2,
+                          boxed.w, boxed.h};
+  struct image_t dst = {PIXEL_RGB2WHCF, boxed.w, boxed.h, boxed.c,
+                        sizeof(float) * boxed.w * boxed.h * boxed.c,
+                        boxed.data};
+  if (plans)
+    resize = resize_plan_cache_get(plans, new_w, new_h, w, h);
+  else
+    resize_params_create_aligned(&local, new_w, new_h, w, h);
+  image_data_from_rgb_resize_embed_thread(&dst, resize, data, box, threadpool);
+  if (!plans)
+    resize_params_free(&local);
+}
+
+/**
+ * @brief  NV12/I420 数据转换为 RGB 并 letterbox 后直接写入 boxed
+ * @note   颜色转换与缩放在同一次计算中完成, 不生成中间的 RGB 图像;
+ *         w, h 为不小于 4 的偶数
+ * @retval 0 成功, 1 参数不支持
+ */
+int letterbox_yuv_into_thread(const unsigned char *data, int w, int h,
+                              YUV_FORMAT format, image boxed,
+                              struct resize_plan_cache *plans,
+                              pthreadpool_t threadpool) {
+  int new_w = w;
+  int new_h = h;
+  if (((float)boxed.w / w) < ((float)boxed.h / h)) {
+    new_w = boxed.w;
+    new_h = (h * boxed.w) / w;
+  } else {
+    new_h = boxed.h;
+    new_w = (w * boxed.h) / h;
+  }
+  if (3 != boxed.c || w > UINT16_MAX || h > UINT16_MAX || new_w < 1 ||
+      new_h < 1)
+    return 1;
+
+  struct resize_params local;
+  struct resize_params *resize = &local;
+  struct embed_box box = {(boxed.w - new_w) / 2, (boxed.h - new_h) / 2,
+                          boxed.w, boxed.h};
+  struct image_t dst = {YUV_I420 == format ? PIXEL_I4202WHCF : PIXEL_NV122WHCF,
+                        boxed.w, boxed.h, boxed.c,
+                        sizeof(float) * boxed.w * boxed.h * boxed.c,
+                        boxed.data};
+  if (plans)
+    resize = resize_plan_cache_get(plans, new_w, new_h, w, h);
+  else
+    resize_params_create_aligned(&local, new_w, new_h, w, h);
+  bool_t ret = image_data_from_yuv_resize_embed_thread(&dst, resize, data, box,
+                                                       threadpool);
+  if (!plans)
+    resize_params_free(&local);
+  return !ret;
+}
+
+/**
+ * @brief  解码图片并直接 letterbox 到 boxed, 原始图片大小通过 w, h 返回
+ */
+void load_image_letterbox_thread(char *filename, image boxed, int *w, int *h,
+                                 struct resize_plan_cache *plans,
+                                 pthreadpool_t threadpool) {
+  unsigned char *data = load_image_data(filename, w, h, boxed.c);
+  letterbox_image_data_into_thread(data, *w, *h, boxed.c, boxed, plans,
+                                   threadpool);
+  free(data);
+}
 #endif
 
+/**
+ * @brief  解码图片, 返回 c 个通道交错排列的 8 位数据, 需要调用者 free
+ */
+unsigned char *load_image_data(char *filename, int *w, int *h, int c) {
+  int channels;
+  unsigned char *data = stbi_load(filename, w, h, &channels, c);
+  if (!data) {
+    fprintf(stderr, "Cannot load image \"%s\"\nSTB Reason: %s\n", filename,
+            stbi_failure_reason());
+    exit(0);
+  }
+  return data;
+}
+
+/**
+ * @brief  8 位交错排列的图像数据 letterbox 后写入 boxed
+ */
+void letterbox_image_data_into(const unsigned char *data, int w, int h, int c,
+                               image boxed) {
+#ifdef NNPACK
+  letterbox_image_data_into_thread(data, w, h, c, boxed, NULL, NULL);
+#else
+  int i, j, k;
+  image im = make_image(w, h, c);
+  for (k = 0; k < c; ++k) {
+    for (j = 0; j < h; ++j) {
+      for (i = 0; i < w; ++i) {
+        im.data[i + w * j + w * h * k] = (float)data[k + c * i + c * w * j] / 255.;
+      }
+    }
+  }
+  fill_image(boxed, .5);
+  letterbox_image_into(im, boxed.w, boxed.h, boxed);
+  free_image(im);
+#endif
+}
+
 image load_image_stb(char *filename, int channels) {
   int w, h, c;
   unsigned char *data = stbi_load(filename, &w, &h, &c, channels);
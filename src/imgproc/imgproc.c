@@ -8,7 +8,9 @@
 #include "imgproc/imgproc.h"
 #include <nnpack.h>
 #include "../utils.h"
+#include "../simd/conv_neon.h"
 #include <stdlib.h>
+#include <math.h>
 
 /**
  * @brief  创建image_t 对象并分配内容缓存区
@@ -32,7 +34,7 @@ void image_create(struct image_t *img, uint16_t w, uint16_t h, uint16_t c,
   // Depending on the type the size differs
   if (PIXEL_YUV == type) {
     img->buf_size = sizeof(uint8_t) * 2 * img->w * img->h;
-  } else if (PIXEL_WHCF == type) {
+  } else if (image_is_whcf(type)) {
     img->buf_size = sizeof(float_t) * c * img->w * img->h;
   } else {
     img->buf_size = sizeof(uint8_t) * c * img->w * img->h;
@@ -41,6 +43,18 @@ void image_create(struct image_t *img, uint16_t w, uint16_t h, uint16_t c,
   img->buf = malloc(img->buf_size);
 }
 
+/**
+ * @brief  目标图像是否为 WHCF 浮点图像
+ * @note   PIXEL_RGB2WHCF, PIXEL_BGR2WHCF 表示由对应格式的数据转换得到的
+ *         WHCF 图像, 缩放函数按源数据的通道顺序写入 R, G, B 平面
+ * @param  type:
+ * @retval 1 是, 0 否
+ */
+bool_t image_is_whcf(enum image_type type) {
+  return PIXEL_WHCF == type ||
+         PIXEL_WHCF == (type & PIXEL_CONVERT_MASK) >> PIXEL_CONVERT_SHIFT;
+}
+
 /**
  * @brief  释放图片缓冲
  * @note
@@ -75,17 +89,14 @@ void image_copy(struct image_t *input, struct image_t *output) {
 }
 
 /**
- * @brief  创建变换参数
- * @note
- * @param  resize:
- * @param  w:
- * @param  h:
- * @param  src_w:
- * @param  src_h:
- * @retval None
+ * @brief  计算缩放参数
+ * @note   align_corners 为 0 时采样点位于像素中心: (dx + 0.5) * src_w / w - 0.5;
+ *         不为 0 时首尾像素对齐: dx * (src_w - 1) / (w - 1), 与 darknet 的
+ *         resize_image 相同
  */
-void resize_params_create(struct resize_params *resize, uint16_t w, uint16_t h,
-                          uint16_t src_w, uint16_t src_h) {
+static void resize_params_init(struct resize_params *resize, uint16_t w,
+                               uint16_t h, uint16_t src_w, uint16_t src_h,
+                               int align_corners) {
   const int INTER_RESIZE_COEF_BITS = 11;
   const int INTER_RESIZE_COEF_SCALE = 1 << INTER_RESIZE_COEF_BITS;
 
@@ -98,7 +109,10 @@ void resize_params_create(struct resize_params *resize, uint16_t w, uint16_t h,
   resize->src_h = src_h;
   resize->scale_x = (float)src_w / w;
   resize->scale_y = (float)src_h / h;
-  resize->buf = (int *)malloc(sizeof(int) * (w + h + w + h));
+  /* 首尾对齐时的采样步长, 计算方式与 resize_image 相同 */
+  float align_x = w > 1 ? (float)(src_w - 1) / (w - 1) : 0.f;
+  float align_y = h > 1 ? (float)(src_h - 1) / (h - 1) : 0.f;
+  resize->buf = (int *)malloc(sizeof(int) * 2 * (w + h + w + h));
 
   /**
    * int w
@@ -119,6 +133,14 @@ void resize_params_create(struct resize_params *resize, uint16_t w, uint16_t h,
    */
   resize->ibeta = (short *)(resize->buf + w + h + w);
 
+  /**
+   * int w, int h, short w*2, short h*2
+   */
+  resize->cxofs = resize->buf + 2 * (w + h);
+  resize->cyofs = resize->cxofs + w;
+  resize->calpha = (short *)(resize->cxofs + w + h);
+  resize->cbeta = (short *)(resize->cxofs + w + h + w);
+
   float fx;
   float fy;
   int sx;
@@ -129,10 +151,17 @@ void resize_params_create(struct resize_params *resize, uint16_t w, uint16_t h,
 
   int dx;
   for (dx = 0; dx < w; dx++) {
-    fx = (float)((dx + 0.5) * resize->scale_x - 0.5);
-    sx = fx; // cvFloor(fx);
+    fx = align_corners ? dx * align_x
+                       : (float)((dx + 0.5) * resize->scale_x - 0.5);
+    sx = floorf(fx);
     fx -= sx;
 
+    /* 放大时第一列的采样点在图像外, 取边界像素 */
+    if (sx < 0) {
+      sx = 0;
+      fx = 0.f;
+    }
+
     if (sx >= src_w - 1) {
       sx = src_w - 2;
       fx = 1.f;
@@ -149,10 +178,16 @@ void resize_params_create(struct resize_params *resize, uint16_t w, uint16_t h,
 
   int dy;
   for (dy = 0; dy < h; dy++) {
-    fy = (float)((dy + 0.5) * resize->scale_y - 0.5);
-    sy = fy; // Floor(fy);
+    fy = align_corners ? dy * align_y
+                       : (float)((dy + 0.5) * resize->scale_y - 0.5);
+    sy = floorf(fy);
     fy -= sy;
 
+    if (sy < 0) {
+      sy = 0;
+      fy = 0.f;
+    }
+
     if (sy >= src_h - 1) {
       sy = src_h - 2;
       fy = 1.f;
@@ -167,9 +202,96 @@ void resize_params_create(struct resize_params *resize, uint16_t w, uint16_t h,
     resize->ibeta[dy * 2 + 1] = SATURATE_CAST_SHORT(b1);
   }
 
+  /**
+   * 色度平面: 一个色度像素覆盖 2x2 个亮度像素, 采样点位于其中心,
+   * 亮度坐标 x 对应的色度坐标为 (x - 0.5) / 2
+   */
+  int src_cw = (src_w + 1) >> 1;
+  int src_ch = (src_h + 1) >> 1;
+  for (dx = 0; dx < w; dx++) {
+    fx = align_corners ? (dx * align_x - 0.5f) * 0.5f
+                       : (float)((dx + 0.5) * resize->scale_x * 0.5 - 0.5);
+    sx = floorf(fx);
+    fx -= sx;
+
+    if (sx < 0) {
+      sx = 0;
+      fx = 0.f;
+    }
+
+    if (sx >= src_cw - 1) {
+      sx = src_cw > 1 ? src_cw - 2 : 0;
+      fx = src_cw > 1 ? 1.f : 0.f;
+    }
+
+    resize->cxofs[dx] = sx;
+
+    float a0 = (1.f - fx) * INTER_RESIZE_COEF_SCALE;
+    float a1 = fx * INTER_RESIZE_COEF_SCALE;
+
+    resize->calpha[dx * 2] = SATURATE_CAST_SHORT(a0);
+    resize->calpha[dx * 2 + 1] = SATURATE_CAST_SHORT(a1);
+  }
+
+  for (dy = 0; dy < h; dy++) {
+    fy = align_corners ? (dy * align_y - 0.5f) * 0.5f
+                       : (float)((dy + 0.5) * resize->scale_y * 0.5 - 0.5);
+    sy = floorf(fy);
+    fy -= sy;
+
+    if (sy < 0) {
+      sy = 0;
+      fy = 0.f;
+    }
+
+    if (sy >= src_ch - 1) {
+      sy = src_ch > 1 ? src_ch - 2 : 0;
+      fy = src_ch > 1 ? 1.f : 0.f;
+    }
+
+    resize->cyofs[dy] = sy;
+
+    float b0 = (1.f - fy) * INTER_RESIZE_COEF_SCALE;
+    float b1 = fy * INTER_RESIZE_COEF_SCALE;
+
+    resize->cbeta[dy * 2] = SATURATE_CAST_SHORT(b0);
+    resize->cbeta[dy * 2 + 1] = SATURATE_CAST_SHORT(b1);
+  }
+
 #undef SATURATE_CAST_SHORT
 }
 
+/**
+ * @brief  创建变换参数
+ * @note
+ * @param  resize:
+ * @param  w:
+ * @param  h:
+ * @param  src_w:
+ * @param  src_h:
+ * @retval None
+ */
+void resize_params_create(struct resize_params *resize, uint16_t w, uint16_t h,
+                          uint16_t src_w, uint16_t src_h) {
+  resize_params_init(resize, w, h, src_w, src_h, 0);
+}
+
+/**
+ * @brief  创建首尾像素对齐的变换参数
+ * @note   采样位置与 darknet 的 resize_image/letterbox_image 相同, 结果只有
+ *         定点计算的舍入误差, 用于网络输入的预处理
+ * @param  resize:
+ * @param  w:
+ * @param  h:
+ * @param  src_w:
+ * @param  src_h:
+ * @retval None
+ */
+void resize_params_create_aligned(struct resize_params *resize, uint16_t w,
+                                  uint16_t h, uint16_t src_w, uint16_t src_h) {
+  resize_params_init(resize, w, h, src_w, src_h, 1);
+}
+
 /**
  * @brief  释放变换参数
  * @note
@@ -190,7 +312,89 @@ void resize_params_free(struct resize_params *resize) {
     resize->ibeta = NULL;
     resize->xofs = NULL;
     resize->yofs = NULL;
+    resize->cxofs = NULL;
+    resize->cyofs = NULL;
+    resize->calpha = NULL;
+    resize->cbeta = NULL;
+  }
+}
+
+/**
+ * @brief  创建缩放参数缓存
+ * @note
+ * @retval 缓存对象, 使用 resize_plan_cache_free 释放
+ */
+struct resize_plan_cache *resize_plan_cache_create() {
+  return (struct resize_plan_cache *)calloc(1, sizeof(struct resize_plan_cache));
+}
+
+/**
+ * @brief  释放缩放参数缓存及其中的全部参数
+ * @note
+ * @param  *cache:
+ * @retval None
+ */
+void resize_plan_cache_free(struct resize_plan_cache *cache) {
+  if (NULL == cache)
+    return;
+
+  int i;
+  for (i = 0; i < RESIZE_PLAN_CACHE_SIZE; i++) {
+    if (cache->last_use[i])
+      resize_params_free(cache->plans + i);
+  }
+  free(cache->scratch);
+  free(cache);
+}
+
+/**
+ * @brief  取得缩放参数, 缓存中没有时创建
+ * @note   缓存满时替换最久未使用的参数
+ * @param  *cache:
+ * @param  w:
+ * @param  h:
+ * @param  src_w:
+ * @param  src_h:
+ * @retval 缩放参数
+ */
+struct resize_params *resize_plan_cache_get(struct resize_plan_cache *cache,
+                                            uint16_t w, uint16_t h,
+                                            uint16_t src_w, uint16_t src_h) {
+  int i;
+  int oldest = 0;
+  cache->tick++;
+  for (i = 0; i < RESIZE_PLAN_CACHE_SIZE; i++) {
+    struct resize_params *plan = cache->plans + i;
+    if (cache->last_use[i] && plan->w == w && plan->h == h &&
+        plan->src_w == src_w && plan->src_h == src_h) {
+      cache->last_use[i] = cache->tick;
+      return plan;
+    }
+    if (cache->last_use[i] < cache->last_use[oldest])
+      oldest = i;
   }
+
+  if (cache->last_use[oldest])
+    resize_params_free(cache->plans + oldest);
+  resize_params_create_aligned(cache->plans + oldest, w, h, src_w, src_h);
+  cache->last_use[oldest] = cache->tick;
+  return cache->plans + oldest;
+}
+
+/**
+ * @brief  取得至少 size 字节的临时缓冲区
+ * @note
+ * @param  *cache:
+ * @param  size:
+ * @retval 缓冲区, 申请失败时为 NULL
+ */
+void *resize_plan_cache_scratch(struct resize_plan_cache *cache, size_t size) {
+  if (size > cache->scratch_size) {
+    free(cache->scratch);
+    cache->scratch = malloc(size);
+    cache->scratch_size = NULL == cache->scratch ? 0 : size;
+  }
+  return cache->scratch;
 }
 
 /**
@@ -267,7 +471,16 @@ bool_t image_data_from_bgr(struct image_t *img, const void *data) {
  * @param  data:
  * @retval
  */
-bool_t image_data_from_yuv(struct image_t *img, const void *data) {}
+bool_t image_data_from_yuv(struct image_t *img, const void *data) {
+  if (NULL == data || NULL == img || NULL == img->buf)
+    return 0;
+
+  struct resize_params resize;
+  resize_params_create(&resize, img->w, img->h, img->w, img->h);
+  bool_t ret = image_data_from_yuv_resize(img, &resize, data);
+  resize_params_free(&resize);
+  return ret;
+}
 
 /**
  * @brief  先改变图像大小和目标图像一致，然后再设置缓冲区，缓冲区数据格式为rgb
@@ -300,7 +513,6 @@ bool_t image_data_from_rgb_resize(struct image_t *img,
   float_t *dst2 = (float_t *)(dst + 2 * resize->w * resize->h);
   short *ibeta = resize->ibeta;
   const unsigned char *orign_data = (const unsigned char *)data;
-  printf("%d", *(int*)data);
   int dy;
   for (dy = 0; dy < resize->h; dy++) {
     int sy = resize->yofs[dy];
@@ -412,86 +624,65 @@ bool_t image_data_from_rgb_resize_neon(struct image_t *img,
   return 1;
 }
 
+/**
+ * @brief  计算缩放后的一行, 三个通道分别写入 dst0, dst1, dst2
+ * @note   每个任务独立计算一行, 因此总是对相邻的两行源数据做水平插值,
+ *         rows0, rows1 为调用者提供的行缓冲, 大小至少为 resize->w * 3
+ */
 void resize_one_row_neon(struct resize_params *resize, short *ibeta, int sy,
                          int dy, const unsigned char *orign_data, short *rows0,
                          short *rows1, float_t *dst0, float_t *dst1,
                          float_t *dst2) {
-  if (sy == -1) {
-    // hresize one row
-    short *rows0_old = rows0;
-    rows0 = rows1;
-    rows1 = rows0_old;
-    const unsigned char *S1 = orign_data + resize->src_w * (sy + 3);
-
-    const short *ialphap = resize->ialpha;
-    short *rows1p = rows1;
-    int dx;
-    for (dx = 0; dx < resize->w; dx++) {
-      int sx = resize->xofs[dx];
-      short a0 = ialphap[0];
-      short a1 = ialphap[1];
-
-      const unsigned char *S1p = S1 + sx;
+  // hresize two rows
+  const unsigned char *S0 = orign_data + resize->src_w * (sy);
+  const unsigned char *S1 = orign_data + resize->src_w * (sy + 3);
 
-      rows1p[0] = (S1p[0] * a0 + S1p[3] * a1) >> 4;
-      rows1p[1] = (S1p[1] * a0 + S1p[4] * a1) >> 4;
-      rows1p[2] = (S1p[2] * a0 + S1p[5] * a1) >> 4;
-
-      ialphap += 2;
-      rows1p += 3;
-    }
-  } else {
-    // hresize two rows
-    const unsigned char *S0 = orign_data + resize->src_w * (sy);
-    const unsigned char *S1 = orign_data + resize->src_w * (sy + 3);
-
-    const short *ialphap = resize->ialpha;
-    short *rows0p = rows0;
-    short *rows1p = rows1;
-    int dx;
-    for (dx = 0; dx < resize->w; dx++) {
-      int sx = resize->xofs[dx];
-      short a0 = ialphap[0];
-      short a1 = ialphap[1];
-
-      const unsigned char *S0p = S0 + sx;
-      const unsigned char *S1p = S1 + sx;
-
-      rows0p[0] = (S0p[0] * a0 + S0p[3] * a1) >> 4;
-      rows0p[1] = (S0p[1] * a0 + S0p[4] * a1) >> 4;
-      rows0p[2] = (S0p[2] * a0 + S0p[5] * a1) >> 4;
-      rows1p[0] = (S1p[0] * a0 + S1p[3] * a1) >> 4;
-      rows1p[1] = (S1p[1] * a0 + S1p[4] * a1) >> 4;
-      rows1p[2] = (S1p[2] * a0 + S1p[5] * a1) >> 4;
-
-      ialphap += 2;
-      rows0p += 3;
-      rows1p += 3;
-    }
+  const short *ialphap = resize->ialpha;
+  short *rows0p = rows0;
+  short *rows1p = rows1;
+  int dx;
+  for (dx = 0; dx < resize->w; dx++) {
+    int sx = resize->xofs[dx];
+    short a0 = ialphap[0];
+    short a1 = ialphap[1];
+
+    const unsigned char *S0p = S0 + sx;
+    const unsigned char *S1p = S1 + sx;
+
+    rows0p[0] = (S0p[0] * a0 + S0p[3] * a1) >> 4;
+    rows0p[1] = (S0p[1] * a0 + S0p[4] * a1) >> 4;
+    rows0p[2] = (S0p[2] * a0 + S0p[5] * a1) >> 4;
+    rows1p[0] = (S1p[0] * a0 + S1p[3] * a1) >> 4;
+    rows1p[1] = (S1p[1] * a0 + S1p[4] * a1) >> 4;
+    rows1p[2] = (S1p[2] * a0 + S1p[5] * a1) >> 4;
+
+    ialphap += 2;
+    rows0p += 3;
+    rows1p += 3;
   }
 
   // vresize
   short b0 = ibeta[2 * dy];
   short b1 = ibeta[2 * dy + 1];
+  const float_t scale = 1.f / 255;
 
-  short *rows0p = rows0;
-  short *rows1p = rows1;
+  rows0p = rows0;
+  rows1p = rows1;
   int remain = resize->w;
 
   for (; remain; --remain) {
-
-    *dst2++ = (((short)((b0 * (short)(*rows0p++)) >> 16) +
+    *dst0++ = (((short)((b0 * (short)(*rows0p++)) >> 16) +
                 (short)((b1 * (short)(*rows1p++)) >> 16) + 2) >>
-               2) /
-              255.0;
+               2) *
+              scale;
     *dst1++ = (((short)((b0 * (short)(*rows0p++)) >> 16) +
                 (short)((b1 * (short)(*rows1p++)) >> 16) + 2) >>
-               2) /
-              255.0;
-    *dst0++ = (((short)((b0 * (short)(*rows0p++)) >> 16) +
+               2) *
+              scale;
+    *dst2++ = (((short)((b0 * (short)(*rows0p++)) >> 16) +
                 (short)((b1 * (short)(*rows1p++)) >> 16) + 2) >>
-               2) /
-              255.0;
+               2) *
+              scale;
   }
 }
 
@@ -525,8 +716,12 @@ void rgb_resize_thread_neon(void *params, size_t index) {
   float_t *dst0 = dst + map_index;
   float_t *dst1 = dst0 + map_size;
   float_t *dst2 = dst1 + map_size;
-  resize_one_row_neon(resize, ibeta, sy, dy, orign_data, rows0, rows1, dst0,
-                      dst1, dst2);
+  if (PIXEL_BGR2WHCF == img->type)
+    resize_one_row_neon(resize, ibeta, sy, dy, orign_data, rows0, rows1, dst2,
+                        dst1, dst0);
+  else
+    resize_one_row_neon(resize, ibeta, sy, dy, orign_data, rows0, rows1, dst0,
+                        dst1, dst2);
 }
 
 /**
@@ -544,7 +739,7 @@ bool_t image_data_from_rgb_resize_thread(struct image_t *img,
                                          const void *data,
                                          pthreadpool_t threadpool) {
   if (NULL == data || NULL == img || NULL == img->buf ||
-      PIXEL_WHCF != img->type || NULL == resize || NULL == resize->buf) {
+      !image_is_whcf(img->type) || NULL == resize || NULL == resize->buf) {
     return 0;
   }
 
@@ -610,8 +805,12 @@ void rgb_resize_embed_thread_neon(void *params, size_t index) {
 
     int dy = index - box.embed_y;
     int sy = resize->yofs[dy];
-    resize_one_row_neon(resize, ibeta, sy, dy, orign_data, rows0, rows1, dst0,
-                        dst1, dst2);
+    if (PIXEL_BGR2WHCF == img->type)
+      resize_one_row_neon(resize, ibeta, sy, dy, orign_data, rows0, rows1, dst2,
+                          dst1, dst0);
+    else
+      resize_one_row_neon(resize, ibeta, sy, dy, orign_data, rows0, rows1, dst0,
+                          dst1, dst2);
 
     dst0 += resize->w;
     dst1 += resize->w;
@@ -643,7 +842,7 @@ bool_t image_data_from_rgb_resize_embed_thread(struct image_t *img,
                                                struct embed_box box,
                                                pthreadpool_t threadpool) {
   if (NULL == data || NULL == img || NULL == img->buf ||
-      PIXEL_WHCF != img->type || NULL == resize || NULL == resize->buf) {
+      !image_is_whcf(img->type) || NULL == resize || NULL == resize->buf) {
     return 0;
   }
 
@@ -653,13 +852,10 @@ bool_t image_data_from_rgb_resize_embed_thread(struct image_t *img,
     return 0;
   }
 
-  printf("resize %d %d\n", box.embed_w, box.embed_h);
-  TIME_BEGIN(rgb_resize_embed_thread_neon);
   struct resize_thread_paramters params = {img, resize, data, box};
   pthreadpool_compute_1d(
       threadpool, (pthreadpool_function_1d_t)rgb_resize_embed_thread_neon,
       &params, box.embed_h);
-  TIME_END(rgb_resize_embed_thread_neon);
 
   return 1;
 }
@@ -682,6 +878,215 @@ bool_t image_data_from_bgr_resize(struct image_t *img,
   return 1;
 }
 
+/**
+ * BT.601 (16-235) YUV 转 RGB 的系数, 已乘以 1/255, 转换结果即为 [0, 1] 的浮点数
+ */
+#define YUV_Y_SCALE (1.164383f / 255)
+#define YUV_R_V (1.596027f / 255)
+#define YUV_G_U (-0.391762f / 255)
+#define YUV_G_V (-0.812968f / 255)
+#define YUV_B_U (2.017232f / 255)
+
+/**
+ * 水平和垂直插值系数均为 INTER_RESIZE_COEF_SCALE (2^11), 插值结果放大了 2^22 倍
+ */
+#define YUV_RESIZE_SCALE (1.f / (1 << 22))
+
+/**
+ * @brief  YUV 420 数据的三个平面
+ */
+struct yuv420_planes {
+  const unsigned char *y;
+  const unsigned char *u;
+  const unsigned char *v;
+  int y_stride;
+  int c_stride;
+  /**
+   * 同一行相邻两个色度像素的间隔, NV12 为 2, I420 为 1
+   */
+  int c_step;
+};
+
+static bool_t yuv420_planes_init(struct yuv420_planes *planes,
+                                 enum image_type type, const void *data,
+                                 int w, int h) {
+  planes->y = (const unsigned char *)data;
+  planes->y_stride = w;
+  if (PIXEL_NV122WHCF == type) {
+    planes->u = planes->y + w * h;
+    planes->v = planes->u + 1;
+    planes->c_stride = w;
+    planes->c_step = 2;
+  } else if (PIXEL_I4202WHCF == type) {
+    planes->u = planes->y + w * h;
+    planes->v = planes->u + (w >> 1) * (h >> 1);
+    planes->c_stride = w >> 1;
+    planes->c_step = 1;
+  } else {
+    return 0;
+  }
+  return 1;
+}
+
+static bool_t yuv420_resize_check(struct image_t *img,
+                                  struct resize_params *resize,
+                                  const void *data) {
+  if (NULL == data || NULL == img || NULL == img->buf || NULL == resize ||
+      NULL == resize->buf) {
+    return 0;
+  }
+
+  if (PIXEL_NV122WHCF != img->type && PIXEL_I4202WHCF != img->type)
+    return 0;
+
+  if (resize->src_w < 4 || resize->src_h < 4 || (resize->src_w & 1) ||
+      (resize->src_h & 1))
+    return 0;
+  return 1;
+}
+
+static float_t clamp_unit(float_t x) {
+  return x < 0 ? 0 : (x > 1 ? 1 : x);
+}
+
+/**
+ * @brief  对水平插值后的两行做垂直插值, 并转换为 R, G, B
+ */
+static void yuv420_vresize_cpu(const int *rows, int w, short b0, short b1,
+                               short cb0, short cb1, float_t *dst0,
+                               float_t *dst1, float_t *dst2) {
+  const int *y0 = rows, *y1 = rows + w;
+  const int *u0 = rows + 2 * w, *u1 = rows + 3 * w;
+  const int *v0 = rows + 4 * w, *v1 = rows + 5 * w;
+  int i;
+  for (i = 0; i < w; i++) {
+    float_t y = (y0[i] * b0 + y1[i] * b1) * YUV_RESIZE_SCALE - 16;
+    float_t u = (u0[i] * cb0 + u1[i] * cb1) * YUV_RESIZE_SCALE - 128;
+    float_t v = (v0[i] * cb0 + v1[i] * cb1) * YUV_RESIZE_SCALE - 128;
+    y *= YUV_Y_SCALE;
+    dst0[i] = clamp_unit(y + YUV_R_V * v);
+    dst1[i] = clamp_unit(y + YUV_G_U * u + YUV_G_V * v);
+    dst2[i] = clamp_unit(y + YUV_B_U * u);
+  }
+}
+
+#ifdef SIMD_X86
+/**
+ * yuv420_vresize_cpu 的 AVX2/FMA 版本, 每次计算 8 个像素
+ */
+__attribute__((target("avx2,fma")))
+static void yuv420_vresize_avx(const int *rows, int w, short b0, short b1,
+                               short cb0, short cb1, float_t *dst0,
+                               float_t *dst1, float_t *dst2) {
+  const int *y0 = rows, *y1 = rows + w;
+  const int *u0 = rows + 2 * w, *u1 = rows + 3 * w;
+  const int *v0 = rows + 4 * w, *v1 = rows + 5 * w;
+  __m256i vb0 = _mm256_set1_epi32(b0);
+  __m256i vb1 = _mm256_set1_epi32(b1);
+  __m256i vcb0 = _mm256_set1_epi32(cb0);
+  __m256i vcb1 = _mm256_set1_epi32(cb1);
+  __m256 yscale = _mm256_set1_ps(YUV_RESIZE_SCALE * YUV_Y_SCALE);
+  __m256 ybias = _mm256_set1_ps(-16 * YUV_Y_SCALE);
+  __m256 cscale = _mm256_set1_ps(YUV_RESIZE_SCALE);
+  __m256 cbias = _mm256_set1_ps(-128);
+  __m256 zero = _mm256_setzero_ps();
+  __m256 one = _mm256_set1_ps(1);
+  int i = 0;
+  for (; i + 7 < w; i += 8) {
+    __m256i y = _mm256_add_epi32(
+        _mm256_mullo_epi32(_mm256_loadu_si256((const __m256i *)(y0 + i)), vb0),
+        _mm256_mullo_epi32(_mm256_loadu_si256((const __m256i *)(y1 + i)), vb1));
+    __m256i u = _mm256_add_epi32(
+        _mm256_mullo_epi32(_mm256_loadu_si256((const __m256i *)(u0 + i)), vcb0),
+        _mm256_mullo_epi32(_mm256_loadu_si256((const __m256i *)(u1 + i)), vcb1));
+    __m256i v = _mm256_add_epi32(
+        _mm256_mullo_epi32(_mm256_loadu_si256((const __m256i *)(v0 + i)), vcb0),
+        _mm256_mullo_epi32(_mm256_loadu_si256((const __m256i *)(v1 + i)), vcb1));
+    __m256 fy = _mm256_fmadd_ps(_mm256_cvtepi32_ps(y), yscale, ybias);
+    __m256 fu = _mm256_fmadd_ps(_mm256_cvtepi32_ps(u), cscale, cbias);
+    __m256 fv = _mm256_fmadd_ps(_mm256_cvtepi32_ps(v), cscale, cbias);
+
+    __m256 r = _mm256_fmadd_ps(fv, _mm256_set1_ps(YUV_R_V), fy);
+    __m256 g = _mm256_fmadd_ps(fu, _mm256_set1_ps(YUV_G_U),
+                               _mm256_fmadd_ps(fv, _mm256_set1_ps(YUV_G_V), fy));
+    __m256 b = _mm256_fmadd_ps(fu, _mm256_set1_ps(YUV_B_U), fy);
+    _mm256_storeu_ps(dst0 + i, _mm256_min_ps(_mm256_max_ps(r, zero), one));
+    _mm256_storeu_ps(dst1 + i, _mm256_min_ps(_mm256_max_ps(g, zero), one));
+    _mm256_storeu_ps(dst2 + i, _mm256_min_ps(_mm256_max_ps(b, zero), one));
+  }
+  if (i < w) {
+    /* 剩余不足 8 个像素, 六行依次排列后使用标量实现 */
+    int n = w - i;
+    int tail[6 * 8];
+    int k;
+    for (k = 0; k < 6; k++)
+      memcpy(tail + k * n, rows + k * w + i, sizeof(int) * n);
+    yuv420_vresize_cpu(tail, n, b0, b1, cb0, cb1, dst0 + i, dst1 + i,
+                       dst2 + i);
+  }
+}
+#endif
+
+/**
+ * @brief  计算 YUV 420 数据缩放后的一行, 转换为 R, G, B 写入 dst0, dst1, dst2
+ * @note   亮度与色度平面分别按各自的坐标做水平插值, 两行结果保存在 rows 中,
+ *         rows 大小至少为 resize->w * 6; 插值与颜色转换均为线性运算,
+ *         因此先插值再转换, 不需要生成全分辨率的 RGB 图像
+ */
+static void yuv420_resize_one_row(struct resize_params *resize,
+                                  const struct yuv420_planes *planes, int dy,
+                                  int *rows, float_t *dst0, float_t *dst1,
+                                  float_t *dst2) {
+  int w = resize->w;
+  int *ry0 = rows, *ry1 = rows + w;
+  int *ru0 = rows + 2 * w, *ru1 = rows + 3 * w;
+  int *rv0 = rows + 4 * w, *rv1 = rows + 5 * w;
+
+  /* xofs, yofs 按三通道数据保存 */
+  const unsigned char *Y0 = planes->y + planes->y_stride * (resize->yofs[dy] / 3);
+  const unsigned char *Y1 = Y0 + planes->y_stride;
+  int cy = resize->cyofs[dy];
+  const unsigned char *U0 = planes->u + planes->c_stride * cy;
+  const unsigned char *U1 = U0 + planes->c_stride;
+  const unsigned char *V0 = planes->v + planes->c_stride * cy;
+  const unsigned char *V1 = V0 + planes->c_stride;
+  int step = planes->c_step;
+
+  const short *ialphap = resize->ialpha;
+  const short *calphap = resize->calpha;
+  int dx;
+  for (dx = 0; dx < w; dx++) {
+    int sx = resize->xofs[dx] / 3;
+    int a0 = ialphap[0];
+    int a1 = ialphap[1];
+    ry0[dx] = Y0[sx] * a0 + Y0[sx + 1] * a1;
+    ry1[dx] = Y1[sx] * a0 + Y1[sx + 1] * a1;
+
+    int cx = resize->cxofs[dx] * step;
+    int c0 = calphap[0];
+    int c1 = calphap[1];
+    ru0[dx] = U0[cx] * c0 + U0[cx + step] * c1;
+    ru1[dx] = U1[cx] * c0 + U1[cx + step] * c1;
+    rv0[dx] = V0[cx] * c0 + V0[cx + step] * c1;
+    rv1[dx] = V1[cx] * c0 + V1[cx + step] * c1;
+
+    ialphap += 2;
+    calphap += 2;
+  }
+
+  short b0 = resize->ibeta[2 * dy];
+  short b1 = resize->ibeta[2 * dy + 1];
+  short cb0 = resize->cbeta[2 * dy];
+  short cb1 = resize->cbeta[2 * dy + 1];
+#ifdef SIMD_X86
+  if (cpu_support_avx2_fma()) {
+    yuv420_vresize_avx(rows, w, b0, b1, cb0, cb1, dst0, dst1, dst2);
+    return;
+  }
+#endif
+  yuv420_vresize_cpu(rows, w, b0, b1, cb0, cb1, dst0, dst1, dst2);
+}
+
 /**
 * @brief  先改变图像大小和目标图像一致，然后再设置缓冲区，缓冲区数据格式为yuv
 * @note
@@ -693,9 +1098,99 @@ bool_t image_data_from_bgr_resize(struct image_t *img,
 bool_t image_data_from_yuv_resize(struct image_t *img,
                                   struct resize_params *resize,
                                   const void *data) {
-  if (NULL == data || NULL == img || NULL == img->buf ||
-      PIXEL_WHCF != img->type || NULL == resize || NULL == resize->buf) {
+  if (!yuv420_resize_check(img, resize, data) || img->w != resize->w ||
+      img->h != resize->h) {
+    return 0;
+  }
+
+  struct yuv420_planes planes;
+  yuv420_planes_init(&planes, img->type, data, resize->src_w, resize->src_h);
+
+  int *rows = (int *)malloc(sizeof(int) * 6 * resize->w);
+  int map_size = resize->w * resize->h;
+  float_t *dst = (float_t *)img->buf;
+  int dy;
+  for (dy = 0; dy < resize->h; dy++) {
+    float_t *dst0 = dst + resize->w * dy;
+    yuv420_resize_one_row(resize, &planes, dy, rows, dst0, dst0 + map_size,
+                          dst0 + 2 * map_size);
+  }
+  free(rows);
+  return 1;
+}
+
+/**
+* @brief  YUV 420 缩放线程函数，单个任务完成嵌入目标图像一行的计算
+* @note
+* @param  *params: 参数
+* @param  index:  第几个任务，即计算行图片数据
+* @retval None
+*/
+void yuv_resize_embed_thread(void *params, size_t index) {
+  struct resize_thread_paramters *p = (struct resize_thread_paramters *)params;
+  struct image_t *img = p->img;
+  struct resize_params *resize = p->resize;
+  struct embed_box box = p->box;
+
+  int map_size = box.embed_h * box.embed_w;
+  float_t *dst0 = (float_t *)img->buf + box.embed_w * index;
+  float_t *dst1 = dst0 + map_size;
+  float_t *dst2 = dst1 + map_size;
+
+  if (index < box.embed_y || index >= box.embed_y + resize->h) {
+    fill_data(dst0, box.embed_w, 0.5);
+    fill_data(dst1, box.embed_w, 0.5);
+    fill_data(dst2, box.embed_w, 0.5);
+    return;
+  }
+
+  fill_data(dst0, box.embed_x, 0.5);
+  fill_data(dst1, box.embed_x, 0.5);
+  fill_data(dst2, box.embed_x, 0.5);
+  dst0 += box.embed_x;
+  dst1 += box.embed_x;
+  dst2 += box.embed_x;
+
+  struct yuv420_planes planes;
+  yuv420_planes_init(&planes, img->type, p->data, resize->src_w,
+                     resize->src_h);
+  int rows[6 * resize->w];
+  yuv420_resize_one_row(resize, &planes, index - box.embed_y, rows, dst0, dst1,
+                        dst2);
+
+  int havelen = box.embed_w - resize->w - box.embed_x;
+  fill_data(dst0 + resize->w, havelen, 0.5);
+  fill_data(dst1 + resize->w, havelen, 0.5);
+  fill_data(dst2 + resize->w, havelen, 0.5);
+}
+
+/**
+* @brief   YUV 420 数据转换为 RGB 并缩放后嵌入目标图像, 通过线程池完成
+* @note
+* @param  *img: 目标图像
+* @param  *resize:  变换参数
+* @param  *data:  原始数据
+* @param  box:
+* @param  threadpool: 线程池对象指针
+* @retval  是否成功 0 表示是否  1表示成功
+*/
+bool_t image_data_from_yuv_resize_embed_thread(struct image_t *img,
+                                               struct resize_params *resize,
+                                               const void *data,
+                                               struct embed_box box,
+                                               pthreadpool_t threadpool) {
+  if (!yuv420_resize_check(img, resize, data))
+    return 0;
+
+  if (box.embed_h < resize->h || box.embed_w < resize->w ||
+      box.embed_x + resize->w > box.embed_w ||
+      box.embed_y + resize->h > box.embed_h) {
     return 0;
   }
+
+  struct resize_thread_paramters params = {img, resize, data, box};
+  pthreadpool_compute_1d(threadpool,
+                         (pthreadpool_function_1d_t)yuv_resize_embed_thread,
+                         &params, box.embed_h);
   return 1;
-}
\ No newline at end of file
+}
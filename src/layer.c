@@ -33,8 +33,11 @@ void free_layer(layer l)
     if(l.scale_updates)      free(l.scale_updates);
     if(l.weights)            free(l.weights);
     if(l.weight_updates)     free(l.weight_updates);
+    if(l.winograd_weights)   free(l.winograd_weights);
+    if(l.conv1x1_weights)    free(l.conv1x1_weights);
     if(l.delta)              free(l.delta);
     if(l.output)             free(l.output);
+    if(l.activated)          free(l.activated);
     if(l.squared)            free(l.squared);
     if(l.norms)              free(l.norms);
     if(l.spatial_mean)       free(l.spatial_mean);
@@ -95,3 +98,35 @@ void free_layer(layer l)
     if(l.norms_gpu)               cuda_free(l.norms_gpu);
 #endif
 }
+
+/**
+ * @brief  释放只在训练时使用的缓冲区并置空, 层的输出及权重保持不变
+ * @note   用于推理, 调用后不能再 backward/update
+ */
+void free_layer_train_state(layer *l)
+{
+    if(l->delta)             free(l->delta);
+    if(l->x)                 free(l->x);
+    if(l->x_norm)            free(l->x_norm);
+    if(l->weight_updates)    free(l->weight_updates);
+    if(l->bias_updates)      free(l->bias_updates);
+    if(l->scale_updates)     free(l->scale_updates);
+    if(l->mean)              free(l->mean);
+    if(l->variance)          free(l->variance);
+    if(l->mean_delta)        free(l->mean_delta);
+    if(l->variance_delta)    free(l->variance_delta);
+    if(l->m)                 free(l->m);
+    if(l->v)                 free(l->v);
+    l->delta = 0;
+    l->x = 0;
+    l->x_norm = 0;
+    l->weight_updates = 0;
+    l->bias_updates = 0;
+    l->scale_updates = 0;
+    l->mean = 0;
+    l->variance = 0;
+    l->mean_delta = 0;
+    l->variance_delta = 0;
+    l->m = 0;
+    l->v = 0;
+}
@@ -86,9 +86,7 @@ void forward_maxpool_layer(const maxpool_layer l, network net) {
   struct maxpool_params params = {net.input, l.output, l.size,  l.pad,
                                   l.w,       l.h,      l.c,     l.out_w,
                                   l.out_h,   l.out_c,  l.stride};
-  pthreadpool_compute_2d(net.threadpool,
-                         (pthreadpool_function_2d_t)maxpool_cpu_thread, &params,
-                         l.batch, l.c);
+  maxpool_cpu(net.threadpool, &params, l.batch);
 #else
   int b, i, j, k, m, n;
   int w_offset = -l.pad;
@@ -127,6 +125,12 @@ void forward_maxpool_layer(const maxpool_layer l, network net) {
   TIME_END(forward_maxpool_layer);
 }
 
+/**
+ * @brief  已由 fuse_network_maxpool 合并到前一个卷积层, 卷积写完每个输出通道后
+ *         立即计算该通道的池化, 不需要再计算
+ */
+void forward_fused_maxpool_layer(const maxpool_layer l, network net) {}
+
 void backward_maxpool_layer(const maxpool_layer l, network net) {
   int i;
   int h = l.out_h;
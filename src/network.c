@@ -1,11 +1,13 @@
 #include <stdio.h>
 #include <time.h>
 #include <assert.h>
+#include <sys/mman.h>
 #include "network.h"
 #include "image.h"
 #include "data.h"
 #include "utils.h"
 #include "blas.h"
+#include "gemm.h"
 
 #include "crop_layer.h"
 #include "connected_layer.h"
@@ -216,6 +218,9 @@ network make_network(int n)
 void forward_network(network net)
 {
     int i;
+#ifdef NNPACK
+    pthreadpool_t threadpool = gemm_set_threadpool(net.threadpool);
+#endif
     for (i = 0; i < net.n; ++i)
     {
         net.index = i;
@@ -232,6 +237,9 @@ void forward_network(network net)
         }
     }
     calc_network_cost(net);
+#ifdef NNPACK
+    gemm_set_threadpool(threadpool);
+#endif
 }
 
 void update_network(network net)
@@ -284,6 +292,9 @@ void backward_network(network net)
 {
     int i;
     network orig = net;
+#ifdef NNPACK
+    pthreadpool_t threadpool = gemm_set_threadpool(net.threadpool);
+#endif
     for (i = net.n - 1; i >= 0; --i)
     {
         layer l = net.layers[i];
@@ -302,6 +313,9 @@ void backward_network(network net)
         net.index = i;
         l.backward(l, net);
     }
+#ifdef NNPACK
+    gemm_set_threadpool(threadpool);
+#endif
 }
 
 float train_network_datum(network net)
@@ -383,6 +397,518 @@ void set_batch_network(network *net, int b)
     }
 }
 
+static int plannable_layer(LAYER_TYPE type)
+{
+    switch (type)
+    {
+    case CONVOLUTIONAL:
+    case CONNECTED:
+    case MAXPOOL:
+    case AVGPOOL:
+    case ROUTE:
+    case SHORTCUT:
+    case REORG:
+    case ACTIVE:
+    case BATCHNORM:
+    case SHUFFLE:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static int in_weights_map(network *net, float *p)
+{
+    return net->weights_map && (char *)p >= (char *)net->weights_map &&
+           (char *)p < (char *)net->weights_map + net->weights_map_size;
+}
+
+/**
+ * @brief  标记被 route 或 shortcut 引用输出的层, 返回的数组由调用者释放
+ */
+static int *referenced_layers(network *net)
+{
+    int *referenced = calloc(net->n, sizeof(int));
+    int i, j;
+    for (i = 0; i < net->n; ++i)
+    {
+        layer *l = net->layers + i;
+        if (l->type == ROUTE)
+        {
+            for (j = 0; j < l->n; ++j)
+                referenced[l->input_layers[j]] = 1;
+        }
+        if (l->type == SHORTCUT)
+            referenced[l->index] = 1;
+    }
+    return referenced;
+}
+
+/**
+ * @brief  推理时合并批归一化, 卷积层只计算卷积, 偏置及激活
+ * @note   卷积层自身的批归一化合并到权重及偏置中. 线性激活的卷积层之后紧跟的
+ *         batchnorm 层, 如果卷积层的输出没有被 route/shortcut 引用, 也合并到该卷积层,
+ *         batchnorm 层与卷积层共用输出, 前向计算为空操作.
+ *         权重位于 load_packed_weights 映射中 (只读) 的层不修改.
+ *         只用于推理, 在加载权重之后, plan_network_memory 之前调用
+ */
+void fold_network_batchnorm(network *net)
+{
+#ifdef GPU
+    if (gpu_index >= 0)
+        return;
+#endif
+    int n = net->n;
+    int *referenced = referenced_layers(net);
+    int i, folded = 0;
+
+    for (i = 0; i < n; ++i)
+    {
+        layer *l = net->layers + i;
+        if (l->type != CONVOLUTIONAL || l->binary || l->xnor || in_weights_map(net, l->weights))
+            continue;
+        if (l->batch_normalize)
+        {
+            fold_convolutional_batchnorm(l);
+            ++folded;
+        }
+        layer *bn = l + 1;
+        if (i + 1 < n && bn->type == BATCHNORM && l->activation == LINEAR &&
+            !referenced[i] && !l->truth)
+        {
+            fold_convolutional_batchnorm_layer(l, bn);
+            free_layer_train_state(bn);
+            free(bn->output);
+            bn->output = l->output;
+            bn->forward = forward_folded_batchnorm_layer;
+            ++folded;
+        }
+    }
+    net->output = get_network_output_layer(*net).output;
+    if (folded)
+        fprintf(stderr, "batchnorm folded into %d convolutional layers\n", folded);
+    free(referenced);
+}
+
+/**
+ * @brief  推理时把卷积层之后的最大池化合并到卷积中
+ * @note   卷积任务完成一个输出通道的后处理后立即计算该通道的池化, 池化前的数据
+ *         仍在缓存中, 池化层的前向计算为空操作. 卷积层的输出被 route/shortcut 引用
+ *         或带 truth 时不合并. 卷积走 GEMM 或 NNPACK 路径时由卷积层在后处理之后
+ *         自行计算池化, 结果相同.
+ *         只用于推理, 在 plan_network_memory 之前调用
+ */
+void fuse_network_maxpool(network *net)
+{
+#ifdef NNPACK
+    int n = net->n;
+    int *referenced = referenced_layers(net);
+    int i, fused = 0;
+    for (i = 0; i + 1 < n; ++i)
+    {
+        layer *l = net->layers + i;
+        layer *pool = l + 1;
+        if (l->type != CONVOLUTIONAL || l->forward != forward_convolutional_layer_nnpack ||
+            pool->type != MAXPOOL || pool->forward != forward_maxpool_layer ||
+            l->binary || l->xnor || referenced[i] || l->truth)
+            continue;
+        l->fuse_maxpool = 1;
+        pool->forward = forward_fused_maxpool_layer;
+        ++fused;
+    }
+    if (fused)
+        fprintf(stderr, "maxpool fused into %d convolutional layers\n", fused);
+    free(referenced);
+#endif
+}
+
+/**
+ * @brief  推理时 region 层不再对整个输出做 logistic 及 softmax
+ * @note   region 层的输出与前一层共用, 保留原始值. parse_object_boxs 先用目标置信度
+ *         的原始值筛选 anchor, 只对通过的 anchor 计算 softmax 及位置;
+ *         get_region_boxes 在层原来的输出 (l->activated) 中激活后再解析, 不再每次分配.
+ *         network_predict 的返回值为原始值.
+ *         只处理 softmax 分类且没有 background 的 region 层.
+ *         只用于推理, 在 plan_network_memory 之前调用
+ */
+void defer_network_region_activation(network *net)
+{
+#ifdef GPU
+    if (gpu_index >= 0)
+        return;
+#endif
+    int i;
+    for (i = 1; i < net->n; ++i)
+    {
+        layer *l = net->layers + i;
+        layer *prev = l - 1;
+        if (l->type != REGION || !l->softmax || l->softmax_tree || l->background ||
+            l->coords != 4 || !prev->output || prev->outputs != l->outputs ||
+            prev->batch != l->batch)
+            continue;
+        free_layer_train_state(l);
+        l->activated = l->output;
+        l->output = prev->output;
+        l->forward = forward_region_layer_raw;
+    }
+    net->output = get_network_output_layer(*net).output;
+}
+
+/**
+ * @brief  推理内存规划, 多个层的输出复用同一块内存
+ * @note   按层的顺序计算每个输出的生命周期 (下一层, route 及 shortcut 的引用,
+ *         dropout 等与前一层共用输出的层), 生命周期不重叠的输出共用一个缓冲区,
+ *         所有缓冲区放在 net->arena 中. 同时释放推理不需要的训练缓冲区.
+ *         batch 为 1 时 route 的输入层直接写入 route 输出中对应的位置, route 不再复制;
+ *         嵌套的 route 同样放在外层 route 的输出中.
+ *         网络输出层, 带 truth 的层及不在 plannable_layer 中的层保留各自的输出.
+ *         只用于推理, 必须在 set_batch_network 之后调用, 之后不能再 resize_network
+ */
+void plan_network_memory(network *net)
+{
+#ifdef GPU
+    if (gpu_index >= 0)
+        return;
+#endif
+    if (net->arena)
+        return;
+
+    int n = net->n;
+    int *last = calloc(n, sizeof(int));
+    int *owner = calloc(n, sizeof(int));
+    int *first = calloc(n, sizeof(int));
+    int *routed = calloc(n, sizeof(int));
+    size_t *place = calloc(n, sizeof(size_t));
+    int *assign = calloc(n, sizeof(int));
+    int *buf_last = calloc(n, sizeof(int));
+    size_t *buf_size = calloc(n, sizeof(size_t));
+    int i, j, b, s;
+
+    for (i = 0; i < n; ++i)
+    {
+        layer *l = net->layers + i;
+        owner[i] = (i > 0 && l->output == net->layers[i - 1].output) ? owner[i - 1] : i;
+        if (last[i] < i + 1)
+            last[i] = i + 1;
+        if (l->truth)
+            last[i] = n;
+        if (l->type == ROUTE)
+        {
+            for (j = 0; j < l->n; ++j)
+            {
+                int index = l->input_layers[j];
+                if (last[index] < i)
+                    last[index] = i;
+            }
+        }
+        if (l->type == SHORTCUT && last[l->index] < i)
+            last[l->index] = i;
+    }
+    for (i = n - 1; i >= 0; --i)
+    {
+        if (net->layers[i].type != COST)
+            break;
+    }
+    if (i >= 0)
+        last[i] = n;
+    for (i = 0; i < n; ++i)
+    {
+        if (last[owner[i]] < last[i])
+            last[owner[i]] = last[i];
+    }
+
+    /* 从后向前处理 route, 输入层放到 route 输出所在的缓冲区中;
+     * 输入层与其他层共用输出或已放入其他 route 时仍由 route 复制 */
+    int nrouted = 0;
+    for (i = n - 1; i >= 0; --i)
+    {
+        layer *l = net->layers + i;
+        if (l->type != ROUTE || l->batch != 1 || !l->output || last[owner[i]] >= n)
+            continue;
+        size_t offset = 0;
+        for (j = 0; j < l->n; offset += l->input_sizes[j], ++j)
+        {
+            int index = l->input_layers[j];
+            layer *in = net->layers + index;
+            if (!plannable_layer(in->type) || !in->output || owner[index] != index ||
+                last[index] >= n || (index + 1 < n && owner[index + 1] == index))
+                continue;
+            owner[index] = owner[i];
+            place[index] = place[i] + offset;
+            routed[index] = 1;
+            ++nrouted;
+        }
+    }
+    for (i = 0; i < n; ++i)
+    {
+        if (last[owner[i]] < last[i])
+            last[owner[i]] = last[i];
+        first[i] = n;
+    }
+    /* 合并到卷积中的池化在卷积层计算时写入 */
+    for (i = n - 1; i >= 0; --i)
+    {
+        s = (i > 0 && net->layers[i - 1].fuse_maxpool) ? i - 1 : i;
+        if (first[owner[i]] > s)
+            first[owner[i]] = s;
+    }
+
+    /* 按每组输出第一次写入的顺序分配, 选择已空闲的缓冲区中能容纳的最小者,
+     * 都不够大时扩大最大的一个 */
+    int nbuf = 0;
+    size_t before = 0;
+    for (i = 0; i < n; ++i)
+    {
+        layer *l = net->layers + i;
+        assign[i] = -1;
+        if (routed[i])
+            before += (size_t)l->outputs * l->batch;
+    }
+    for (s = 0; s < n; ++s)
+    {
+        for (i = s; i < n; ++i)
+        {
+            layer *l = net->layers + i;
+            if (first[i] != s || !plannable_layer(l->type) || owner[i] != i ||
+                last[i] >= n || !l->output)
+                continue;
+
+            size_t size = (size_t)l->outputs * l->batch;
+            int best = -1;
+            for (b = 0; b < nbuf; ++b)
+            {
+                if (buf_last[b] >= s)
+                    continue;
+                if (best < 0)
+                {
+                    best = b;
+                }
+                else if (buf_size[b] >= size)
+                {
+                    if (buf_size[best] < size || buf_size[b] < buf_size[best])
+                        best = b;
+                }
+                else if (buf_size[best] < size && buf_size[b] > buf_size[best])
+                {
+                    best = b;
+                }
+            }
+            if (best < 0)
+                best = nbuf++;
+            if (buf_size[best] < size)
+                buf_size[best] = size;
+            buf_last[best] = last[i];
+            assign[i] = best;
+            before += size;
+        }
+    }
+
+    size_t *offset = calloc(nbuf + 1, sizeof(size_t));
+    for (b = 0; b < nbuf; ++b)
+        offset[b + 1] = offset[b] + (buf_size[b] + 15) / 16 * 16;
+    if (offset[nbuf])
+    {
+        net->arena_size = offset[nbuf];
+        net->arena = calloc(net->arena_size, sizeof(float));
+    }
+
+    for (i = 0; i < n; ++i)
+    {
+        layer *l = net->layers + i;
+        if (assign[i] >= 0)
+        {
+            free(l->output);
+            l->output = net->arena + offset[assign[i]];
+        }
+    }
+    for (i = 0; i < n; ++i)
+    {
+        layer *l = net->layers + i;
+        if (routed[i])
+        {
+            free(l->output);
+            l->output = net->layers[owner[i]].output + place[i];
+        }
+        else if (owner[i] != i)
+        {
+            l->output = net->layers[owner[i]].output + place[i];
+            l->delta = 0;
+            continue;
+        }
+        if (plannable_layer(l->type))
+            free_layer_train_state(l);
+    }
+    net->output = get_network_output_layer(*net).output;
+
+    fprintf(stderr, "memory planner: %d buffers, %d route inputs in place, %.2f MB -> %.2f MB\n",
+            nbuf, nrouted, before * sizeof(float) / 1048576.,
+            net->arena_size * sizeof(float) / 1048576.);
+
+    free(offset);
+    free(buf_size);
+    free(buf_last);
+    free(assign);
+    free(place);
+    free(routed);
+    free(first);
+    free(owner);
+    free(last);
+}
+
+/**
+ * @brief  第 i 层的输出是否为单独分配的缓冲区, 不在 arena 中也不与之前的层共用
+ */
+static int owned_output(const network *net, int i)
+{
+    const layer *l = net->layers + i;
+    int j;
+    if (!l->output)
+        return 0;
+    if (net->arena && l->output >= net->arena && l->output < net->arena + net->arena_size)
+        return 0;
+    for (j = 0; j < i; ++j)
+    {
+        const layer *p = net->layers + j;
+        if (p->output && l->output >= p->output &&
+            l->output < p->output + (size_t)p->outputs * p->batch)
+            return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief  创建与 net 共用权重的推理上下文
+ * @note   ctx 中的层与 net 共用权重, 偏置, 合并后的批归一化参数及 winograd 权重等
+ *         只读数据, 每个上下文单独分配前向计算会写入的内存: arena 及单独分配的层输出,
+ *         workspace, 输入, region/detection/cost 等层的 delta 及 cost,
+ *         以及 normalization (LRN) 层的 squared/norms.
+ *         输出之间的共用关系 (arena 中的位置, route 输入直接写入 route 输出,
+ *         dropout 及 region 与前一层共用输出) 与 net 相同.
+ *         不同上下文可在不同线程中同时调用 network_predict, 线程池由调用者设置.
+ *         net 在所有上下文释放之前不能释放, 也不能再修改权重或 resize_network.
+ *         含有状态的循环层 (rnn/crnn/gru/lstm) 及 xnor 卷积在前向计算时修改层内数据,
+ *         不支持.
+ * @retval 0 成功, 1 不支持
+ */
+int clone_network_context(const network *net, network *ctx)
+{
+    int i, j;
+#ifdef GPU
+    if (gpu_index >= 0)
+    {
+        fprintf(stderr, "clone_network_context: gpu network is not supported\n");
+        return 1;
+    }
+#endif
+    for (i = 0; i < net->n; ++i)
+    {
+        layer *l = net->layers + i;
+        if (l->type == RNN || l->type == CRNN || l->type == GRU || l->type == LSTM || l->xnor)
+        {
+            fprintf(stderr, "clone_network_context: layer %d is stateful, can not share\n", i);
+            return 1;
+        }
+    }
+
+    *ctx = *net;
+    ctx->shared_weights = 1;
+#ifdef NNPACK
+    ctx->resize_plans = 0;
+#endif
+    ctx->layers = calloc(net->n, sizeof(layer));
+    memcpy(ctx->layers, net->layers, net->n * sizeof(layer));
+    ctx->cost = calloc(1, sizeof(float));
+    ctx->input = calloc(net->inputs * net->batch, sizeof(float));
+    ctx->truth = 0;
+    ctx->delta = 0;
+
+    size_t workspace_size = 0;
+    for (i = 0; i < net->n; ++i)
+    {
+        if (net->layers[i].workspace_size > workspace_size)
+            workspace_size = net->layers[i].workspace_size;
+    }
+    ctx->workspace = workspace_size ? calloc(1, workspace_size) : 0;
+    ctx->arena = net->arena ? calloc(net->arena_size, sizeof(float)) : 0;
+
+    for (i = 0; i < net->n; ++i)
+    {
+        layer *src = net->layers + i;
+        layer *l = ctx->layers + i;
+        size_t size = (size_t)src->outputs * src->batch;
+        if (owned_output(net, i))
+        {
+            l->output = calloc(size, sizeof(float));
+        }
+        else if (src->output && net->arena && src->output >= net->arena &&
+                 src->output < net->arena + net->arena_size)
+        {
+            l->output = ctx->arena + (src->output - net->arena);
+        }
+        else if (src->output)
+        {
+            for (j = 0; j < i; ++j)
+            {
+                layer *p = net->layers + j;
+                if (p->output && src->output >= p->output &&
+                    src->output < p->output + (size_t)p->outputs * p->batch)
+                    break;
+            }
+            l->output = ctx->layers[j].output + (src->output - net->layers[j].output);
+        }
+        if (src->delta)
+            l->delta = calloc(size, sizeof(float));
+        if (src->indexes)
+            l->indexes = calloc(size, sizeof(int));
+        if (src->cost)
+            l->cost = calloc(1, sizeof(float));
+        if (src->type == NORMALIZATION)
+        {
+            /* LRN 前向计算会写 squared/norms, 每个上下文使用各自的缓冲 */
+            l->squared = calloc(size, sizeof(float));
+            l->norms = calloc(size, sizeof(float));
+        }
+        if (src->activated)
+            l->activated = calloc(size, sizeof(float));
+    }
+    ctx->output = get_network_output_layer(*ctx).output;
+    return 0;
+}
+
+/**
+ * @brief  释放 clone_network_context 创建的上下文, 共用的权重不释放
+ */
+static void free_network_context(network net)
+{
+    int i;
+    for (i = 0; i < net.n; ++i)
+    {
+        layer *l = net.layers + i;
+        if (owned_output(&net, i))
+            free(l->output);
+        if (l->delta)
+            free(l->delta);
+        if (l->indexes)
+            free(l->indexes);
+        if (l->cost)
+            free(l->cost);
+        if (l->type == NORMALIZATION)
+        {
+            free(l->squared);
+            free(l->norms);
+        }
+        if (l->activated)
+            free(l->activated);
+    }
+    free(net.layers);
+    if (net.arena)
+        free(net.arena);
+    if (net.workspace)
+        free(net.workspace);
+    free(net.input);
+    free(net.cost);
+}
+
 int resize_network(network *net, int w, int h)
 {
 #ifdef GPU
@@ -390,6 +916,11 @@ int resize_network(network *net, int w, int h)
     cuda_free(net->workspace);
 #endif
     int i;
+    if (net->arena)
+    {
+        fprintf(stderr, "resize_network: network memory is planned, can not resize\n");
+        return 1;
+    }
     //if(w == net->w && h == net->h) return 0;
     net->w = w;
     net->h = h;
@@ -770,11 +1301,37 @@ float network_accuracy_multi(network net, data d, int n)
 void free_network(network net)
 {
     int i;
+    if (net.shared_weights)
+    {
+        free_network_context(net);
+        return;
+    }
     for (i = 0; i < net.n; ++i)
     {
-        free_layer(net.layers[i]);
+        layer *l = net.layers + i;
+        if (net.arena && l->output >= net.arena &&
+            l->output < net.arena + net.arena_size)
+            l->output = 0;
+        if (i > 0 && l->output == net.layers[i - 1].output)
+            l->output = 0;
+        if (net.weights_map)
+        {
+            float **field[] = {&l->weights, &l->biases, &l->scales, &l->rolling_mean,
+                               &l->rolling_variance, &l->winograd_weights};
+            int k;
+            for (k = 0; k < sizeof(field) / sizeof(field[0]); ++k)
+            {
+                if (in_weights_map(&net, *field[k]))
+                    *field[k] = 0;
+            }
+        }
+        free_layer(*l);
     }
     free(net.layers);
+    if (net.arena)
+        free(net.arena);
+    if (net.weights_map)
+        munmap(net.weights_map, net.weights_map_size);
     if (net.input)
         free(net.input);
     if (net.truth)
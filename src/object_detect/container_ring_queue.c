@@ -0,0 +1,99 @@
+/*
+ * File:   container_ring_queue.c
+ *
+ * 有界无锁队列, 每个单元带一个序号, 生产者及消费者通过比较序号与位置判断单元
+ * 是否可写/可读, 再用 CAS 推进位置
+ */
+#include <sched.h>
+#include <stdlib.h>
+#include <time.h>
+#include "object_detect/container_ring_queue.h"
+
+ring_queue create_ring_queue(int capacity) {
+  ring_queue queue = {0};
+  size_t size = 2;
+  size_t i;
+  while (size < (size_t)capacity)
+    size <<= 1;
+  queue.cells = calloc(size, sizeof(ring_queue_cell));
+  for (i = 0; i < size; i++)
+    queue.cells[i].sequence = i;
+  queue.mask = size - 1;
+  return queue;
+}
+
+void free_ring_queue(ring_queue *queue) {
+  if (NULL == queue)
+    return;
+  free(queue->cells);
+  queue->cells = NULL;
+}
+
+int ring_queue_try_push(ring_queue *queue, void *data) {
+  size_t pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+  for (;;) {
+    ring_queue_cell *cell = queue->cells + (pos & queue->mask);
+    size_t seq = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+    long diff = (long)seq - (long)pos;
+    if (0 == diff) {
+      if (__atomic_compare_exchange_n(&queue->enqueue_pos, &pos, pos + 1, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        cell->data = data;
+        __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+        return 1;
+      }
+    } else if (diff < 0) {
+      return 0;
+    } else {
+      pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+int ring_queue_try_pop(ring_queue *queue, void **data) {
+  size_t pos = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+  for (;;) {
+    ring_queue_cell *cell = queue->cells + (pos & queue->mask);
+    size_t seq = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+    long diff = (long)seq - (long)(pos + 1);
+    if (0 == diff) {
+      if (__atomic_compare_exchange_n(&queue->dequeue_pos, &pos, pos + 1, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        *data = cell->data;
+        __atomic_store_n(&cell->sequence, pos + queue->mask + 1,
+                         __ATOMIC_RELEASE);
+        return 1;
+      }
+    } else if (diff < 0) {
+      return 0;
+    } else {
+      pos = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+/**
+ * 等待时先让出 CPU, 多次失败后短暂休眠, 避免前后阶段较慢时空转占用 CPU
+ */
+static void ring_queue_backoff(int *spins) {
+  if (++*spins < 64) {
+    sched_yield();
+  } else {
+    struct timespec ts = {0, 200000};
+    nanosleep(&ts, NULL);
+  }
+}
+
+void ring_queue_push(ring_queue *queue, void *data) {
+  int spins = 0;
+  while (!ring_queue_try_push(queue, data))
+    ring_queue_backoff(&spins);
+}
+
+void *ring_queue_pop(ring_queue *queue) {
+  void *data;
+  int spins = 0;
+  while (!ring_queue_try_pop(queue, &data))
+    ring_queue_backoff(&spins);
+  return data;
+}
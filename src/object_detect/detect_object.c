@@ -6,8 +6,15 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
 #include "utils.h"
+#include "../activations.h"
 #include "../region_layer.h"
+#ifdef NNPACK
+#include "../simd/conv_neon.h"
+#endif
 #include "object_detect/detect_object.h"
 
 /**
@@ -243,25 +250,87 @@ object_box object_box_correct(correct_param param, object_box box) {
 }
 
 /**
- * @brief  解析目标对象
- * @note   过程 :
- *             (1）把目标从网络输出中解析出来,包括类别及概率及位置信息
- *             (2）根据阈值进行过滤
- *             (3) 将通过筛选的目标进行位置信息矫正，得到在原图像中的位置信息
- *             (4)将目标按概率进行从大到小的顺序进行排列，这里使用链表有序插
- *                  入实现了有序
- *             (5) 对筛选的目标进行极大值抑制剔除
- * @param  l:  region网络输出层
- * @param  param  位置变换参数
- * @param  thresh:
- * @param  nms:
- * @param  *list:
- * @retval None
+ * @brief  创建目标框数组
+ * @note   capacity 为初始容量, 不足时自动扩大, 使用 free_object_box_array 释放
  */
-void parse_object_boxs(layer l, correct_param param, float thresh, float nms,
-                       linked_list *link_list) {
-  TIME_BEGIN(parse_object_boxs);
-  int i, j, n, z;
+object_box_array create_object_box_array(int capacity) {
+  object_box_array boxes = {0};
+  object_box_array_reserve(&boxes, capacity);
+  return boxes;
+}
+
+void free_object_box_array(object_box_array *boxes) {
+  if (NULL == boxes)
+    return;
+  free(boxes->x);
+  free(boxes->y);
+  free(boxes->w);
+  free(boxes->h);
+  free(boxes->prob);
+  free(boxes->classid);
+  free(boxes->anchor_x);
+  free(boxes->anchor_y);
+  free(boxes->anchor_n);
+  free(boxes->work);
+  memset(boxes, 0, sizeof(object_box_array));
+}
+
+/**
+ * @brief  保证数组至少能容纳 capacity 个目标, 已有的目标保持不变
+ */
+void object_box_array_reserve(object_box_array *boxes, int capacity) {
+  if (NULL == boxes || capacity <= boxes->capacity)
+    return;
+  boxes->x = realloc(boxes->x, capacity * sizeof(float));
+  boxes->y = realloc(boxes->y, capacity * sizeof(float));
+  boxes->w = realloc(boxes->w, capacity * sizeof(float));
+  boxes->h = realloc(boxes->h, capacity * sizeof(float));
+  boxes->prob = realloc(boxes->prob, capacity * sizeof(float));
+  boxes->classid = realloc(boxes->classid, capacity * sizeof(int));
+  boxes->anchor_x = realloc(boxes->anchor_x, capacity * sizeof(int));
+  boxes->anchor_y = realloc(boxes->anchor_y, capacity * sizeof(int));
+  boxes->anchor_n = realloc(boxes->anchor_n, capacity * sizeof(int));
+  boxes->capacity = capacity;
+}
+
+void object_box_array_push(object_box_array *boxes, object_box box) {
+  if (boxes->size == boxes->capacity)
+    object_box_array_reserve(boxes,
+                             boxes->capacity ? 2 * boxes->capacity : 64);
+  int i = boxes->size++;
+  boxes->x[i] = box.x;
+  boxes->y[i] = box.y;
+  boxes->w[i] = box.w;
+  boxes->h[i] = box.h;
+  boxes->prob[i] = box.prob;
+  boxes->classid[i] = box.classid;
+  boxes->anchor_x[i] = box.anchor_x;
+  boxes->anchor_y[i] = box.anchor_y;
+  boxes->anchor_n[i] = box.anchor_n;
+}
+
+object_box object_box_array_get(const object_box_array *boxes, int i) {
+  object_box box;
+  box.x = boxes->x[i];
+  box.y = boxes->y[i];
+  box.w = boxes->w[i];
+  box.h = boxes->h[i];
+  box.prob = boxes->prob[i];
+  box.classid = boxes->classid[i];
+  box.anchor_x = boxes->anchor_x[i];
+  box.anchor_y = boxes->anchor_y[i];
+  box.anchor_n = boxes->anchor_n[i];
+  return box;
+}
+
+/**
+ * @brief  解析已做过 logistic/softmax 的 region 输出
+ * @note   类别概率为 置信度 x softmax, 不超过置信度, 因此置信度不超过阈值的
+ *         anchor 不再计算位置及扫描类别
+ */
+static void parse_activated_object_boxs(layer l, correct_param param,
+                                        float thresh, object_box_array *boxes) {
+  int i, j, n;
   float *predictions = l.output;
   for (i = 0; i < l.w * l.h; ++i) {
     int row = i / l.w;
@@ -273,6 +342,8 @@ void parse_object_boxs(layer l, correct_param param, float thresh, float nms,
       int obj_index = entry_index(l, 0, n * l.w * l.h + i, l.coords);
       int box_index = entry_index(l, 0, n * l.w * l.h + i, 0);
       float scale = l.background ? 1 : predictions[obj_index];
+      if (scale <= thresh)
+        continue;
       object_box box = get_object_box(predictions, l.biases, n, box_index, col,
                                       row, l.w, l.h, l.w * l.h);
       box.prob = 0;
@@ -293,28 +364,500 @@ void parse_object_boxs(layer l, correct_param param, float thresh, float nms,
         }
       }
 
-      /**
-       * @brief  有序插入链表中
-       */
-      if (box.prob > thresh) {
-        // printf("\nbox pos: %d %d n:%d box %f %f %f %f prob: %f\n", row, col, n,
-        //        box.x, box.y, box.w, box.h, box.prob);
-        box = object_box_correct(param, box);
-        object_box_node *node = create_object_box_node(box);
-        linked_list_insert_sort(link_list, (linked_node *)node);
+      if (box.prob > thresh)
+        object_box_array_push(boxes, object_box_correct(param, box));
+    }
+  }
+}
+
+/**
+ * @brief  由原始输出解码一个通过筛选的 anchor
+ * @note   sum 为 softmax 的分母 (以最大值为基准), 最大类别的概率为 1 / sum,
+ *         计算方式与 forward_region_layer 相同
+ */
+static void add_raw_object_box(layer l, correct_param param, float thresh,
+                               int n, int i, int classid, float sum,
+                               object_box_array *boxes) {
+  int wh = l.w * l.h;
+  const float *x = l.output + entry_index(l, 0, n * wh + i, 0);
+  float scale = logistic_activate(x[l.coords * wh]);
+  float prob = scale * (1.f / sum);
+  if (prob <= thresh)
+    return;
+
+  int row = i / l.w;
+  int col = i % l.w;
+  object_box box = create_object_box();
+  box.x = (col + logistic_activate(x[0])) / l.w;
+  box.y = (row + logistic_activate(x[wh])) / l.h;
+  box.w = exp(x[2 * wh]) * l.biases[2 * n] / l.w;
+  box.h = exp(x[3 * wh]) * l.biases[2 * n + 1] / l.h;
+  box.prob = prob;
+  box.classid = classid;
+  box.anchor_x = col;
+  box.anchor_y = row;
+  box.anchor_n = n;
+  object_box_array_push(boxes, object_box_correct(param, box));
+}
+
+#ifdef SIMD_X86
+/**
+ * 8 路 exp, 多项式逼近, 相对误差约 1e-7
+ */
+__attribute__((target("avx2,fma")))
+static inline __m256 exp256_ps(__m256 x) {
+  x = _mm256_min_ps(x, _mm256_set1_ps(88.3762626647949f));
+  x = _mm256_max_ps(x, _mm256_set1_ps(-88.3762626647949f));
+  __m256 fx = _mm256_fmadd_ps(x, _mm256_set1_ps(1.44269504088896341f),
+                              _mm256_set1_ps(.5f));
+  fx = _mm256_floor_ps(fx);
+  x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(0.693359375f), x);
+  x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(-2.12194440e-4f), x);
+  __m256 z = _mm256_mul_ps(x, x);
+  __m256 y = _mm256_set1_ps(1.9875691500e-4f);
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.3981999507e-3f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(8.3334519073e-3f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(4.1665795894e-2f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.6666665459e-1f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(5.0000001201e-1f));
+  y = _mm256_fmadd_ps(y, z, _mm256_add_ps(x, _mm256_set1_ps(1.f)));
+  __m256i n = _mm256_add_epi32(_mm256_cvttps_epi32(fx), _mm256_set1_epi32(127));
+  return _mm256_mul_ps(y, _mm256_castsi256_ps(_mm256_slli_epi32(n, 23)));
+}
+
+/**
+ * @brief  同一 anchor 相邻 8 个位置一组, 先比较置信度的原始值,
+ *         有通过的位置时再对这一组做 softmax 及 argmax
+ * @retval 已处理的位置数
+ */
+__attribute__((target("avx2,fma")))
+static int parse_raw_anchor_avx(layer l, correct_param param, float thresh,
+                                float cut, int n, object_box_array *boxes) {
+  int wh = l.w * l.h;
+  const float *x = l.output + entry_index(l, 0, n * wh, 0);
+  const float *obj = x + l.coords * wh;
+  const float *cls = obj + wh;
+  int i, j, k;
+  for (i = 0; i + 8 <= wh; i += 8) {
+    int mask = _mm256_movemask_ps(_mm256_cmp_ps(
+        _mm256_loadu_ps(obj + i), _mm256_set1_ps(cut), _CMP_GT_OQ));
+    if (0 == mask)
+      continue;
+
+    __m256 max = _mm256_loadu_ps(cls + i);
+    __m256 arg = _mm256_setzero_ps();
+    for (j = 1; j < l.classes; ++j) {
+      __m256 v = _mm256_loadu_ps(cls + j * wh + i);
+      __m256 gt = _mm256_cmp_ps(v, max, _CMP_GT_OQ);
+      max = _mm256_max_ps(v, max);
+      arg = _mm256_blendv_ps(arg, _mm256_set1_ps((float)j), gt);
+    }
+    __m256 sum = _mm256_setzero_ps();
+    for (j = 0; j < l.classes; ++j)
+      sum = _mm256_add_ps(sum, exp256_ps(_mm256_sub_ps(
+                                   _mm256_loadu_ps(cls + j * wh + i), max)));
+
+    float s[8], a[8];
+    _mm256_storeu_ps(s, sum);
+    _mm256_storeu_ps(a, arg);
+    for (k = 0; k < 8; ++k) {
+      if (mask & (1 << k))
+        add_raw_object_box(l, param, thresh, n, i + k, (int)a[k], s[k],
+                           boxes);
+    }
+  }
+  return i;
+}
+#endif
+
+/**
+ * @brief  解析保留原始值的 region 输出, 见 defer_network_region_activation
+ * @note   目标概率 = logistic(置信度) x softmax 的最大值, 不超过 logistic(置信度),
+ *         因此先用原始值与 logit(thresh) 比较, 不通过的 anchor 不计算 logistic,
+ *         softmax 及位置, 解码的开销与目标个数成正比而不是与网格大小成正比
+ */
+static void parse_raw_object_boxs(layer l, correct_param param, float thresh,
+                                  object_box_array *boxes) {
+  int wh = l.w * l.h;
+  int i, j, n;
+  /* 留出余量, 边界附近的 anchor 由 add_raw_object_box 按原方式精确判断 */
+  float cut = -FLT_MAX;
+  if (thresh >= 1)
+    return;
+  if (thresh > 0)
+    cut = logf(thresh / (1 - thresh)) - 1e-3f;
+
+  for (n = 0; n < l.n; ++n) {
+    const float *obj = l.output + entry_index(l, 0, n * wh, l.coords);
+    const float *cls = obj + wh;
+    i = 0;
+#ifdef SIMD_X86
+    if (cpu_support_avx2_fma())
+      i = parse_raw_anchor_avx(l, param, thresh, cut, n, boxes);
+#endif
+    for (; i < wh; ++i) {
+      if (obj[i] <= cut)
+        continue;
+      float max = cls[i];
+      int classid = 0;
+      for (j = 1; j < l.classes; ++j) {
+        if (cls[j * wh + i] > max) {
+          max = cls[j * wh + i];
+          classid = j;
+        }
       }
+      float sum = 0;
+      for (j = 0; j < l.classes; ++j)
+        sum += exp(cls[j * wh + i] - max);
+      add_raw_object_box(l, param, thresh, n, i, classid, sum, boxes);
     }
   }
+}
+
+/**
+ * @brief  按 region 层输出的形式解码, 通过阈值的目标按解码顺序追加到 boxes
+ */
+static void parse_region_object_boxs(layer l, correct_param param,
+                                     float thresh, object_box_array *boxes) {
+  object_box_array_reserve(boxes, boxes->size + l.w * l.h * l.n);
+  if (region_output_is_raw(l))
+    parse_raw_object_boxs(l, param, thresh, boxes);
+  else
+    parse_activated_object_boxs(l, param, thresh, boxes);
+}
+
+/**
+ * 排序键: 先按类别, 同类按概率降序, 概率相同时保持解码顺序,
+ * 与链表有序插入的结果一致
+ */
+typedef struct {
+  int classid;
+  float prob;
+  int index;
+} object_box_key;
 
+static int object_box_key_compare(const void *a, const void *b) {
+  const object_box_key *ka = (const object_box_key *)a;
+  const object_box_key *kb = (const object_box_key *)b;
+  if (ka->classid != kb->classid)
+    return ka->classid < kb->classid ? -1 : 1;
+  if (ka->prob != kb->prob)
+    return ka->prob > kb->prob ? -1 : 1;
+  return ka->index - kb->index;
+}
+
+/**
+ * 排序后的目标框, 按左上角/右下角/面积存放, 计算方式与 object_box_iou 相同
+ */
+typedef struct {
+  float *x1;
+  float *y1;
+  float *x2;
+  float *y2;
+  float *area;
+  float *score;
+  int *keep;
+} object_box_sorted;
+
+static inline float object_box_sorted_iou(const object_box_sorted *b, int i,
+                                          int j) {
+  float left = b->x1[i] > b->x1[j] ? b->x1[i] : b->x1[j];
+  float right = b->x2[i] < b->x2[j] ? b->x2[i] : b->x2[j];
+  float top = b->y1[i] > b->y1[j] ? b->y1[i] : b->y1[j];
+  float bottom = b->y2[i] < b->y2[j] ? b->y2[i] : b->y2[j];
+  float w = right - left;
+  float h = bottom - top;
+  float inter = (w < 0 || h < 0) ? 0 : w * h;
+  return inter / (b->area[i] + b->area[j] - inter);
+}
+
+#ifdef SIMD_X86
+/**
+ * @brief  第 i 个目标与 [j, end) 中目标的 IOU, 8 个一组
+ */
+__attribute__((target("avx2,fma")))
+static inline __m256 object_box_sorted_iou_avx(const object_box_sorted *b,
+                                               int i, int j) {
+  __m256 w = _mm256_sub_ps(
+      _mm256_min_ps(_mm256_set1_ps(b->x2[i]), _mm256_loadu_ps(b->x2 + j)),
+      _mm256_max_ps(_mm256_set1_ps(b->x1[i]), _mm256_loadu_ps(b->x1 + j)));
+  __m256 h = _mm256_sub_ps(
+      _mm256_min_ps(_mm256_set1_ps(b->y2[i]), _mm256_loadu_ps(b->y2 + j)),
+      _mm256_max_ps(_mm256_set1_ps(b->y1[i]), _mm256_loadu_ps(b->y1 + j)));
+  __m256 zero = _mm256_setzero_ps();
+  __m256 outside = _mm256_or_ps(_mm256_cmp_ps(w, zero, _CMP_LT_OQ),
+                                _mm256_cmp_ps(h, zero, _CMP_LT_OQ));
+  __m256 inter = _mm256_andnot_ps(outside, _mm256_mul_ps(w, h));
+  __m256 uni = _mm256_sub_ps(
+      _mm256_add_ps(_mm256_set1_ps(b->area[i]), _mm256_loadu_ps(b->area + j)),
+      inter);
+  return _mm256_div_ps(inter, uni);
+}
+
+/**
+ * @retval 已处理到的位置
+ */
+__attribute__((target("avx2,fma")))
+static int object_box_suppress_avx(object_box_sorted *b, int i, int j,
+                                   int end, float nms) {
+  __m256 thresh = _mm256_set1_ps(nms);
+  int k;
+  for (; j + 8 <= end; j += 8) {
+    int mask = _mm256_movemask_ps(
+        _mm256_cmp_ps(object_box_sorted_iou_avx(b, i, j), thresh, _CMP_GT_OQ));
+    for (k = 0; mask; k++, mask >>= 1) {
+      if (mask & 1)
+        b->keep[j + k] = 0;
+    }
+  }
+  return j;
+}
+
+/**
+ * @brief  Gaussian soft-NMS 的衰减, score *= exp(-iou^2 / sigma)
+ * @retval 已处理到的位置
+ */
+__attribute__((target("avx2,fma")))
+static int object_box_decay_avx(object_box_sorted *b, int i, int j, int end,
+                                float sigma) {
+  __m256 scale = _mm256_set1_ps(-1.f / sigma);
+  for (; j + 8 <= end; j += 8) {
+    __m256 iou = object_box_sorted_iou_avx(b, i, j);
+    __m256 decay = exp256_ps(_mm256_mul_ps(_mm256_mul_ps(iou, iou), scale));
+    _mm256_storeu_ps(b->score + j,
+                     _mm256_mul_ps(_mm256_loadu_ps(b->score + j), decay));
+  }
+  return j;
+}
+#endif
+
+static void object_box_swap(object_box_sorted *b, object_box_key *keys, int i,
+                            int j) {
+  float *fields[] = {b->x1, b->y1, b->x2, b->y2, b->area, b->score};
+  int f;
+  for (f = 0; f < 6; f++) {
+    float t = fields[f][i];
+    fields[f][i] = fields[f][j];
+    fields[f][j] = t;
+  }
+  object_box_key k = keys[i];
+  keys[i] = keys[j];
+  keys[j] = k;
+}
+
+/**
+ * @brief  同一类别的目标 [start, end) 已按概率降序排列, 依次用保留的目标抑制
+ *         其后 IOU 超过 nms 的目标
+ */
+static void object_box_hard_nms(object_box_sorted *b, int start, int end,
+                                float nms) {
+  int i, j;
+  for (i = start; i < end; ++i) {
+    if (!b->keep[i])
+      continue;
+    j = i + 1;
+#ifdef SIMD_X86
+    if (cpu_support_avx2_fma())
+      j = object_box_suppress_avx(b, i, j, end, nms);
+#endif
+    for (; j < end; ++j) {
+      if (object_box_sorted_iou(b, i, j) > nms)
+        b->keep[j] = 0;
+    }
+  }
+}
+
+/**
+ * @brief  Gaussian soft-NMS, 每次取剩余目标中得分最高的一个, 按 IOU 衰减其余
+ *         目标的得分, 得分不超过 thresh 的目标丢弃
+ */
+static void object_box_soft_nms(object_box_sorted *b, object_box_key *keys,
+                                int start, int end, float sigma, float thresh) {
+  int i, j;
+  for (i = start; i < end; ++i) {
+    int best = i;
+    for (j = i + 1; j < end; ++j) {
+      if (b->score[j] > b->score[best])
+        best = j;
+    }
+    if (b->score[best] <= thresh) {
+      for (j = i; j < end; ++j)
+        b->keep[j] = 0;
+      return;
+    }
+    if (best != i)
+      object_box_swap(b, keys, i, best);
+    j = i + 1;
+#ifdef SIMD_X86
+    if (cpu_support_avx2_fma())
+      j = object_box_decay_avx(b, i, j, end, sigma);
+#endif
+    for (; j < end; ++j) {
+      float iou = object_box_sorted_iou(b, i, j);
+      b->score[j] *= expf(-iou * iou / sigma);
+    }
+  }
+}
+
+/**
+ * @brief  按类别分组及按概率排序后做极大值抑制, 保留的目标按概率降序写回
+ * @param  soft: 0 普通 NMS, 参数为 nms; 1 soft-NMS, 参数为 sigma 及 thresh
+ */
+static void object_box_array_suppress(object_box_array *boxes, int soft,
+                                      float nms, float sigma, float thresh) {
+  int n = boxes->size;
+  int i, s, e;
+  if (n <= 0)
+    return;
+  size_t bytes = n * (sizeof(object_box_key) + 6 * sizeof(float) + sizeof(int));
+  if (boxes->work_size < bytes) {
+    free(boxes->work);
+    boxes->work = malloc(bytes);
+    boxes->work_size = bytes;
+  }
+  object_box_key *keys = (object_box_key *)boxes->work;
+  object_box_sorted b;
+  b.x1 = (float *)(keys + n);
+  b.y1 = b.x1 + n;
+  b.x2 = b.y1 + n;
+  b.y2 = b.x2 + n;
+  b.area = b.y2 + n;
+  b.score = b.area + n;
+  b.keep = (int *)(b.score + n);
+
+  for (i = 0; i < n; ++i) {
+    keys[i].classid = boxes->classid[i];
+    keys[i].prob = boxes->prob[i];
+    keys[i].index = i;
+  }
+  qsort(keys, n, sizeof(object_box_key), object_box_key_compare);
+  for (i = 0; i < n; ++i) {
+    int k = keys[i].index;
+    b.x1[i] = boxes->x[k];
+    b.y1[i] = boxes->y[k];
+    b.x2[i] = boxes->x[k] + boxes->w[k];
+    b.y2[i] = boxes->y[k] + boxes->h[k];
+    b.area[i] = boxes->w[k] * boxes->h[k];
+    b.score[i] = boxes->prob[k];
+    b.keep[i] = 1;
+  }
+
+  for (s = 0; s < n; s = e) {
+    for (e = s + 1; e < n && keys[e].classid == keys[s].classid; ++e)
+      ;
+    if (soft)
+      object_box_soft_nms(&b, keys, s, e, sigma, thresh);
+    else if (nms > 0)
+      object_box_hard_nms(&b, s, e, nms);
+  }
+
+  /* 保留的目标按 (新的) 概率降序排列后写回 */
+  int m = 0;
+  for (i = 0; i < n; ++i) {
+    if (b.keep[i]) {
+      keys[m].classid = 0;
+      keys[m].prob = b.score[i];
+      keys[m].index = keys[i].index;
+      ++m;
+    }
+  }
+  qsort(keys, m, sizeof(object_box_key), object_box_key_compare);
+
+  float *ftmp = b.x1;
+  int *itmp = (int *)b.y1;
+  float *ffields[] = {boxes->x, boxes->y, boxes->w, boxes->h};
+  int *ifields[] = {boxes->classid, boxes->anchor_x, boxes->anchor_y,
+                    boxes->anchor_n};
+  int f;
+  for (f = 0; f < 4; f++) {
+    for (i = 0; i < m; ++i)
+      ftmp[i] = ffields[f][keys[i].index];
+    memcpy(ffields[f], ftmp, m * sizeof(float));
+    for (i = 0; i < m; ++i)
+      itmp[i] = ifields[f][keys[i].index];
+    memcpy(ifields[f], itmp, m * sizeof(int));
+  }
+  for (i = 0; i < m; ++i)
+    boxes->prob[i] = keys[i].prob;
+  boxes->size = m;
+}
+
+/**
+ * @brief  极大值抑制, 同类别 IOU 超过 nms 的目标只保留概率最大的一个
+ * @note   结果与 object_boxs_nms 相同, 保留的目标按概率降序排列;
+ *         nms 不大于 0 时只排序
+ */
+void object_box_array_nms(object_box_array *boxes, float nms) {
+  object_box_array_suppress(boxes, 0, nms, 0, 0);
+}
+
+/**
+ * @brief  Gaussian soft-NMS, 同类别目标的概率按 exp(-iou^2 / sigma) 衰减,
+ *         衰减后不超过 thresh 的目标丢弃, 保留的目标按衰减后的概率降序排列
+ */
+void object_box_array_soft_nms(object_box_array *boxes, float sigma,
+                               float thresh) {
+  object_box_array_suppress(boxes, 1, 0, sigma, thresh);
+}
+
+/**
+ * @brief  解析目标对象
+ * @note   过程 :
+ *             (1）把目标从网络输出中解析出来,包括类别及概率及位置信息
+ *             (2）根据阈值进行过滤
+ *             (3) 将通过筛选的目标进行位置信息矫正，得到在原图像中的位置信息
+ *             (4)将目标按概率进行从大到小的顺序进行排列，这里使用链表有序插
+ *                  入实现了有序
+ *             (5) 对筛选的目标进行极大值抑制剔除
+ *         置信度先于类别及位置判断, 低于阈值的 anchor 不做其余计算;
+ *         region 层保留原始值时 (defer_network_region_activation) 连 logistic
+ *         及 softmax 也只对通过的 anchor 计算
+ *         目标较多时使用 parse_object_boxs_array
+ * @param  l:  region网络输出层
+ * @param  param  位置变换参数
+ * @param  thresh:
+ * @param  nms:
+ * @param  *list:
+ * @retval None
+ */
+void parse_object_boxs(layer l, correct_param param, float thresh, float nms,
+                       linked_list *link_list) {
+  TIME_BEGIN(parse_object_boxs);
+  object_box_array boxes = create_object_box_array(0);
+  parse_region_object_boxs(l, param, thresh, &boxes);
+  int i;
+  for (i = 0; i < boxes.size; ++i) {
+    object_box_node *node =
+        create_object_box_node(object_box_array_get(&boxes, i));
+    linked_list_insert_sort(link_list, (linked_node *)node);
+  }
+  free_object_box_array(&boxes);
   TIME_END(parse_object_boxs);
+
   /**
    * @brief   进行极大值抑制处理
    */
-  // printf("nms before:\n");
-  // linked_list_for_each_forword(link_list, print_object_box, NULL);
-  // TIME_BEGIN(object_boxs_nms);
   object_boxs_nms(link_list, nms);
-  // TIME_END(object_boxs_nms);
-  // printf("nms back:\n");
-  // linked_list_for_each_forword(link_list, print_object_box, NULL);
+}
+
+/**
+ * @brief  解析目标对象到数组中
+ * @note   与 parse_object_boxs 的结果相同, 目标存放在连续的数组中,
+ *         按类别分组及按概率排序一次后做极大值抑制, 开销为 O(n log n) 加上
+ *         同类目标间向量化的 IOU 计算. boxes 原有的内容被清除, 缓冲区重复使用
+ * @param  l:  region网络输出层
+ * @param  param  位置变换参数
+ * @param  thresh:
+ * @param  nms: 不大于 0 时不做极大值抑制, 需要 soft-NMS 时传 0 后调用
+ *              object_box_array_soft_nms
+ * @param  *boxes: 保留的目标, 按概率降序排列
+ * @retval None
+ */
+void parse_object_boxs_array(layer l, correct_param param, float thresh,
+                             float nms, object_box_array *boxes) {
+  TIME_BEGIN(parse_object_boxs_array);
+  boxes->size = 0;
+  parse_region_object_boxs(l, param, thresh, boxes);
+  object_box_array_nms(boxes, nms);
+  TIME_END(parse_object_boxs_array);
 }
@@ -32,6 +32,14 @@
 #include "lstm_layer.h"
 #include "shuffle_layer.h"
 #include "utils.h"
+#ifdef NNPACK
+#include "simd/conv_neon.h"
+#endif
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 typedef struct {
   char *type;
@@ -134,6 +142,7 @@ typedef struct size_params {
   int c;
   int index;
   int time_steps;
+  int train;
   network net;
 } size_params;
 
@@ -213,7 +222,7 @@ convolutional_layer parse_convolutional(list *options, size_params params) {
 
   convolutional_layer layer = make_convolutional_layer(
       batch, h, w, c, n, size, stride, padding, groups, activation,
-      batch_normalize, binary, xnor, params.net.adam);
+      batch_normalize, binary, xnor, params.net.adam, params.train);
   layer.flipped = option_find_int_quiet(options, "flipped", 0);
   layer.dot = option_find_float_quiet(options, "dot", 0);
 
@@ -280,7 +289,8 @@ layer parse_connected(list *options, size_params params) {
   int batch_normalize = option_find_int_quiet(options, "batch_normalize", 0);
 
   layer l = make_connected_layer(params.batch, params.inputs, output,
-                                 activation, batch_normalize, params.net.adam);
+                                 activation, batch_normalize, params.net.adam,
+                                 params.train);
   return l;
 }
 
@@ -674,7 +684,26 @@ int is_network(section *s) {
   return (strcmp(s->type, "[net]") == 0 || strcmp(s->type, "[network]") == 0);
 }
 
-network parse_network_cfg(char *filename) {
+/**
+ * @brief  推理时这些层在构造后释放训练缓冲区
+ */
+static int inference_free_train_state(LAYER_TYPE type) {
+  switch (type) {
+  case MAXPOOL:
+  case AVGPOOL:
+  case ROUTE:
+  case SHORTCUT:
+  case REORG:
+  case ACTIVE:
+  case BATCHNORM:
+  case SHUFFLE:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+static network parse_network_cfg_mode(char *filename, int train, int batch) {
   list *sections = read_cfg(filename);
   node *n = sections->front;
   if (!n)
@@ -688,6 +717,8 @@ network parse_network_cfg(char *filename) {
   if (!is_network(s))
     error("First section must be [net] or [network]");
   parse_net_options(options, &net);
+  if (batch > 0)
+    net.batch = batch;
 
   params.h = net.h;
   params.w = net.w;
@@ -695,6 +726,7 @@ network parse_network_cfg(char *filename) {
   params.inputs = net.inputs;
   params.batch = net.batch;
   params.time_steps = net.time_steps;
+  params.train = train;
   params.net = net;
 
   size_t workspace_size = 0;
@@ -776,6 +808,8 @@ network parse_network_cfg(char *filename) {
         option_find_float_quiet(options, "learning_rate", 1);
     l.smooth = option_find_float_quiet(options, "smooth", 0);
     option_unused(options);
+    if (!train && inference_free_train_state(lt))
+      free_layer_train_state(&l);
     net.layers[count] = l;
     if (l.workspace_size > workspace_size)
       workspace_size = l.workspace_size;
@@ -819,6 +853,28 @@ network parse_network_cfg(char *filename) {
   return net;
 }
 
+network parse_network_cfg(char *filename) {
+  return parse_network_cfg_mode(filename, 1, 0);
+}
+
+/**
+ * @brief  只用于推理的网络构造
+ * @note   卷积层及全连接层不分配梯度, 动量及批归一化的训练缓冲区, 也不做随机初始化,
+ *         权重必须随后由 load_weights 载入. 其他常用层构造后释放训练缓冲区.
+ *         得到的网络不能用于 train_network
+ */
+network parse_network_cfg_inference(char *filename) {
+  return parse_network_cfg_mode(filename, 0, 0);
+}
+
+/**
+ * @brief  只用于推理的网络构造, 各层按 batch 分配输出及 workspace
+ * @note   忽略 cfg 中的 batch 及 subdivisions, 用于一次推理多张图片
+ */
+network parse_network_cfg_inference_batch(char *filename, int batch) {
+  return parse_network_cfg_mode(filename, 0, batch);
+}
+
 list *read_cfg(char *filename) {
   FILE *file = fopen(filename, "r");
   if (file == 0)
@@ -1063,6 +1119,7 @@ void load_batchnorm_weights(layer l, FILE *fp) {
   fread(l.scales, sizeof(float), l.c, fp);
   fread(l.rolling_mean, sizeof(float), l.c, fp);
   fread(l.rolling_variance, sizeof(float), l.c, fp);
+  expand_rolling_mean_variance(&l);
 #ifdef GPU
   if (gpu_index >= 0) {
     push_batchnorm_layer(l);
@@ -1144,6 +1201,10 @@ void load_convolutional_weights(layer l, FILE *fp) {
   if (l.flipped) {
     transpose_matrix(l.weights, l.c * l.size * l.size, l.n);
   }
+#ifdef NNPACK
+  winograd_convolutional_weights(l);
+  conv1x1_convolutional_weights(l);
+#endif
 #ifdef GPU
   if (gpu_index >= 0) {
     push_convolutional_layer(l);
@@ -1245,3 +1306,236 @@ void load_weights_upto(network *net, char *filename, int start, int cutoff) {
 void load_weights(network *net, char *filename) {
   load_weights_upto(net, filename, 0, net->n);
 }
+
+/**
+ * 打包权重文件: packed_weights_header, 每层一个 packed_layer_entry, 之后是按
+ * PACKED_WEIGHTS_ALIGN 字节对齐的各个数组. 数组保存推理时使用的形式 (卷积层已合并
+ * 批归一化, 可选保存 Winograd 变换后的权重), 加载时 mmap 后层直接指向文件内容.
+ */
+#define PACKED_WEIGHTS_MAGIC 0x57504b44 /* "DKPW" */
+#define PACKED_WEIGHTS_VERSION 1
+#define PACKED_WEIGHTS_ALIGN 64
+
+enum {
+  PACKED_WEIGHTS,
+  PACKED_BIASES,
+  PACKED_SCALES,
+  PACKED_ROLLING_MEAN,
+  PACKED_ROLLING_VARIANCE,
+  PACKED_WINOGRAD_WEIGHTS,
+  PACKED_ARRAYS
+};
+
+typedef struct {
+  int32_t magic;
+  int32_t version;
+  int32_t n;
+  int32_t reserved;
+  uint64_t seen;
+} packed_weights_header;
+
+typedef struct {
+  int32_t type;
+  int32_t batch_normalize;
+  int32_t winograd;
+  int32_t reserved;
+  uint64_t offset[PACKED_ARRAYS];
+  uint64_t count[PACKED_ARRAYS];
+} packed_layer_entry;
+
+/**
+ * @brief  层中需要打包的数组及其长度, 不需要的数组长度为 0
+ * @retval 0: 层不含权重, 1: 支持打包, -1: 含权重但不支持打包
+ */
+static int packed_layer_fields(layer *l, float **field[PACKED_ARRAYS],
+                               size_t count[PACKED_ARRAYS]) {
+  field[PACKED_WEIGHTS] = &l->weights;
+  field[PACKED_BIASES] = &l->biases;
+  field[PACKED_SCALES] = &l->scales;
+  field[PACKED_ROLLING_MEAN] = &l->rolling_mean;
+  field[PACKED_ROLLING_VARIANCE] = &l->rolling_variance;
+  field[PACKED_WINOGRAD_WEIGHTS] = &l->winograd_weights;
+  memset(count, 0, sizeof(size_t) * PACKED_ARRAYS);
+
+  size_t n = 0;
+  if (l->type == CONVOLUTIONAL) {
+    n = l->n;
+    count[PACKED_WEIGHTS] = l->nweights;
+#ifdef NNPACK
+    if (l->winograd && l->winograd_weights)
+      count[PACKED_WINOGRAD_WEIGHTS] =
+          winograd_weights_size(l->winograd, l->n, l->c);
+#endif
+  } else if (l->type == CONNECTED) {
+    n = l->outputs;
+    count[PACKED_WEIGHTS] = (size_t)l->outputs * l->inputs;
+  } else if (l->type == BATCHNORM) {
+    count[PACKED_BIASES] = count[PACKED_SCALES] = l->c;
+    count[PACKED_ROLLING_MEAN] = count[PACKED_ROLLING_VARIANCE] = l->c;
+    return 1;
+  } else if (l->type == DECONVOLUTIONAL || l->type == LOCAL ||
+             l->type == CRNN || l->type == RNN || l->type == LSTM ||
+             l->type == GRU) {
+    return -1;
+  } else {
+    return 0;
+  }
+  count[PACKED_BIASES] = n;
+  if (l->batch_normalize) {
+    count[PACKED_SCALES] = n;
+    count[PACKED_ROLLING_MEAN] = count[PACKED_ROLLING_VARIANCE] = n;
+  }
+  return 1;
+}
+
+static size_t packed_align(size_t offset) {
+  return (offset + PACKED_WEIGHTS_ALIGN - 1) / PACKED_WEIGHTS_ALIGN *
+         PACKED_WEIGHTS_ALIGN;
+}
+
+/**
+ * @brief  以打包格式保存权重, 供 load_packed_weights 使用
+ * @note   保存层当前的内容, 需要合并批归一化时先调用 fold_convolutional_batchnorm
+ */
+void save_packed_weights(network net, char *filename) {
+  fprintf(stderr, "Saving packed weights to %s\n", filename);
+  FILE *fp = fopen(filename, "wb");
+  if (!fp)
+    file_error(filename);
+
+  packed_weights_header header = {0};
+  header.magic = PACKED_WEIGHTS_MAGIC;
+  header.version = PACKED_WEIGHTS_VERSION;
+  header.n = net.n;
+  header.seen = *net.seen;
+
+  packed_layer_entry *entries = calloc(net.n, sizeof(packed_layer_entry));
+  size_t offset = packed_align(sizeof(header) +
+                               net.n * sizeof(packed_layer_entry));
+  int i, k;
+  for (i = 0; i < net.n; ++i) {
+    float **field[PACKED_ARRAYS];
+    size_t count[PACKED_ARRAYS];
+    layer *l = net.layers + i;
+    if (packed_layer_fields(l, field, count) < 0)
+      error("Packed weights only support convolutional, connected and "
+            "batchnorm layers");
+    entries[i].type = l->type;
+    entries[i].batch_normalize = l->batch_normalize;
+    entries[i].winograd = l->winograd;
+    for (k = 0; k < PACKED_ARRAYS; ++k) {
+      if (!count[k])
+        continue;
+      entries[i].offset[k] = offset;
+      entries[i].count[k] = count[k];
+      offset = packed_align(offset + count[k] * sizeof(float));
+    }
+  }
+
+  static const char zeros[PACKED_WEIGHTS_ALIGN] = {0};
+  fwrite(&header, sizeof(header), 1, fp);
+  fwrite(entries, sizeof(packed_layer_entry), net.n, fp);
+  long pos = ftell(fp);
+  for (i = 0; i < net.n; ++i) {
+    float **field[PACKED_ARRAYS];
+    size_t count[PACKED_ARRAYS];
+    packed_layer_fields(net.layers + i, field, count);
+    for (k = 0; k < PACKED_ARRAYS; ++k) {
+      if (!count[k])
+        continue;
+      fwrite(zeros, 1, entries[i].offset[k] - pos, fp);
+      fwrite(*field[k], sizeof(float), count[k], fp);
+      pos = entries[i].offset[k] + count[k] * sizeof(float);
+    }
+  }
+  fwrite(zeros, 1, offset - pos, fp);
+  fclose(fp);
+  free(entries);
+}
+
+/**
+ * @brief  mmap 方式加载 save_packed_weights 生成的文件, 层的权重直接指向文件内容,
+ *         多个进程共享同一份页缓存
+ * @note   映射为只读, 只用于推理. 文件中已合并批归一化的卷积层 batch_normalize
+ *         置 0. 映射在 free_network 中释放
+ * @retval 1: 加载成功, 0: 不是打包格式的文件
+ */
+int load_packed_weights(network *net, char *filename) {
+#ifdef GPU
+  if (gpu_index >= 0)
+    return 0;
+#endif
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    file_error(filename);
+  struct stat st;
+  packed_weights_header header;
+  if (fstat(fd, &st) || st.st_size < (off_t)sizeof(header) ||
+      pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+      header.magic != PACKED_WEIGHTS_MAGIC) {
+    close(fd);
+    return 0;
+  }
+  if (header.version != PACKED_WEIGHTS_VERSION || header.n != net->n ||
+      (size_t)st.st_size < sizeof(header) + net->n * sizeof(packed_layer_entry))
+    error("Packed weights do not match the network");
+
+  fprintf(stderr, "Mapping packed weights from %s...", filename);
+  size_t size = st.st_size;
+  char *map = mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    file_error(filename);
+
+  const packed_layer_entry *entries =
+      (const packed_layer_entry *)(map + sizeof(header));
+  int i, k;
+  for (i = 0; i < net->n; ++i) {
+    layer *l = net->layers + i;
+    const packed_layer_entry *e = entries + i;
+    float **field[PACKED_ARRAYS];
+    size_t count[PACKED_ARRAYS];
+    if (e->type != l->type)
+      error("Packed weights do not match the network");
+    if (packed_layer_fields(l, field, count) <= 0)
+      continue;
+    if (e->batch_normalize && !l->batch_normalize)
+      error("Packed weights do not match the network");
+    /* Winograd 分块与当前网络不同时 (如修改了输入大小) 重新计算 */
+    int winograd = count[PACKED_WINOGRAD_WEIGHTS] &&
+                   (!e->count[PACKED_WINOGRAD_WEIGHTS] ||
+                    e->winograd != l->winograd);
+    for (k = 0; k < PACKED_ARRAYS; ++k) {
+      if (!e->count[k])
+        continue;
+      if (k == PACKED_WINOGRAD_WEIGHTS && (winograd || !count[k]))
+        continue;
+      if (e->count[k] != count[k] ||
+          e->offset[k] % PACKED_WEIGHTS_ALIGN ||
+          e->offset[k] + e->count[k] * sizeof(float) > size)
+        error("Packed weights do not match the network");
+      if (*field[k])
+        free(*field[k]);
+      *field[k] = (float *)(map + e->offset[k]);
+    }
+    if (l->type == CONVOLUTIONAL) {
+      if (!e->batch_normalize) {
+        l->batch_normalize = 0;
+      } else if (l->expand_a) {
+        expand_rolling_mean_variance(l);
+      }
+#ifdef NNPACK
+      if (winograd)
+        winograd_convolutional_weights(*l);
+      conv1x1_convolutional_weights(*l);
+#endif
+    } else if (l->type == BATCHNORM) {
+      expand_rolling_mean_variance(l);
+    }
+  }
+  *net->seen = header.seen;
+  net->weights_map = map;
+  net->weights_map_size = size;
+  fprintf(stderr, "Done!\n");
+  return 1;
+}
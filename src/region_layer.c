@@ -149,18 +149,19 @@ int entry_index(layer l, int batch, int location, int entry) {
          entry * l.w * l.h + loc;
 }
 
-void forward_region_layer(const layer l, network net) {
-  int i, j, b, t, n;
-  memcpy(l.output, net.input, l.outputs * l.batch * sizeof(float));
-
-#ifndef GPU
+/**
+ * @brief  对 region 层的原始输出做 logistic 及 softmax
+ * @note   output 中须已复制了 input, softmax 从 input 计算写入 output
+ */
+static void activate_region_output(const layer l, float *input, float *output) {
+  int b, n;
   for (b = 0; b < l.batch; ++b) {
     for (n = 0; n < l.n; ++n) {
       int index = entry_index(l, b, n * l.w * l.h, 0);
-      activate_array(l.output + index, 2 * l.w * l.h, LOGISTIC);
+      activate_array(output + index, 2 * l.w * l.h, LOGISTIC);
       index = entry_index(l, b, n * l.w * l.h, l.coords);
       if (!l.background)
-        activate_array(l.output + index, l.w * l.h, LOGISTIC);
+        activate_array(output + index, l.w * l.h, LOGISTIC);
     }
   }
   if (l.softmax_tree) {
@@ -168,16 +169,24 @@ void forward_region_layer(const layer l, network net) {
     int count = l.coords + 1;
     for (i = 0; i < l.softmax_tree->groups; ++i) {
       int group_size = l.softmax_tree->group_size[i];
-      softmax_cpu(net.input + count, group_size, l.batch, l.inputs,
+      softmax_cpu(input + count, group_size, l.batch, l.inputs,
                   l.n * l.w * l.h, 1, l.n * l.w * l.h, l.temperature,
-                  l.output + count);
+                  output + count);
       count += group_size;
     }
   } else if (l.softmax) {
     int index = entry_index(l, 0, 0, l.coords + !l.background);
-    softmax_cpu(net.input + index, l.classes + l.background, l.batch * l.n,
-                l.inputs / l.n, l.w * l.h, 1, l.w * l.h, 1, l.output + index);
+    softmax_cpu(input + index, l.classes + l.background, l.batch * l.n,
+                l.inputs / l.n, l.w * l.h, 1, l.w * l.h, 1, output + index);
   }
+}
+
+void forward_region_layer(const layer l, network net) {
+  int i, j, b, t, n;
+  memcpy(l.output, net.input, l.outputs * l.batch * sizeof(float));
+
+#ifndef GPU
+  activate_region_output(l, net.input, l.output);
 #endif
 
   memset(l.delta, 0, l.outputs * l.batch * sizeof(float));
@@ -353,6 +362,16 @@ void forward_region_layer(const layer l, network net) {
          avg_anyobj / (l.w * l.h * l.n * l.batch), recall / count, count);
 }
 
+/**
+ * @brief  已由 defer_network_region_activation 设置, 输出与前一层共用, 保留原始值,
+ *         logistic 及 softmax 在解析目标时只对需要的 anchor 计算
+ */
+void forward_region_layer_raw(const layer l, network net) {}
+
+int region_output_is_raw(const layer l) {
+  return l.type == REGION && l.forward == forward_region_layer_raw;
+}
+
 void backward_region_layer(const layer l, network net) {
   /*
      int b;
@@ -398,6 +417,11 @@ void get_region_boxes(layer l, int w, int h, int netw, int neth, float thresh,
                       int only_objectness, int *map, float tree_thresh,
                       int relative) {
   int i, j, n, z;
+  if (region_output_is_raw(l)) {
+    memcpy(l.activated, l.output, l.batch * l.outputs * sizeof(float));
+    activate_region_output(l, l.output, l.activated);
+    l.output = l.activated;
+  }
   float *predictions = l.output;
   if (l.batch == 2) {
     float *flip = l.output + l.outputs;
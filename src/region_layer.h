@@ -7,6 +7,8 @@
 
 layer make_region_layer(int batch, int h, int w, int n, int classes, int coords);
 void forward_region_layer(const layer l, network net);
+void forward_region_layer_raw(const layer l, network net);
+int region_output_is_raw(const layer l);
 void backward_region_layer(const layer l, network net);
 void resize_region_layer(layer *l, int w, int h);
 
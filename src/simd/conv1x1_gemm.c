@@ -0,0 +1,251 @@
+#include "conv_neon.h"
+
+#ifdef SIMD_X86
+#include <immintrin.h>
+#endif
+
+/**
+ * 1x1 卷积按矩阵乘法计算
+ *   output[outch][outw*outh] = weights[outch][inch] x input[inch][outw*outh]
+ * 输入先按 CONV1X1_GEMM_NR 列一组打包为 [panels][inch][NR], 打包时完成步长
+ * 采样及补边, 因此步长 2 与步长 1 共用同一个计算核.
+ * 权重在加载时打包为 [outch/MR][inch][MR] 并缓存在层中, 计算时每个任务处理一个输入块及
+ * CONV1X1_GEMM_MC 个输出通道, 输入通道按 CONV1X1_GEMM_KC 分段, 使打包后的
+ * 输入块在 L1 缓存中被这些输出通道重复使用.
+ */
+
+#define CONV1X1_GEMM_NR 16
+#define CONV1X1_GEMM_MR 6
+#define CONV1X1_GEMM_MC (CONV1X1_GEMM_MR * 8)
+#define CONV1X1_GEMM_KC 256
+
+struct conv1x1_gemm_params {
+    struct conv_params *conv;
+    size_t batch;
+    int n;
+    float *packed;
+};
+
+size_t conv1x1_gemm_workspace_size(int outw, int outh, int inch) {
+    size_t n = (size_t)outw * outh;
+    size_t panels = (n + CONV1X1_GEMM_NR - 1) / CONV1X1_GEMM_NR;
+    return panels * CONV1X1_GEMM_NR * inch;
+}
+
+size_t conv1x1_gemm_weights_size(int outch, int inch) {
+    size_t mpanels = (outch + CONV1X1_GEMM_MR - 1) / CONV1X1_GEMM_MR;
+    return mpanels * CONV1X1_GEMM_MR * inch;
+}
+
+/**
+ * @brief  打包 1x1 卷积的权重, 每 CONV1X1_GEMM_MR 个输出通道一组打包为 [inch][MR],
+ *         不足一组时重复最后一个有效通道
+ * @note   packed 的大小见 conv1x1_gemm_weights_size, 修改权重后需要重新打包
+ */
+void conv1x1_gemm_pack_weights(const float *weights, float *packed, int outch,
+                               int inch) {
+    int m0, r, k;
+    for (m0 = 0; m0 < outch; m0 += CONV1X1_GEMM_MR, packed += inch * CONV1X1_GEMM_MR) {
+        for (r = 0; r < CONV1X1_GEMM_MR; r++) {
+            int m = m0 + r < outch ? m0 + r : outch - 1;
+            const float *src = weights + m * inch;
+            for (k = 0; k < inch; k++)
+                packed[k * CONV1X1_GEMM_MR + r] = src[k];
+        }
+    }
+}
+
+/**
+ * 打包一个输入块, 超出输出大小或落在补边区域的列填 0
+ */
+static void conv1x1_gemm_pack_thread(struct conv1x1_gemm_params *p,
+                                     size_t panel) {
+    struct conv_params *conv = p->conv;
+    int map = conv->w * conv->h;
+    const float *img = conv->input + p->batch * conv->inch * map;
+    float *dst = p->packed + panel * conv->inch * CONV1X1_GEMM_NR;
+    int n0 = panel * CONV1X1_GEMM_NR;
+    int cols = p->n - n0;
+    if (cols > CONV1X1_GEMM_NR)
+        cols = CONV1X1_GEMM_NR;
+
+    int k, j;
+    if (1 == conv->stride && 0 == conv->pad) {
+        for (k = 0; k < conv->inch; k++, dst += CONV1X1_GEMM_NR) {
+            memcpy(dst, img + k * map + n0, sizeof(float) * cols);
+            for (j = cols; j < CONV1X1_GEMM_NR; j++)
+                dst[j] = 0;
+        }
+        return;
+    }
+
+    int offset[CONV1X1_GEMM_NR];
+    for (j = 0; j < CONV1X1_GEMM_NR; j++) {
+        offset[j] = -1;
+        if (j < cols) {
+            int y = (n0 + j) / conv->outw * conv->stride - conv->pad;
+            int x = (n0 + j) % conv->outw * conv->stride - conv->pad;
+            if (y >= 0 && y < conv->h && x >= 0 && x < conv->w)
+                offset[j] = y * conv->w + x;
+        }
+    }
+    for (k = 0; k < conv->inch; k++, dst += CONV1X1_GEMM_NR) {
+        const float *src = img + k * map;
+        for (j = 0; j < CONV1X1_GEMM_NR; j++)
+            dst[j] = offset[j] < 0 ? 0 : src[offset[j]];
+    }
+}
+
+static void conv1x1_gemm_thread(struct conv1x1_gemm_params *p, size_t panel,
+                                size_t block) {
+    struct conv_params *conv = p->conv;
+    int inch = conv->inch;
+    int n0 = panel * CONV1X1_GEMM_NR;
+    int cols = p->n - n0;
+    if (cols > CONV1X1_GEMM_NR)
+        cols = CONV1X1_GEMM_NR;
+    int m0 = block * CONV1X1_GEMM_MC;
+    int m1 = m0 + CONV1X1_GEMM_MC;
+    if (m1 > conv->outch)
+        m1 = conv->outch;
+
+    const float *b = p->packed + panel * inch * CONV1X1_GEMM_NR;
+    float *out = conv->output + p->batch * conv->outch * p->n + n0;
+
+    int m, k, j;
+    for (m = m0; m < m1; m++) {
+        const float *a = conv->weights + m * inch;
+        float sum[CONV1X1_GEMM_NR] = {0};
+        for (k = 0; k < inch; k++) {
+            const float *bp = b + k * CONV1X1_GEMM_NR;
+            for (j = 0; j < CONV1X1_GEMM_NR; j++)
+                sum[j] += a[k] * bp[j];
+        }
+        if (NULL != conv->bias) {
+            for (j = 0; j < cols; j++)
+                out[m * p->n + j] = conv_epilogue(conv, m, sum[j]);
+        } else {
+            for (j = 0; j < cols; j++)
+                out[m * p->n + j] = sum[j];
+        }
+    }
+}
+
+#ifdef SIMD_X86
+static const int conv1x1_gemm_tail_mask[16] = {-1, -1, -1, -1, -1, -1, -1, -1,
+                                               0,  0,  0,  0,  0,  0,  0,  0};
+
+/**
+ * conv1x1_gemm_thread 的 AVX2/FMA 版本
+ * 寄存器分块: CONV1X1_GEMM_MR 个输出通道 x 16 列, 共 12 个累加寄存器,
+ * 输出通道不足一组时重复计算最后一个有效通道但不写回,
+ * 最后一段输入通道累加完成后在寄存器中完成后处理
+ */
+__attribute__((target("avx2,fma")))
+static void conv1x1_gemm_avx_thread(struct conv1x1_gemm_params *p,
+                                    size_t panel, size_t block) {
+    struct conv_params *conv = p->conv;
+    int inch = conv->inch;
+    int n0 = panel * CONV1X1_GEMM_NR;
+    int cols = p->n - n0;
+    if (cols > CONV1X1_GEMM_NR)
+        cols = CONV1X1_GEMM_NR;
+    int m0 = block * CONV1X1_GEMM_MC;
+    int m1 = m0 + CONV1X1_GEMM_MC;
+    if (m1 > conv->outch)
+        m1 = conv->outch;
+
+    int r0 = cols < 8 ? cols : 8;
+    int r1 = cols - r0;
+    __m256i mask0 = _mm256_loadu_si256((const __m256i *)(conv1x1_gemm_tail_mask + 8 - r0));
+    __m256i mask1 = _mm256_loadu_si256((const __m256i *)(conv1x1_gemm_tail_mask + 8 - r1));
+
+    const float *b = p->packed + panel * inch * CONV1X1_GEMM_NR;
+    float *out = conv->output + p->batch * conv->outch * p->n + n0;
+
+    int k0, m, r, k;
+    for (k0 = 0; k0 < inch; k0 += CONV1X1_GEMM_KC) {
+        int kc = inch - k0;
+        if (kc > CONV1X1_GEMM_KC)
+            kc = CONV1X1_GEMM_KC;
+        for (m = m0; m < m1; m += CONV1X1_GEMM_MR) {
+            int nn = m1 - m;
+            if (nn > CONV1X1_GEMM_MR)
+                nn = CONV1X1_GEMM_MR;
+
+            const float *a = conv->conv1x1_weights + (m * inch + k0 * CONV1X1_GEMM_MR);
+            __m256 sum0[CONV1X1_GEMM_MR];
+            __m256 sum1[CONV1X1_GEMM_MR];
+            for (r = 0; r < CONV1X1_GEMM_MR; r++) {
+                if (0 == k0 || r >= nn) {
+                    sum0[r] = _mm256_setzero_ps();
+                    sum1[r] = _mm256_setzero_ps();
+                } else {
+                    float *outptr = out + (m + r) * p->n;
+                    sum0[r] = _mm256_maskload_ps(outptr, mask0);
+                    sum1[r] = _mm256_maskload_ps(outptr + 8, mask1);
+                }
+            }
+
+            const float *bp = b + k0 * CONV1X1_GEMM_NR;
+            for (k = 0; k < kc; k++, bp += CONV1X1_GEMM_NR, a += CONV1X1_GEMM_MR) {
+                __m256 b0 = _mm256_loadu_ps(bp);
+                __m256 b1 = _mm256_loadu_ps(bp + 8);
+                for (r = 0; r < CONV1X1_GEMM_MR; r++) {
+                    __m256 w = _mm256_broadcast_ss(a + r);
+                    sum0[r] = _mm256_fmadd_ps(b0, w, sum0[r]);
+                    sum1[r] = _mm256_fmadd_ps(b1, w, sum1[r]);
+                }
+            }
+
+            if (NULL != conv->bias && k0 + kc == inch) {
+                for (r = 0; r < nn; r++) {
+                    sum0[r] = conv_epilogue_avx(conv, m + r, sum0[r]);
+                    sum1[r] = conv_epilogue_avx(conv, m + r, sum1[r]);
+                }
+            }
+
+            for (r = 0; r < nn; r++) {
+                float *outptr = out + (m + r) * p->n;
+                if (CONV1X1_GEMM_NR == cols) {
+                    _mm256_storeu_ps(outptr, sum0[r]);
+                    _mm256_storeu_ps(outptr + 8, sum1[r]);
+                } else {
+                    _mm256_maskstore_ps(outptr, mask0, sum0[r]);
+                    _mm256_maskstore_ps(outptr + 8, mask1, sum1[r]);
+                }
+            }
+        }
+    }
+}
+#endif
+
+/**
+ * @brief  1x1 非分组卷积, 支持任意步长及补边
+ * @note   打包后的输入保存在 params->workspace 中, 大小见 conv1x1_gemm_workspace_size,
+ *         params->conv1x1_weights 为 conv1x1_gemm_pack_weights 打包后的权重
+ */
+void conv1x1_gemm(pthreadpool_t threadpool, struct conv_params *params,
+                  size_t batch) {
+    struct conv1x1_gemm_params p;
+    p.conv = params;
+    p.n = params->outw * params->outh;
+    p.packed = params->workspace;
+
+    size_t panels = (p.n + CONV1X1_GEMM_NR - 1) / CONV1X1_GEMM_NR;
+
+    pthreadpool_function_2d_t gemm =
+        (pthreadpool_function_2d_t)conv1x1_gemm_thread;
+#ifdef SIMD_X86
+    if (cpu_support_avx2_fma())
+        gemm = (pthreadpool_function_2d_t)conv1x1_gemm_avx_thread;
+#endif
+
+    size_t blocks = (params->outch + CONV1X1_GEMM_MC - 1) / CONV1X1_GEMM_MC;
+    for (p.batch = 0; p.batch < batch; p.batch++) {
+        pthreadpool_compute_1d(threadpool,
+                               (pthreadpool_function_1d_t)conv1x1_gemm_pack_thread,
+                               &p, panels);
+        pthreadpool_compute_2d(threadpool, gemm, &p, panels, blocks);
+    }
+}
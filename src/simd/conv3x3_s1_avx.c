@@ -0,0 +1,121 @@
+#include "conv_neon.h"
+
+#ifdef SIMD_X86
+#include <immintrin.h>
+
+static const int conv3x3_tail_mask[16] = {-1, -1, -1, -1, -1, -1, -1, -1,
+                                          0,  0,  0,  0,  0,  0,  0,  0};
+
+/**
+ * conv3x3_s1_cpu 的 AVX2/FMA 版本
+ * 输入为 make_border_data 补边后的数据
+ * 寄存器分块: CONV3X3_S1_OUTCH_TILE 个输出通道 x 2 行 x 8 个像素, 在寄存器中
+ * 累加完全部输入通道后才写回输出, 行尾不足 8 个像素时使用掩码读写
+ * 输出通道不足一组时, 多余的通道重复计算最后一个有效通道但不写回
+ * 后处理在写回前对寄存器中的结果完成, 融合的池化在任务结束时逐通道计算
+ */
+__attribute__((target("avx2,fma")))
+void conv3x3_s1_avx(struct conv_params *params, size_t batch, size_t tile)
+{
+    int w = params->w;
+    int h = params->h;
+    int inch = params->inch;
+    int pad = params->pad;
+    int pad_w = w + 2 * pad;
+    int pad_h = h + 2 * pad;
+    int map = pad_w * pad_h;
+
+    int outw = params->outw;
+    int outh = params->outh;
+    int outch = params->outch;
+    const float *kernel = params->weights;
+
+    int p = tile * CONV3X3_S1_OUTCH_TILE;
+    int nn = outch - p;
+    if (nn > CONV3X3_S1_OUTCH_TILE)
+        nn = CONV3X3_S1_OUTCH_TILE;
+
+    const float *img = params->input + batch * inch * map;
+    float *out[CONV3X3_S1_OUTCH_TILE];
+    const float *kernel0[CONV3X3_S1_OUTCH_TILE];
+    int c = 0;
+    for (c = 0; c < CONV3X3_S1_OUTCH_TILE; c++)
+    {
+        int oc = p + (c < nn ? c : nn - 1);
+        out[c] = params->output + batch * (outw * outh * outch) + oc * (outw * outh);
+        kernel0[c] = kernel + oc * inch * 9;
+    }
+
+    int i = 0;
+    for (; i < outh; i += 2)
+    {
+        int rows = (i + 1 < outh) ? 2 : 1;
+        int j = 0;
+        for (; j < outw; j += 8)
+        {
+            int remain = outw - j;
+            __m256i mask = _mm256_loadu_si256(
+                (const __m256i *)(conv3x3_tail_mask + 8 - (remain < 8 ? remain : 8)));
+
+            __m256 sum[CONV3X3_S1_OUTCH_TILE];
+            __m256 sum2[CONV3X3_S1_OUTCH_TILE];
+            for (c = 0; c < CONV3X3_S1_OUTCH_TILE; c++)
+            {
+                sum[c] = _mm256_setzero_ps();
+                sum2[c] = _mm256_setzero_ps();
+            }
+
+            const float *r0 = img + i * pad_w + j;
+            int q = 0;
+            for (q = 0; q < inch; q++, r0 += map)
+            {
+                int r = 0;
+                for (r = 0; r < 4; r++)
+                {
+                    if (r == 3 && rows == 1)
+                        break;
+                    const float *rp = r0 + r * pad_w;
+                    __m256 v0 = _mm256_maskload_ps(rp, mask);
+                    __m256 v1 = _mm256_maskload_ps(rp + 1, mask);
+                    __m256 v2 = _mm256_maskload_ps(rp + 2, mask);
+                    for (c = 0; c < CONV3X3_S1_OUTCH_TILE; c++)
+                    {
+                        const float *k = kernel0[c] + q * 9;
+                        if (r < 3)
+                        {
+                            sum[c] = _mm256_fmadd_ps(v0, _mm256_broadcast_ss(k + r * 3), sum[c]);
+                            sum[c] = _mm256_fmadd_ps(v1, _mm256_broadcast_ss(k + r * 3 + 1), sum[c]);
+                            sum[c] = _mm256_fmadd_ps(v2, _mm256_broadcast_ss(k + r * 3 + 2), sum[c]);
+                        }
+                        if (r > 0)
+                        {
+                            sum2[c] = _mm256_fmadd_ps(v0, _mm256_broadcast_ss(k + r * 3 - 3), sum2[c]);
+                            sum2[c] = _mm256_fmadd_ps(v1, _mm256_broadcast_ss(k + r * 3 - 2), sum2[c]);
+                            sum2[c] = _mm256_fmadd_ps(v2, _mm256_broadcast_ss(k + r * 3 - 1), sum2[c]);
+                        }
+                    }
+                }
+            }
+
+            if (NULL != params->bias)
+            {
+                for (c = 0; c < nn; c++)
+                {
+                    sum[c] = conv_epilogue_avx(params, p + c, sum[c]);
+                    sum2[c] = conv_epilogue_avx(params, p + c, sum2[c]);
+                }
+            }
+
+            for (c = 0; c < nn; c++)
+            {
+                _mm256_maskstore_ps(out[c] + i * outw + j, mask, sum[c]);
+                if (rows == 2)
+                    _mm256_maskstore_ps(out[c] + (i + 1) * outw + j, mask, sum2[c]);
+            }
+        }
+    }
+
+    for (c = 0; c < nn; c++)
+        conv_pool_channel(params, batch, p + c);
+}
+#endif
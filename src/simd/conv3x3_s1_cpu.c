@@ -1,6 +1,10 @@
 #include "conv_neon.h"
 
-void conv3x3_s1_cpu(struct conv_params *params, size_t batch, size_t filters)
+/**
+ * 每个任务计算 CONV3X3_S1_OUTCH_TILE 个输出通道, 共享输入行的读取,
+ * 最后一个任务处理剩余不足一组的输出通道
+ */
+void conv3x3_s1_cpu(struct conv_params *params, size_t batch, size_t tile)
 {
     int w = params->w;
     int h = params->h;
@@ -14,104 +18,94 @@ void conv3x3_s1_cpu(struct conv_params *params, size_t batch, size_t filters)
     int outch = params->outch;
     const float *kernel = params->weights;
 
-    float *out = params->output + batch * (outw * outh * outch) + filters * (outw * outh);
-    memset(out, 0, sizeof(float) * outw * outh);
+    int p = tile * CONV3X3_S1_OUTCH_TILE;
+    int nn = outch - p;
+    if (nn > CONV3X3_S1_OUTCH_TILE)
+        nn = CONV3X3_S1_OUTCH_TILE;
+
+    float *out[CONV3X3_S1_OUTCH_TILE];
+    const float *kernel0[CONV3X3_S1_OUTCH_TILE];
+    int c = 0;
+    for (c = 0; c < nn; c++)
+    {
+        out[c] = params->output + batch * (outw * outh * outch) + (p + c) * (outw * outh);
+        kernel0[c] = kernel + (p + c) * inch * 9;
+        memset(out[c], 0, sizeof(float) * outw * outh);
+    }
 
     int q = 0;
-    const float *kernel0 = kernel + filters * inch * 9;
     for (q = 0; q < inch; q++)
     {
-        float *img0 = params->input + pad_w * pad_h * q;
-
-        float *outptr = out;
-        float *outptr2 = outptr + outw;
+        const float *img0 = params->input + pad_w * pad_h * (batch * inch + q);
 
-        float *r0 = img0;
-        float *r1 = img0 + pad_w;
-        float *r2 = img0 + pad_w * 2;
-        float *r3 = img0 + pad_w * 3;
-
-        float *k0 = kernel0;
-        float *k1 = kernel0 + 3;
-        float *k2 = kernel0 + 6;
+        const float *r0 = img0;
+        const float *r1 = img0 + pad_w;
+        const float *r2 = img0 + pad_w * 2;
+        const float *r3 = img0 + pad_w * 3;
 
         int i = 0;
         for (; i + 1 < outh; i += 2)
         {
-            int remain = outw;
-            for (; remain > 0; remain--)
+            int j = 0;
+            for (; j < outw; j++)
             {
-                float sum = 0;
-                float sum2 = 0;
-
-                sum += r0[0] * k0[0];
-                sum += r0[1] * k0[1];
-                sum += r0[2] * k0[2];
-                sum += r1[0] * k1[0];
-                sum += r1[1] * k1[1];
-                sum += r1[2] * k1[2];
-                sum += r2[0] * k2[0];
-                sum += r2[1] * k2[1];
-                sum += r2[2] * k2[2];
-
-                sum2 += r1[0] * k0[0];
-                sum2 += r1[1] * k0[1];
-                sum2 += r1[2] * k0[2];
-                sum2 += r2[0] * k1[0];
-                sum2 += r2[1] * k1[1];
-                sum2 += r2[2] * k1[2];
-                sum2 += r3[0] * k2[0];
-                sum2 += r3[1] * k2[1];
-                sum2 += r3[2] * k2[2];
-
-                *outptr += sum;
-                *outptr2 += sum2;
-
-                r0++;
-                r1++;
-                r2++;
-                r3++;
-                outptr++;
-                outptr2++;
+                for (c = 0; c < nn; c++)
+                {
+                    const float *k0 = kernel0[c];
+                    const float *k1 = k0 + 3;
+                    const float *k2 = k0 + 6;
+
+                    float sum = 0;
+                    float sum2 = 0;
+
+                    sum += r0[j] * k0[0] + r0[j + 1] * k0[1] + r0[j + 2] * k0[2];
+                    sum += r1[j] * k1[0] + r1[j + 1] * k1[1] + r1[j + 2] * k1[2];
+                    sum += r2[j] * k2[0] + r2[j + 1] * k2[1] + r2[j + 2] * k2[2];
+
+                    sum2 += r1[j] * k0[0] + r1[j + 1] * k0[1] + r1[j + 2] * k0[2];
+                    sum2 += r2[j] * k1[0] + r2[j + 1] * k1[1] + r2[j + 2] * k1[2];
+                    sum2 += r3[j] * k2[0] + r3[j + 1] * k2[1] + r3[j + 2] * k2[2];
+
+                    out[c][i * outw + j] += sum;
+                    out[c][(i + 1) * outw + j] += sum2;
+                }
             }
 
-            r0 += 2 + pad_w;
-            r1 += 2 + pad_w;
-            r2 += 2 + pad_w;
-            r3 += 2 + pad_w;
-
-            outptr += outw;
-            outptr2 += outw;
+            r0 += 2 * pad_w;
+            r1 += 2 * pad_w;
+            r2 += 2 * pad_w;
+            r3 += 2 * pad_w;
         }
 
         for (; i < outh; i++)
         {
-            int remain = outw;
-            for (; remain > 0; remain--)
+            int j = 0;
+            for (; j < outw; j++)
             {
-                float sum = 0;
-                sum += r0[0] * k0[0];
-                sum += r0[1] * k0[1];
-                sum += r0[2] * k0[2];
-                sum += r1[0] * k1[0];
-                sum += r1[1] * k1[1];
-                sum += r1[2] * k1[2];
-                sum += r2[0] * k2[0];
-                sum += r2[1] * k2[1];
-                sum += r2[2] * k2[2];
-
-                *outptr += sum;
-                r0++;
-                r1++;
-                r2++;
-                outptr++;
+                for (c = 0; c < nn; c++)
+                {
+                    const float *k0 = kernel0[c];
+                    const float *k1 = k0 + 3;
+                    const float *k2 = k0 + 6;
+
+                    float sum = 0;
+                    sum += r0[j] * k0[0] + r0[j + 1] * k0[1] + r0[j + 2] * k0[2];
+                    sum += r1[j] * k1[0] + r1[j + 1] * k1[1] + r1[j + 2] * k1[2];
+                    sum += r2[j] * k2[0] + r2[j + 1] * k2[1] + r2[j + 2] * k2[2];
+
+                    out[c][i * outw + j] += sum;
+                }
             }
 
-            r0 += 2;
-            r1 += 2;
-            r2 += 2;
+            r0 += pad_w;
+            r1 += pad_w;
+            r2 += pad_w;
         }
 
-        kernel0 += 9;
+        for (c = 0; c < nn; c++)
+            kernel0[c] += 9;
     }
-}
\ No newline at end of file
+
+    for (c = 0; c < nn; c++)
+        conv_epilogue_channel(params, batch, p + c);
+}
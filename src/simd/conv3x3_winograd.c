@@ -0,0 +1,403 @@
+#include "conv_neon.h"
+
+#ifdef SIMD_X86
+#include <immintrin.h>
+#endif
+
+/**
+ * Winograd F(mxm, 3x3) 卷积
+ *   U = G g G^T       权重变换, 加载权重后只计算一次, 保存在层中
+ *   V = B^T d B       输入变换
+ *   M = sum(U . V)    按 alpha*alpha 个点分别做矩阵乘法
+ *   Y = A^T M A       输出变换
+ * 支持 m = 2 (alpha = 4) 及 m = 4 (alpha = 6)
+ * batch 大于 1 且特征图较小时, 多张图片的块放在一起做矩阵乘法, 变换后的权重
+ * 只读取一次
+ */
+
+static const float winograd_f2_g[4 * 3] = {
+    1, 0, 0,
+    0.5f, 0.5f, 0.5f,
+    0.5f, -0.5f, 0.5f,
+    0, 0, 1};
+
+static const float winograd_f4_g[6 * 3] = {
+    1.f / 4, 0, 0,
+    -1.f / 6, -1.f / 6, -1.f / 6,
+    -1.f / 6, 1.f / 6, -1.f / 6,
+    1.f / 24, 1.f / 12, 1.f / 6,
+    1.f / 24, -1.f / 12, 1.f / 6,
+    0, 0, 1};
+
+#define WINOGRAD_MAX_ALPHA 6
+#define WINOGRAD_OUTCH_TILE 4
+
+/**
+ * 多张图片合并计算时每次最多的块数, 限制 workspace 的大小
+ */
+#define WINOGRAD_BATCH_TILES 1024
+
+struct winograd_params {
+    struct conv_params *conv;
+    int tile;
+    int alpha;
+    int tiles_w;
+    int tiles_h;
+    int tiles;
+    int ntiles;
+    size_t batch;
+    float *v;
+    float *m;
+};
+
+/**
+ * @brief  选择 Winograd 输出块大小
+ * @note   只对 3x3 步长1 非分组且输入通道足够多的卷积使用, 输出不小于 12x12 时使用
+ *         F(4x4, 3x3), 8x8 ~ 12x12 之间使用 F(2x2, 3x3), 更小的特征图分块数太少,
+ *         矩阵乘法效率低, 仍使用直接卷积
+ * @retval 输出块大小 m, 0 表示不使用 Winograd
+ */
+int winograd_tile_size(int size, int stride, int groups, int inch, int outw,
+                       int outh) {
+    if (3 != size || 1 != stride || 1 != groups || inch < 8)
+        return 0;
+    if (outw >= 12 && outh >= 12)
+        return 4;
+    if (outw >= 8 && outh >= 8)
+        return 2;
+    return 0;
+}
+
+size_t winograd_weights_size(int tile, int outch, int inch) {
+    int alpha = tile + 2;
+    return (size_t)alpha * alpha * outch * inch;
+}
+
+/**
+ * @brief  一次合并计算的图片数, 合并后的块数不超过 WINOGRAD_BATCH_TILES,
+ *         一张图片的块数已经超过时逐张计算
+ */
+static int winograd_batch_group(int tile, int outw, int outh, int batch) {
+    int tiles = ((outw + tile - 1) / tile) * ((outh + tile - 1) / tile);
+    int group = WINOGRAD_BATCH_TILES / tiles;
+    if (group < 1)
+        group = 1;
+    if (group > batch)
+        group = batch;
+    return group;
+}
+
+size_t winograd_workspace_size(int tile, int outw, int outh, int inch,
+                               int outch, int batch) {
+    int alpha = tile + 2;
+    size_t tiles = (size_t)((outw + tile - 1) / tile) * ((outh + tile - 1) / tile);
+    tiles *= winograd_batch_group(tile, outw, outh, batch);
+    return (size_t)alpha * alpha * tiles * (inch + outch);
+}
+
+/**
+ * @brief  权重变换 U = G g G^T
+ * @note   变换后的布局为 [alpha*alpha][outch][inch]
+ */
+void winograd_transform_weights(int tile, const float *weights,
+                                float *transformed, int outch, int inch) {
+    const float *g = (4 == tile) ? winograd_f4_g : winograd_f2_g;
+    int alpha = tile + 2;
+    int oc, ic, i, j, k;
+    for (oc = 0; oc < outch; oc++) {
+        for (ic = 0; ic < inch; ic++) {
+            const float *kernel = weights + (oc * inch + ic) * 9;
+            float tmp[WINOGRAD_MAX_ALPHA * 3];
+            for (i = 0; i < alpha; i++) {
+                for (j = 0; j < 3; j++) {
+                    float sum = 0;
+                    for (k = 0; k < 3; k++)
+                        sum += g[i * 3 + k] * kernel[k * 3 + j];
+                    tmp[i * 3 + j] = sum;
+                }
+            }
+            for (i = 0; i < alpha; i++) {
+                for (j = 0; j < alpha; j++) {
+                    float sum = 0;
+                    for (k = 0; k < 3; k++)
+                        sum += tmp[i * 3 + k] * g[j * 3 + k];
+                    transformed[((size_t)(i * alpha + j) * outch + oc) * inch + ic] = sum;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * 一维输入变换 r = B^T d, 按步长读写, 对行和列各做一次即得到 B^T d B
+ */
+static inline void winograd_input_1d(int tile, const float *d, int ds, float *r,
+                                     int rs) {
+    if (4 == tile) {
+        float d0 = d[0], d1 = d[ds], d2 = d[2 * ds];
+        float d3 = d[3 * ds], d4 = d[4 * ds], d5 = d[5 * ds];
+        r[0] = 4 * d0 - 5 * d2 + d4;
+        r[rs] = -4 * (d1 + d2) + d3 + d4;
+        r[2 * rs] = 4 * (d1 - d2) - d3 + d4;
+        r[3 * rs] = 2 * (d3 - d1) - d2 + d4;
+        r[4 * rs] = 2 * (d1 - d3) - d2 + d4;
+        r[5 * rs] = 4 * d1 - 5 * d3 + d5;
+    } else {
+        float d0 = d[0], d1 = d[ds], d2 = d[2 * ds], d3 = d[3 * ds];
+        r[0] = d0 - d2;
+        r[rs] = d1 + d2;
+        r[2 * rs] = d2 - d1;
+        r[3 * rs] = d1 - d3;
+    }
+}
+
+/**
+ * 一维输出变换 y = A^T m
+ */
+static inline void winograd_output_1d(int tile, const float *m, int ms, float *y,
+                                      int ys) {
+    if (4 == tile) {
+        float m0 = m[0], m1 = m[ms], m2 = m[2 * ms];
+        float m3 = m[3 * ms], m4 = m[4 * ms], m5 = m[5 * ms];
+        float a = m1 + m2, b = m1 - m2;
+        float c = m3 + m4, e = m3 - m4;
+        y[0] = m0 + a + c;
+        y[ys] = b + 2 * e;
+        y[2 * ys] = a + 4 * c;
+        y[3 * ys] = b + 8 * e + m5;
+    } else {
+        float m0 = m[0], m1 = m[ms], m2 = m[2 * ms], m3 = m[3 * ms];
+        y[0] = m0 + m1 + m2;
+        y[ys] = m1 - m2 - m3;
+    }
+}
+
+/**
+ * 输入变换, 每个任务处理一张图片的一个输入通道, 补边在取块时完成
+ * V 的布局为 [alpha*alpha][inch][images][tiles]
+ */
+static void winograd_input_thread(struct winograd_params *p, size_t image,
+                                  size_t ic) {
+    struct conv_params *conv = p->conv;
+    int alpha = p->alpha;
+    int w = conv->w;
+    int h = conv->h;
+    const float *img = conv->input + ((p->batch + image) * conv->inch + ic) * w * h;
+    float *v = p->v + ic * p->ntiles + image * p->tiles;
+    size_t vstep = (size_t)conv->inch * p->ntiles;
+
+    int th, tw, i, j;
+    for (th = 0; th < p->tiles_h; th++) {
+        for (tw = 0; tw < p->tiles_w; tw++) {
+            float d[WINOGRAD_MAX_ALPHA * WINOGRAD_MAX_ALPHA];
+            float tmp[WINOGRAD_MAX_ALPHA * WINOGRAD_MAX_ALPHA];
+            float r[WINOGRAD_MAX_ALPHA * WINOGRAD_MAX_ALPHA];
+            int y0 = th * p->tile - conv->pad;
+            int x0 = tw * p->tile - conv->pad;
+            if (y0 >= 0 && x0 >= 0 && y0 + alpha <= h && x0 + alpha <= w) {
+                const float *src = img + y0 * w + x0;
+                for (i = 0; i < alpha; i++)
+                    memcpy(d + i * alpha, src + i * w, sizeof(float) * alpha);
+            } else {
+                for (i = 0; i < alpha; i++) {
+                    int y = y0 + i;
+                    for (j = 0; j < alpha; j++) {
+                        int x = x0 + j;
+                        d[i * alpha + j] =
+                            (y >= 0 && y < h && x >= 0 && x < w) ? img[y * w + x] : 0;
+                    }
+                }
+            }
+            for (j = 0; j < alpha; j++)
+                winograd_input_1d(p->tile, d + j, alpha, tmp + j, alpha);
+            for (i = 0; i < alpha; i++)
+                winograd_input_1d(p->tile, tmp + i * alpha, 1, r + i * alpha, 1);
+
+            int t = th * p->tiles_w + tw;
+            for (i = 0; i < alpha * alpha; i++)
+                v[i * vstep + t] = r[i];
+        }
+    }
+}
+
+/**
+ * 逐点矩阵乘法 M[xi][oc][t] = sum_ic U[xi][oc][ic] * V[xi][ic][t]
+ * 每个任务处理一个点 xi 的 WINOGRAD_OUTCH_TILE 个输出通道
+ */
+static void winograd_gemm_thread(struct winograd_params *p, size_t xi,
+                                 size_t block) {
+    struct conv_params *conv = p->conv;
+    int inch = conv->inch;
+    int outch = conv->outch;
+    int tiles = p->ntiles;
+    int oc0 = block * WINOGRAD_OUTCH_TILE;
+    int nn = outch - oc0;
+    if (nn > WINOGRAD_OUTCH_TILE)
+        nn = WINOGRAD_OUTCH_TILE;
+
+    const float *u = conv->winograd_weights + ((size_t)xi * outch + oc0) * inch;
+    const float *v = p->v + (size_t)xi * inch * tiles;
+    float *m = p->m + ((size_t)xi * outch + oc0) * tiles;
+
+    int c, ic, t;
+    for (c = 0; c < nn; c++) {
+        float *mp = m + c * tiles;
+        const float *up = u + c * inch;
+        memset(mp, 0, sizeof(float) * tiles);
+        for (ic = 0; ic < inch; ic++) {
+            const float *vp = v + ic * tiles;
+            float k = up[ic];
+            for (t = 0; t < tiles; t++)
+                mp[t] += k * vp[t];
+        }
+    }
+}
+
+#ifdef SIMD_X86
+static const int winograd_tail_mask[16] = {-1, -1, -1, -1, -1, -1, -1, -1,
+                                           0,  0,  0,  0,  0,  0,  0,  0};
+
+/**
+ * winograd_gemm_thread 的 AVX2/FMA 版本
+ * 寄存器分块: WINOGRAD_OUTCH_TILE 个输出通道 x 16 个块
+ */
+__attribute__((target("avx2,fma")))
+static void winograd_gemm_avx_thread(struct winograd_params *p, size_t xi,
+                                     size_t block) {
+    struct conv_params *conv = p->conv;
+    int inch = conv->inch;
+    int outch = conv->outch;
+    int tiles = p->ntiles;
+    int oc0 = block * WINOGRAD_OUTCH_TILE;
+    int nn = outch - oc0;
+    if (nn > WINOGRAD_OUTCH_TILE)
+        nn = WINOGRAD_OUTCH_TILE;
+
+    const float *u[WINOGRAD_OUTCH_TILE];
+    float *m[WINOGRAD_OUTCH_TILE];
+    int c, ic, t;
+    for (c = 0; c < WINOGRAD_OUTCH_TILE; c++) {
+        int oc = oc0 + (c < nn ? c : nn - 1);
+        u[c] = conv->winograd_weights + ((size_t)xi * outch + oc) * inch;
+        m[c] = p->m + ((size_t)xi * outch + oc) * tiles;
+    }
+    const float *v = p->v + (size_t)xi * inch * tiles;
+
+    for (t = 0; t < tiles; t += 16) {
+        int remain = tiles - t;
+        int r0 = remain < 8 ? remain : 8;
+        int r1 = remain - 8 < 0 ? 0 : (remain - 8 < 8 ? remain - 8 : 8);
+        __m256i mask0 = _mm256_loadu_si256((const __m256i *)(winograd_tail_mask + 8 - r0));
+        __m256i mask1 = _mm256_loadu_si256((const __m256i *)(winograd_tail_mask + 8 - r1));
+
+        __m256 sum0[WINOGRAD_OUTCH_TILE];
+        __m256 sum1[WINOGRAD_OUTCH_TILE];
+        for (c = 0; c < WINOGRAD_OUTCH_TILE; c++) {
+            sum0[c] = _mm256_setzero_ps();
+            sum1[c] = _mm256_setzero_ps();
+        }
+
+        const float *vp = v + t;
+        for (ic = 0; ic < inch; ic++, vp += tiles) {
+            __m256 v0 = _mm256_maskload_ps(vp, mask0);
+            __m256 v1 = _mm256_maskload_ps(vp + 8, mask1);
+            for (c = 0; c < WINOGRAD_OUTCH_TILE; c++) {
+                __m256 k = _mm256_broadcast_ss(u[c] + ic);
+                sum0[c] = _mm256_fmadd_ps(v0, k, sum0[c]);
+                sum1[c] = _mm256_fmadd_ps(v1, k, sum1[c]);
+            }
+        }
+
+        for (c = 0; c < nn; c++) {
+            _mm256_maskstore_ps(m[c] + t, mask0, sum0[c]);
+            _mm256_maskstore_ps(m[c] + t + 8, mask1, sum1[c]);
+        }
+    }
+}
+#endif
+
+/**
+ * 输出变换, 每个任务处理一张图片的一个输出通道, 超出输出大小的部分丢弃
+ */
+static void winograd_output_thread(struct winograd_params *p, size_t image,
+                                   size_t oc) {
+    struct conv_params *conv = p->conv;
+    int alpha = p->alpha;
+    int tile = p->tile;
+    int outw = conv->outw;
+    int outh = conv->outh;
+    float *out = conv->output + ((p->batch + image) * conv->outch + oc) * outw * outh;
+    const float *m = p->m + oc * p->ntiles + image * p->tiles;
+    size_t mstep = (size_t)conv->outch * p->ntiles;
+
+    int th, tw, i, j;
+    for (th = 0; th < p->tiles_h; th++) {
+        for (tw = 0; tw < p->tiles_w; tw++) {
+            int t = th * p->tiles_w + tw;
+            float d[WINOGRAD_MAX_ALPHA * WINOGRAD_MAX_ALPHA];
+            float tmp[WINOGRAD_MAX_ALPHA * WINOGRAD_MAX_ALPHA];
+            float y[WINOGRAD_MAX_ALPHA * WINOGRAD_MAX_ALPHA];
+            for (i = 0; i < alpha * alpha; i++)
+                d[i] = m[i * mstep + t];
+            for (j = 0; j < alpha; j++)
+                winograd_output_1d(tile, d + j, alpha, tmp + j, alpha);
+            for (i = 0; i < tile; i++)
+                winograd_output_1d(tile, tmp + i * alpha, 1, y + i * tile, 1);
+
+            for (i = 0; i < tile; i++) {
+                int oy = th * tile + i;
+                if (oy >= outh)
+                    break;
+                for (j = 0; j < tile; j++) {
+                    int ox = tw * tile + j;
+                    if (ox >= outw)
+                        break;
+                    out[oy * outw + ox] = y[i * tile + j];
+                }
+            }
+        }
+    }
+
+    conv_epilogue_channel(conv, p->batch + image, oc);
+}
+
+/**
+ * @brief  Winograd 3x3 步长1 卷积
+ * @note   使用 params->winograd_weights 中缓存的变换后权重,
+ *         params->workspace 需要 winograd_workspace_size 个浮点数, 其中的 batch
+ *         不小于这里的 batch
+ */
+void conv3x3_winograd(pthreadpool_t threadpool, struct conv_params *params,
+                      size_t batch) {
+    struct winograd_params p;
+    p.conv = params;
+    p.tile = params->winograd;
+    p.alpha = p.tile + 2;
+    p.tiles_w = (params->outw + p.tile - 1) / p.tile;
+    p.tiles_h = (params->outh + p.tile - 1) / p.tile;
+    p.tiles = p.tiles_w * p.tiles_h;
+    int group = winograd_batch_group(p.tile, params->outw, params->outh, batch);
+
+    pthreadpool_function_2d_t gemm =
+        (pthreadpool_function_2d_t)winograd_gemm_thread;
+#ifdef SIMD_X86
+    if (cpu_support_avx2_fma())
+        gemm = (pthreadpool_function_2d_t)winograd_gemm_avx_thread;
+#endif
+
+    size_t blocks =
+        (params->outch + WINOGRAD_OUTCH_TILE - 1) / WINOGRAD_OUTCH_TILE;
+    for (p.batch = 0; p.batch < batch; p.batch += group) {
+        size_t images = batch - p.batch < group ? batch - p.batch : group;
+        p.ntiles = images * p.tiles;
+        p.v = params->workspace;
+        p.m = p.v + (size_t)p.alpha * p.alpha * params->inch * p.ntiles;
+        pthreadpool_compute_2d(threadpool,
+                               (pthreadpool_function_2d_t)winograd_input_thread,
+                               &p, images, params->inch);
+        pthreadpool_compute_2d(threadpool, gemm, &p, p.alpha * p.alpha, blocks);
+        pthreadpool_compute_2d(threadpool,
+                               (pthreadpool_function_2d_t)winograd_output_thread,
+                               &p, images, params->outch);
+    }
+}
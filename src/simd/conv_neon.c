@@ -1,4 +1,10 @@
 #include "conv_neon.h"
+#include "maxpool_neon.h"
+#include "../activations.h"
+
+#ifdef SIMD_X86
+#include <cpuid.h>
+#endif
 
 #define prefetch(x) __builtin_prefetch(x)
 #define PREFETCH_STRIDE 512
@@ -10,29 +16,225 @@ inline void prefetch_range(void *addr, size_t len) {
     prefetch(cp);
 }
 
+static void normalize_active_scalar(float *ptr, int n, float a, float b,
+                                    ACTIVATION act) {
+  int i = 0;
+  switch (act) {
+  case LINEAR:
+    for (; i < n; i++)
+      ptr[i] = b * ptr[i] + a;
+    break;
+  case LEAKY:
+    for (; i < n; i++) {
+      float temp = b * ptr[i] + a;
+      ptr[i] = (temp > 0) ? temp : .1f * temp;
+    }
+    break;
+  case RELU:
+    for (; i < n; i++) {
+      float temp = b * ptr[i] + a;
+      ptr[i] = (temp > 0) ? temp : 0;
+    }
+    break;
+  default:
+    for (; i < n; i++)
+      ptr[i] = activate(b * ptr[i] + a, act);
+    break;
+  }
+}
+
+#ifdef SIMD_X86
+/**
+ * 8 路单精度 exp, 多项式系数取自 Cephes 的 expf, 相对误差约 1e-7
+ * 输入截断到 [-88.38, 88.38]
+ */
+__attribute__((target("avx2,fma")))
+static inline __m256 exp256_ps(__m256 x) {
+  x = _mm256_min_ps(x, _mm256_set1_ps(88.3762626647949f));
+  x = _mm256_max_ps(x, _mm256_set1_ps(-88.3762626647949f));
+
+  /* exp(x) = 2^n * exp(r), n = round(x / ln2), r = x - n * ln2 */
+  __m256 fx = _mm256_fmadd_ps(x, _mm256_set1_ps(1.44269504088896341f),
+                              _mm256_set1_ps(.5f));
+  fx = _mm256_floor_ps(fx);
+  x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(0.693359375f), x);
+  x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(-2.12194440e-4f), x);
+
+  __m256 y = _mm256_set1_ps(1.9875691500E-4f);
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.3981999507E-3f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(8.3334519073E-3f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(4.1665795894E-2f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.6666665459E-1f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(5.0000001201E-1f));
+  y = _mm256_fmadd_ps(y, _mm256_mul_ps(x, x), x);
+  y = _mm256_add_ps(y, _mm256_set1_ps(1.f));
+
+  __m256i n = _mm256_cvttps_epi32(fx);
+  n = _mm256_slli_epi32(_mm256_add_epi32(n, _mm256_set1_epi32(127)), 23);
+  return _mm256_mul_ps(y, _mm256_castsi256_ps(n));
+}
+
+/**
+ * normalize_active_scalar 的 AVX2/FMA 版本
+ * 分段线性的激活函数及 LOGISTIC, LOGGY, TANH, ELU 在寄存器中完成,
+ * 后者使用 exp256_ps, 与 activate 的相对误差在 1e-6 以内
+ * @note STAIR 仍先做向量化的缩放平移, 再逐个调用 activate
+ */
+__attribute__((target("avx2,fma")))
+static void normalize_active_avx(float *ptr, int n, float a, float b,
+                                 ACTIVATION act) {
+  __m256 va = _mm256_set1_ps(a);
+  __m256 vb = _mm256_set1_ps(b);
+  __m256 zero = _mm256_setzero_ps();
+  __m256 one = _mm256_set1_ps(1.f);
+  int i = 0;
+  switch (act) {
+  case LOGISTIC:
+    for (; i + 7 < n; i += 8) {
+      __m256 v = _mm256_fmadd_ps(_mm256_loadu_ps(ptr + i), vb, va);
+      __m256 e = exp256_ps(_mm256_sub_ps(zero, v));
+      _mm256_storeu_ps(ptr + i, _mm256_div_ps(one, _mm256_add_ps(one, e)));
+    }
+    break;
+  case LOGGY: {
+    __m256 two = _mm256_set1_ps(2.f);
+    for (; i + 7 < n; i += 8) {
+      __m256 v = _mm256_fmadd_ps(_mm256_loadu_ps(ptr + i), vb, va);
+      __m256 e = exp256_ps(_mm256_sub_ps(zero, v));
+      _mm256_storeu_ps(
+          ptr + i,
+          _mm256_sub_ps(_mm256_div_ps(two, _mm256_add_ps(one, e)), one));
+    }
+    break;
+  }
+  case TANH: {
+    /* tanh(x) = 2 / (1 + exp(-2x)) - 1, x 很大时不会出现 inf / inf */
+    __m256 two = _mm256_set1_ps(2.f);
+    __m256 mtwo = _mm256_set1_ps(-2.f);
+    for (; i + 7 < n; i += 8) {
+      __m256 v = _mm256_fmadd_ps(_mm256_loadu_ps(ptr + i), vb, va);
+      __m256 e = exp256_ps(_mm256_mul_ps(v, mtwo));
+      _mm256_storeu_ps(
+          ptr + i,
+          _mm256_sub_ps(_mm256_div_ps(two, _mm256_add_ps(one, e)), one));
+    }
+    break;
+  }
+  case ELU:
+    for (; i + 7 < n; i += 8) {
+      __m256 v = _mm256_fmadd_ps(_mm256_loadu_ps(ptr + i), vb, va);
+      __m256 e = _mm256_sub_ps(exp256_ps(v), one);
+      _mm256_storeu_ps(
+          ptr + i, _mm256_blendv_ps(v, e, _mm256_cmp_ps(v, zero, _CMP_LT_OQ)));
+    }
+    break;
+  case HARDTAN: {
+    __m256 mone = _mm256_set1_ps(-1.f);
+    for (; i + 7 < n; i += 8) {
+      __m256 v = _mm256_fmadd_ps(_mm256_loadu_ps(ptr + i), vb, va);
+      _mm256_storeu_ps(ptr + i, _mm256_min_ps(_mm256_max_ps(v, mone), one));
+    }
+    break;
+  }
+  case PLSE: {
+    __m256 lo = _mm256_set1_ps(-4.f);
+    __m256 hi = _mm256_set1_ps(4.f);
+    __m256 slope = _mm256_set1_ps(.01f);
+    __m256 mid = _mm256_set1_ps(.125f);
+    __m256 half = _mm256_set1_ps(.5f);
+    for (; i + 7 < n; i += 8) {
+      __m256 v = _mm256_fmadd_ps(_mm256_loadu_ps(ptr + i), vb, va);
+      __m256 r = _mm256_fmadd_ps(v, mid, half);
+      r = _mm256_blendv_ps(r, _mm256_mul_ps(_mm256_sub_ps(v, lo), slope),
+                           _mm256_cmp_ps(v, lo, _CMP_LT_OQ));
+      r = _mm256_blendv_ps(
+          r, _mm256_fmadd_ps(_mm256_sub_ps(v, hi), slope, one),
+          _mm256_cmp_ps(v, hi, _CMP_GT_OQ));
+      _mm256_storeu_ps(ptr + i, r);
+    }
+    break;
+  }
+  case LHTAN: {
+    __m256 slope = _mm256_set1_ps(.001f);
+    for (; i + 7 < n; i += 8) {
+      __m256 v = _mm256_fmadd_ps(_mm256_loadu_ps(ptr + i), vb, va);
+      __m256 r = _mm256_blendv_ps(v, _mm256_mul_ps(v, slope),
+                                  _mm256_cmp_ps(v, zero, _CMP_LT_OQ));
+      r = _mm256_blendv_ps(
+          r, _mm256_fmadd_ps(_mm256_sub_ps(v, one), slope, one),
+          _mm256_cmp_ps(v, one, _CMP_GT_OQ));
+      _mm256_storeu_ps(ptr + i, r);
+    }
+    break;
+  }
+  case LEAKY: {
+    __m256 slope = _mm256_set1_ps(.1f);
+    for (; i + 7 < n; i += 8) {
+      __m256 v = _mm256_fmadd_ps(_mm256_loadu_ps(ptr + i), vb, va);
+      _mm256_storeu_ps(ptr + i, _mm256_max_ps(v, _mm256_mul_ps(v, slope)));
+    }
+    break;
+  }
+  case RELIE: {
+    __m256 slope = _mm256_set1_ps(.01f);
+    for (; i + 7 < n; i += 8) {
+      __m256 v = _mm256_fmadd_ps(_mm256_loadu_ps(ptr + i), vb, va);
+      _mm256_storeu_ps(ptr + i, _mm256_max_ps(v, _mm256_mul_ps(v, slope)));
+    }
+    break;
+  }
+  case RELU:
+    for (; i + 7 < n; i += 8) {
+      __m256 v = _mm256_fmadd_ps(_mm256_loadu_ps(ptr + i), vb, va);
+      _mm256_storeu_ps(ptr + i, _mm256_max_ps(v, zero));
+    }
+    break;
+  case RAMP: {
+    __m256 slope = _mm256_set1_ps(.1f);
+    for (; i + 7 < n; i += 8) {
+      __m256 v = _mm256_fmadd_ps(_mm256_loadu_ps(ptr + i), vb, va);
+      _mm256_storeu_ps(ptr + i, _mm256_fmadd_ps(v, slope, _mm256_max_ps(v, zero)));
+    }
+    break;
+  }
+  case LINEAR:
+    for (; i + 7 < n; i += 8)
+      _mm256_storeu_ps(ptr + i,
+                       _mm256_fmadd_ps(_mm256_loadu_ps(ptr + i), vb, va));
+    break;
+  default:
+    for (; i + 7 < n; i += 8)
+      _mm256_storeu_ps(ptr + i,
+                       _mm256_fmadd_ps(_mm256_loadu_ps(ptr + i), vb, va));
+    activate_array(ptr, i, act);
+    break;
+  }
+  normalize_active_scalar(ptr + i, n - i, a, b, act);
+}
+#endif
+
 /**
  *  Expand to compute
  *  a = bias - scale * mean / sqrt(var)
  *  b = scale / sqrt(var)
- *  value = b * value + a
+ *  value = activate(b * value + a)
  */
 void normalize_active_cpu_thread(struct normalize_params *params, size_t batch,
                                  size_t filters) {
   float *ptr =
-      params->x + batch * filters * params->spatial + filters * params->spatial;
+      params->x + (batch * params->channels + filters) * params->spatial;
   float a = params->adata[filters];
   float b = params->bdata[filters];
 
-  int remain = params->spatial;
-
   prefetch_range(ptr, params->spatial * 4);
 
-  for (; remain > 0; remain--) {
-    float temp = b * (*ptr) + a;
-    temp = (temp > 0) ? temp : .1 * temp;
-    *ptr = temp;
-    ptr++;
+#ifdef SIMD_X86
+  if (cpu_support_avx2_fma()) {
+    normalize_active_avx(ptr, params->spatial, a, b, params->a);
+    return;
   }
+#endif
+  normalize_active_scalar(ptr, params->spatial, a, b, params->a);
 }
 
 void make_border_row(float *workspace, const float *input, int row, int pad,
@@ -68,37 +270,147 @@ void make_border_data(float *workspace, const float *input, int batch, int pad,
   }
 }
 
-void conv_cpu_inference(pthreadpool_t threadpool, struct conv_params *params,
-                        size_t batch, size_t filters) {
+/**
+ * @brief  检测CPU是否支持 AVX2 及 FMA 指令
+ * @note   通过 CPUID 检测指令集, 并通过 XGETBV 确认系统保存了 YMM 寄存器状态,
+ *         结果只检测一次
+ * @retval 1 支持  0 不支持
+ */
+int cpu_support_avx2_fma() {
+#ifdef SIMD_X86
+  static int support = -1;
+  if (support < 0) {
+    unsigned int eax, ebx, ecx, edx;
+    support = 0;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_OSXSAVE) &&
+        (ecx & bit_AVX) && (ecx & bit_FMA)) {
+      unsigned int xcr0_lo, xcr0_hi;
+      __asm__ volatile("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+      if (6 == (xcr0_lo & 6) && __get_cpuid_max(0, NULL) >= 7) {
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+        support = (ebx & bit_AVX2) ? 1 : 0;
+      }
+    }
+  }
+  return support;
+#else
+  return 0;
+#endif
+}
+
+#ifdef SIMD_X86
+__attribute__((target("avx2,fma")))
+static void conv_epilogue_channel_avx(const struct conv_params *params,
+                                      float *out, int oc, int count) {
+  int i = 0;
+  for (; i + 7 < count; i += 8)
+    _mm256_storeu_ps(out + i,
+                     conv_epilogue_avx(params, oc, _mm256_loadu_ps(out + i)));
+  for (; i < count; i++)
+    out[i] = conv_epilogue(params, oc, out[i]);
+}
+#endif
+
+/**
+ * @brief  对一个输出通道做后处理, 有融合的池化时接着计算该通道的池化
+ * @note   由卷积任务在写完该通道后立即调用, 此时数据仍在缓存中
+ */
+void conv_epilogue_channel(const struct conv_params *params, size_t batch,
+                           int oc) {
+  if (NULL == params->bias)
+    return;
+  int count = params->outw * params->outh;
+  float *out = params->output + (batch * params->outch + oc) * count;
+#ifdef SIMD_X86
+  if (cpu_support_avx2_fma()) {
+    conv_epilogue_channel_avx(params, out, oc, count);
+    conv_pool_channel(params, batch, oc);
+    return;
+  }
+#endif
+  int i = 0;
+  for (; i < count; i++)
+    out[i] = conv_epilogue(params, oc, out[i]);
+  conv_pool_channel(params, batch, oc);
+}
+
+/**
+ * @brief  对一个已完成后处理的输出通道做融合的最大池化
+ * @note   池化的输入即卷积的输出, 在卷积任务内调用时该通道仍在缓存中
+ */
+void conv_pool_channel(const struct conv_params *params, size_t batch, int oc) {
+  const struct maxpool_params *pool = params->pool;
+  if (NULL == pool)
+    return;
+  maxpool_cpu_thread((struct maxpool_params *)pool, batch, oc);
+}
+
+/**
+ * @brief  CPU 推理卷积
+ * @note   params->bias 不为 NULL 且激活函数受支持时, 卷积核在写回输出时完成
+ *         后处理; 否则忽略 scale/bias, 由调用者另行处理
+ * @retval 1 已完成后处理  0 未做后处理
+ */
+int conv_cpu_inference(pthreadpool_t threadpool, struct conv_params *params,
+                       size_t batch, size_t filters) {
   typedef void (*convfunc)(struct conv_params *, size_t, size_t);
   convfunc conv_fun = NULL;
+  size_t tasks = filters;
+  int avx = cpu_support_avx2_fma();
+  if (NULL != params->bias && !conv_epilogue_supported(params->activation))
+    params->bias = NULL;
+  if (NULL == params->bias)
+    params->pool = NULL;
+
+  if (NULL != params->winograd_weights && 3 == params->size &&
+      params->groups == 1 && 1 == params->stride) {
+    conv3x3_winograd(threadpool, params, batch);
+    return NULL != params->bias;
+  }
+  if (NULL != params->conv1x1_weights && 1 == params->size &&
+      params->groups == 1) {
+    /* 按输出通道块及列块分任务, 一个通道的输出分散在多个任务中, 无法融合池化 */
+    params->pool = NULL;
+    conv1x1_gemm(threadpool, params, batch);
+    return NULL != params->bias;
+  }
+
   if (3 == params->size && params->groups == params->inch &&
       params->inch == params->outch && 1 == params->stride) {
     conv_fun = dwconv3x3_s1_cpu;
+#ifdef SIMD_X86
+    if (avx)
+      conv_fun = dwconv3x3_s1_avx;
+#endif
     make_border_data(params->workspace, params->input, batch, params->pad,
                      params->w, params->h, params->inch);
     params->input = params->workspace;
-  } else if (16 == params->outch && 3 == params->size && params->groups == 1 &&
-             1 == params->stride) {
+  } else if (3 == params->size && params->groups == 1 && 1 == params->stride) {
     conv_fun = conv3x3_s1_cpu;
+    tasks = (filters + CONV3X3_S1_OUTCH_TILE - 1) / CONV3X3_S1_OUTCH_TILE;
+#ifdef SIMD_X86
+    if (avx)
+      conv_fun = conv3x3_s1_avx;
+#endif
     make_border_data(params->workspace, params->input, batch, params->pad,
                      params->w, params->h, params->inch);
     params->input = params->workspace;
-  } else if (2 == params->size && params->groups == 1 && 1 == params->stride) {
-    conv_fun = conv1x1_s1_cpu;
   }
 
   if (NULL != conv_fun) {
     pthreadpool_compute_2d(threadpool, (pthreadpool_function_2d_t)conv_fun,
-                           params, batch, filters);
+                           params, batch, tasks);
+    return NULL != params->bias;
   } else 
   {
+    params->pool = NULL;
     struct nnp_size input_size = {params->w, params->h};
     struct nnp_padding input_padding = {params->pad, params->pad, params->pad,
                                         params->pad};
     struct nnp_size kernel_size = {params->size, params->size};
     struct nnp_size stride = {params->stride, params->stride};
     int j;
+    size_t b;
 
     int group_in_ch = params->inch / params->groups;
     int group_out_ch = params->outch / params->groups;
@@ -113,18 +425,23 @@ void conv_cpu_inference(pthreadpool_t threadpool, struct conv_params *params,
       algorithm = nnp_convolution_algorithm_ft8x8;
     }*/
     TIME_BEGIN(nnp_convolution_inference);
-    for (j = 0; j < params->groups; j++) {
-      enum nnp_status status = nnp_convolution_inference(
-          algorithm, nnp_convolution_transform_strategy_tuple_based,
-          group_in_ch, group_out_ch, input_size, input_padding, kernel_size,
-          stride, params->input + j * group_in_step,
-          params->weights + j * group_ksize, NULL,
-          params->output + j * group_out_step, NULL, NULL,
-          nnp_activation_identity, NULL, threadpool, NULL);
-      if (nnp_status_success != status) {
-        printf("error: %d", status);
+    for (b = 0; b < batch; b++) {
+      const float *input = params->input + b * params->groups * group_in_step;
+      float *output = params->output + b * params->groups * group_out_step;
+      for (j = 0; j < params->groups; j++) {
+        enum nnp_status status = nnp_convolution_inference(
+            algorithm, nnp_convolution_transform_strategy_tuple_based,
+            group_in_ch, group_out_ch, input_size, input_padding, kernel_size,
+            stride, input + j * group_in_step,
+            params->weights + j * group_ksize, NULL,
+            output + j * group_out_step, NULL, NULL,
+            nnp_activation_identity, NULL, threadpool, NULL);
+        if (nnp_status_success != status) {
+          printf("error: %d", status);
+        }
       }
     }
     TIME_END(nnp_convolution_inference);
   }
+  return 0;
 }
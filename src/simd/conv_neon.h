@@ -11,18 +11,26 @@ extern "C" {
 #include <nnpack.h>
 #include "../utils.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86 1
+#include <immintrin.h>
+#endif
+
     struct normalize_params {
         float *x;
         float *adata;
         float *bdata;
         int spatial;
         ACTIVATION a;
+        int channels;
     };
 
     void make_border_row(float *workspace, const float *input, int row, int pad, int w, int h);
     void make_border_data(float *workspace, const float *input, int batch, int pad, int w, int h, int c);
     void normalize_active_cpu_thread(struct normalize_params *params, size_t batch, size_t filters);
 
+    struct maxpool_params;
+
     struct conv_params {
         float *input;
         float *output;
@@ -39,15 +47,101 @@ extern "C" {
         int outw;
         int outh;
         int outch;
+        float *winograd_weights;
+        int winograd;
+        /**
+         * 1x1 卷积打包后的权重, 见 conv1x1_gemm_pack_weights
+         */
+        float *conv1x1_weights;
+        /**
+         * 卷积后处理 y = activation(scale[oc] * x + bias[oc]), 在输出仍在寄存器
+         * 或缓存中时完成. scale 为 NULL 时不缩放, bias 为 NULL 时不做后处理
+         */
+        float *scale;
+        float *bias;
+        ACTIVATION activation;
+        /**
+         * 融合的最大池化, 不为 NULL 时卷积任务在完成一个输出通道的后处理后
+         * 立即对该通道做池化, conv_cpu_inference 无法融合时置为 NULL
+         */
+        const struct maxpool_params *pool;
     };
 
+    /**
+     * 后处理融合支持的激活函数, 其余激活函数不在卷积核中融合,
+     * 由 normalize_active_cpu_thread 在卷积完成后按通道处理
+     */
+    static inline int conv_epilogue_supported(ACTIVATION a) {
+        return LINEAR == a || RELU == a || LEAKY == a;
+    }
+
+    static inline float conv_epilogue(const struct conv_params *params, int oc, float x) {
+        if (NULL != params->scale)
+            x *= params->scale[oc];
+        x += params->bias[oc];
+        if (LEAKY == params->activation)
+            return (x > 0) ? x : .1f * x;
+        if (RELU == params->activation)
+            return (x > 0) ? x : 0;
+        return x;
+    }
+
+#ifdef SIMD_X86
+    __attribute__((target("avx2,fma")))
+    static inline __m256 conv_epilogue_avx(const struct conv_params *params, int oc, __m256 x) {
+        __m256 bias = _mm256_set1_ps(params->bias[oc]);
+        if (NULL != params->scale)
+            x = _mm256_fmadd_ps(x, _mm256_set1_ps(params->scale[oc]), bias);
+        else
+            x = _mm256_add_ps(x, bias);
+        if (LEAKY == params->activation)
+            return _mm256_max_ps(x, _mm256_mul_ps(x, _mm256_set1_ps(.1f)));
+        if (RELU == params->activation)
+            return _mm256_max_ps(x, _mm256_setzero_ps());
+        return x;
+    }
+#endif
+
+    /**
+     * conv3x3_s1 每个任务计算的输出通道数
+     */
+#define CONV3X3_S1_OUTCH_TILE 4
+
     void prefetch_range(void *addr, size_t len);
-    void conv_cpu_inference(pthreadpool_t threadpool, struct conv_params *params, size_t batch, size_t filters);
+    void conv_epilogue_channel(const struct conv_params *params, size_t batch, int oc);
+    void conv_pool_channel(const struct conv_params *params, size_t batch, int oc);
+    int conv_cpu_inference(pthreadpool_t threadpool, struct conv_params *params, size_t batch, size_t filters);
     void conv1x1_s1_cpu(struct conv_params *params, size_t batch, size_t filters);
-    void conv3x3_s1_cpu(struct conv_params *params, size_t batch, size_t filters);
+    void conv3x3_s1_cpu(struct conv_params *params, size_t batch, size_t tile);
     void dwconv3x3_s1_workspace(struct conv_params *params, size_t batch, size_t filters);
     void dwconv3x3_s1_cpu(struct conv_params *params, size_t batch, size_t filters);
 
+    /**
+     * Winograd F(2x2,3x3) / F(4x4,3x3) 卷积, 权重在加载时变换并缓存在层中
+     */
+    int winograd_tile_size(int size, int stride, int groups, int inch, int outw, int outh);
+    size_t winograd_weights_size(int tile, int outch, int inch);
+    size_t winograd_workspace_size(int tile, int outw, int outh, int inch, int outch, int batch);
+    void winograd_transform_weights(int tile, const float *weights, float *transformed, int outch, int inch);
+    void conv3x3_winograd(pthreadpool_t threadpool, struct conv_params *params, size_t batch);
+
+    /**
+     * 1x1 卷积按分块矩阵乘法计算, 支持步长 2, 权重在加载时打包并缓存在层中
+     */
+    size_t conv1x1_gemm_workspace_size(int outw, int outh, int inch);
+    size_t conv1x1_gemm_weights_size(int outch, int inch);
+    void conv1x1_gemm_pack_weights(const float *weights, float *packed, int outch, int inch);
+    void conv1x1_gemm(pthreadpool_t threadpool, struct conv_params *params, size_t batch);
+
+    /**
+     * x86 AVX2/FMA 实现, 运行时通过 CPUID 检测后由 conv_cpu_inference 选用
+     */
+    int cpu_support_avx2_fma();
+#ifdef SIMD_X86
+    void conv3x3_s1_avx(struct conv_params *params, size_t batch, size_t tile);
+    void dwconv3x3_s1_avx(struct conv_params *params, size_t batch, size_t filters);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,155 @@
+#include "conv_neon.h"
+
+#ifdef SIMD_X86
+#include <immintrin.h>
+
+/**
+ * dwconv3x3_s1_cpu 的 AVX2/FMA 版本
+ * 输入为 make_border_data 补边后的数据, 每个任务计算一个通道
+ */
+__attribute__((target("avx2,fma")))
+void dwconv3x3_s1_avx(struct conv_params *params, size_t batch, size_t filters)
+{
+    int w = params->w;
+    int h = params->h;
+    int inch = params->inch;
+    int pad = params->pad;
+    int pad_w = w + 2 * pad;
+    int pad_h = h + 2 * pad;
+
+    int outw = params->outw;
+    int outh = params->outh;
+    int outch = params->outch;
+    const float *kernel = params->weights;
+
+    float *out = params->output + batch * (outw * outh * outch) + filters * (outw * outh);
+
+    const float *img0 = params->input + (inch * batch + filters) * pad_w * pad_h;
+    float *outptr = out;
+    float *outptr2 = outptr + outw;
+    const float *kernel0 = kernel + filters * 9;
+
+    const float *r0 = img0;
+    const float *r1 = img0 + pad_w;
+    const float *r2 = img0 + pad_w * 2;
+    const float *r3 = img0 + pad_w * 3;
+
+    const float *k0 = kernel0;
+    const float *k1 = kernel0 + 3;
+    const float *k2 = kernel0 + 6;
+
+    __m256 k00 = _mm256_broadcast_ss(k0 + 0);
+    __m256 k01 = _mm256_broadcast_ss(k0 + 1);
+    __m256 k02 = _mm256_broadcast_ss(k0 + 2);
+    __m256 k10 = _mm256_broadcast_ss(k1 + 0);
+    __m256 k11 = _mm256_broadcast_ss(k1 + 1);
+    __m256 k12 = _mm256_broadcast_ss(k1 + 2);
+    __m256 k20 = _mm256_broadcast_ss(k2 + 0);
+    __m256 k21 = _mm256_broadcast_ss(k2 + 1);
+    __m256 k22 = _mm256_broadcast_ss(k2 + 2);
+
+    int i = 0;
+    for (; i + 1 < outh; i += 2)
+    {
+        int j = 0;
+        for (; j + 7 < outw; j += 8)
+        {
+            __m256 v0 = _mm256_loadu_ps(r0 + j);
+            __m256 v1 = _mm256_loadu_ps(r0 + j + 1);
+            __m256 v2 = _mm256_loadu_ps(r0 + j + 2);
+            __m256 sum = _mm256_mul_ps(v0, k00);
+            sum = _mm256_fmadd_ps(v1, k01, sum);
+            sum = _mm256_fmadd_ps(v2, k02, sum);
+
+            v0 = _mm256_loadu_ps(r1 + j);
+            v1 = _mm256_loadu_ps(r1 + j + 1);
+            v2 = _mm256_loadu_ps(r1 + j + 2);
+            sum = _mm256_fmadd_ps(v0, k10, sum);
+            sum = _mm256_fmadd_ps(v1, k11, sum);
+            sum = _mm256_fmadd_ps(v2, k12, sum);
+            __m256 sum2 = _mm256_mul_ps(v0, k00);
+            sum2 = _mm256_fmadd_ps(v1, k01, sum2);
+            sum2 = _mm256_fmadd_ps(v2, k02, sum2);
+
+            v0 = _mm256_loadu_ps(r2 + j);
+            v1 = _mm256_loadu_ps(r2 + j + 1);
+            v2 = _mm256_loadu_ps(r2 + j + 2);
+            sum = _mm256_fmadd_ps(v0, k20, sum);
+            sum = _mm256_fmadd_ps(v1, k21, sum);
+            sum = _mm256_fmadd_ps(v2, k22, sum);
+            sum2 = _mm256_fmadd_ps(v0, k10, sum2);
+            sum2 = _mm256_fmadd_ps(v1, k11, sum2);
+            sum2 = _mm256_fmadd_ps(v2, k12, sum2);
+
+            v0 = _mm256_loadu_ps(r3 + j);
+            v1 = _mm256_loadu_ps(r3 + j + 1);
+            v2 = _mm256_loadu_ps(r3 + j + 2);
+            sum2 = _mm256_fmadd_ps(v0, k20, sum2);
+            sum2 = _mm256_fmadd_ps(v1, k21, sum2);
+            sum2 = _mm256_fmadd_ps(v2, k22, sum2);
+
+            _mm256_storeu_ps(outptr + j, sum);
+            _mm256_storeu_ps(outptr2 + j, sum2);
+        }
+
+        for (; j < outw; j++)
+        {
+            float sum = 0;
+            float sum2 = 0;
+
+            sum += r0[j] * k0[0] + r0[j + 1] * k0[1] + r0[j + 2] * k0[2];
+            sum += r1[j] * k1[0] + r1[j + 1] * k1[1] + r1[j + 2] * k1[2];
+            sum += r2[j] * k2[0] + r2[j + 1] * k2[1] + r2[j + 2] * k2[2];
+
+            sum2 += r1[j] * k0[0] + r1[j + 1] * k0[1] + r1[j + 2] * k0[2];
+            sum2 += r2[j] * k1[0] + r2[j + 1] * k1[1] + r2[j + 2] * k1[2];
+            sum2 += r3[j] * k2[0] + r3[j + 1] * k2[1] + r3[j + 2] * k2[2];
+
+            outptr[j] = sum;
+            outptr2[j] = sum2;
+        }
+
+        r0 += 2 * pad_w;
+        r1 += 2 * pad_w;
+        r2 += 2 * pad_w;
+        r3 += 2 * pad_w;
+
+        outptr += 2 * outw;
+        outptr2 += 2 * outw;
+    }
+
+    for (; i < outh; i++)
+    {
+        int j = 0;
+        for (; j + 7 < outw; j += 8)
+        {
+            __m256 sum = _mm256_mul_ps(_mm256_loadu_ps(r0 + j), k00);
+            sum = _mm256_fmadd_ps(_mm256_loadu_ps(r0 + j + 1), k01, sum);
+            sum = _mm256_fmadd_ps(_mm256_loadu_ps(r0 + j + 2), k02, sum);
+            sum = _mm256_fmadd_ps(_mm256_loadu_ps(r1 + j), k10, sum);
+            sum = _mm256_fmadd_ps(_mm256_loadu_ps(r1 + j + 1), k11, sum);
+            sum = _mm256_fmadd_ps(_mm256_loadu_ps(r1 + j + 2), k12, sum);
+            sum = _mm256_fmadd_ps(_mm256_loadu_ps(r2 + j), k20, sum);
+            sum = _mm256_fmadd_ps(_mm256_loadu_ps(r2 + j + 1), k21, sum);
+            sum = _mm256_fmadd_ps(_mm256_loadu_ps(r2 + j + 2), k22, sum);
+            _mm256_storeu_ps(outptr + j, sum);
+        }
+
+        for (; j < outw; j++)
+        {
+            float sum = 0;
+            sum += r0[j] * k0[0] + r0[j + 1] * k0[1] + r0[j + 2] * k0[2];
+            sum += r1[j] * k1[0] + r1[j + 1] * k1[1] + r1[j + 2] * k1[2];
+            sum += r2[j] * k2[0] + r2[j + 1] * k2[1] + r2[j + 2] * k2[2];
+            outptr[j] = sum;
+        }
+
+        r0 += pad_w;
+        r1 += pad_w;
+        r2 += pad_w;
+        outptr += outw;
+    }
+
+    conv_epilogue_channel(params, batch, filters);
+}
+#endif
@@ -107,4 +107,6 @@ void dwconv3x3_s1_cpu(struct conv_params *params, size_t batch, size_t filters)
         r1 += 2;
         r2 += 2;
     }
+
+    conv_epilogue_channel(params, batch, filters);
 }
\ No newline at end of file
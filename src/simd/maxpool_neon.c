@@ -3,91 +3,171 @@
 #include "conv_neon.h"
 #include "maxpool_neon.h"
 
-void maxpool_cpu_thread(struct maxpool_params *params, size_t batch, size_t filters) {
-    typedef void (*maxpool_func)(struct maxpool_params *, size_t, size_t);
-    maxpool_func maxpool = maxpool_cpu;
-    if (2 == params->size && 2 == params->stride && 0 == params->pad)
-        maxpool = maxpool2x2_s2_cpu;
-    maxpool(params, batch, filters);
-}
+/**
+ * 最大池化按输出行计算: 先对窗口覆盖的有效输入行逐列取最大值, 写入一行按补边
+ * 展开的行缓冲, 补边及超出输入的列固定为 -FLT_MAX; 再在行缓冲上按窗口大小和
+ * 步长做水平方向的最大值, 内层循环不再逐点判断边界.
+ */
 
-void maxpool_cpu(struct maxpool_params *params, size_t batch, size_t filters) {
-    int w = params->w;
-    int h = params->h;
-    int inch = params->inch;
-    int pad = params->pad;
-    int pad_w = w + 2 * pad;
-    int pad_h = h + 2 * pad;
-    int size = params->size;
+/**
+ * 每个任务处理的最少输出像素数, 小特征图时多个通道合并为一个任务
+ */
+#define MAXPOOL_TASK_PIXELS 4096
 
-    int outw = params->outw;
-    int outh = params->outh;
-    int outch = params->outch;
-    int stride = params->stride;
+struct maxpool_task_params {
+    struct maxpool_params *pool;
+    int channels;
+    int block;
+};
+
+static void maxpool_rows_cpu(float *colmax, const float *img, int w, int r0, int r1) {
+    int r, x;
+    memcpy(colmax, img + r0 * w, sizeof(float) * w);
+    for (r = r0 + 1; r < r1; r++) {
+        const float *row = img + r * w;
+        for (x = 0; x < w; x++)
+            colmax[x] = colmax[x] > row[x] ? colmax[x] : row[x];
+    }
+}
 
+static void maxpool_window_cpu(const float *colmax, float *out, int outw, int size, int stride) {
+    int j, n;
+    if (2 == size) {
+        for (j = 0; j < outw; j++, colmax += stride)
+            out[j] = colmax[0] > colmax[1] ? colmax[0] : colmax[1];
+        return;
+    }
+    for (j = 0; j < outw; j++, colmax += stride) {
+        float m = colmax[0];
+        for (n = 1; n < size; n++)
+            m = m > colmax[n] ? m : colmax[n];
+        out[j] = m;
+    }
+}
 
-    const float *img = params->input + (inch * batch + filters) * w * h;
-    float *outptr = params->output + batch * (outw * outh * outch) + filters * (outw * outh);
-    prefetch_range(img, w * h * 4);
-    prefetch_range(outptr, outw * outh * 4);
-    int i = 0, j = 0;
-    for (i = 0; i < outh; i++) {
-        for (j = 0; j < outw; j++) {
-            *outptr = -FLT_MAX;
-            int m = 0, n = 0;
-            for (m = 0; m < size; m++) {
-                for (n = 0; n < size; n++) {
-                    int cur_h = i * stride + m - pad;
-                    int cur_w = j * stride + n - pad;
-                    int valid = (cur_h >= 0 && cur_h < h && cur_w >= 0 && cur_w < w);
-                    float *indata = img + cur_h * w + cur_w;
-                    float val = (valid != 0) ? (*indata) : -FLT_MAX;
-                    *outptr = MAX(*outptr, val);
-                }
-            }
-            outptr++;
+#ifdef SIMD_X86
+__attribute__((target("avx2,fma")))
+static void maxpool_rows_avx(float *colmax, const float *img, int w, int r0, int r1) {
+    int r, x;
+    memcpy(colmax, img + r0 * w, sizeof(float) * w);
+    for (r = r0 + 1; r < r1; r++) {
+        const float *row = img + r * w;
+        for (x = 0; x + 7 < w; x += 8)
+            _mm256_storeu_ps(colmax + x, _mm256_max_ps(_mm256_loadu_ps(colmax + x),
+                                                       _mm256_loadu_ps(row + x)));
+        for (; x < w; x++)
+            colmax[x] = colmax[x] > row[x] ? colmax[x] : row[x];
+    }
+}
+
+/**
+ * 2x2/s2, 2x2/s1 (tiny-yolo 最后一层) 与 3x3/s1 使用 AVX, 其余窗口使用标量实现
+ */
+__attribute__((target("avx2,fma")))
+static void maxpool_window_avx(const float *colmax, float *out, int outw, int size, int stride) {
+    int j = 0;
+    if (2 == size && 2 == stride) {
+        for (; j + 7 < outw; j += 8) {
+            __m256 a = _mm256_loadu_ps(colmax + 2 * j);
+            __m256 b = _mm256_loadu_ps(colmax + 2 * j + 8);
+            /* 偶数列与奇数列两两取最大值后, 128 位通道交叉导致顺序为 0 1 4 5 2 3 6 7 */
+            __m256 m = _mm256_max_ps(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)),
+                                     _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+            m = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(m),
+                                                       _MM_SHUFFLE(3, 1, 2, 0)));
+            _mm256_storeu_ps(out + j, m);
+        }
+    } else if (2 == size && 1 == stride) {
+        for (; j + 7 < outw; j += 8)
+            _mm256_storeu_ps(out + j, _mm256_max_ps(_mm256_loadu_ps(colmax + j),
+                                                    _mm256_loadu_ps(colmax + j + 1)));
+    } else if (3 == size && 1 == stride) {
+        for (; j + 7 < outw; j += 8) {
+            __m256 m = _mm256_max_ps(_mm256_loadu_ps(colmax + j),
+                                     _mm256_loadu_ps(colmax + j + 1));
+            _mm256_storeu_ps(out + j, _mm256_max_ps(m, _mm256_loadu_ps(colmax + j + 2)));
         }
     }
+    maxpool_window_cpu(colmax + j * stride, out + j, outw - j, size, stride);
 }
+#endif
 
-void maxpool2x2_s2_cpu(struct maxpool_params *params, size_t batch, size_t filters) {
+/**
+ * @brief  计算一个通道的最大池化
+ * @note   窗口起点为 i * stride - pad, 窗口内超出输入的部分不参与计算,
+ *         与 forward_maxpool_layer 的参考实现一致
+ */
+void maxpool_channel(const struct maxpool_params *params, const float *img, float *out) {
     int w = params->w;
     int h = params->h;
-    int inch = params->inch;
     int pad = params->pad;
-    int pad_w = w + 2 * pad;
-    int pad_h = h + 2 * pad;
     int size = params->size;
-
+    int stride = params->stride;
     int outw = params->outw;
     int outh = params->outh;
-    int outch = params->outch;
-    int stride = params->stride;
 
-    const float *img = params->input + (inch * batch + filters) * w * h;
-    float *outptr = params->output + batch * (outw * outh * outch) + filters * (outw * outh);
+    int len = (outw - 1) * stride + size;
+    if (len < pad + w)
+        len = pad + w;
+    float colmax[len];
+    int x, i;
+    for (x = 0; x < len; x++)
+        colmax[x] = -FLT_MAX;
 
-    const float* r0 = img;
-    const float* r1 = img + pad_w;
-
-    int i = 0;
-    for (i = 0; i < outh; i++) {
-        int remain = outw;
-        prefetch_range(r0, w * 4);
-        prefetch_range(r1, w * 4);
-        prefetch_range(outptr, outw * 4);
-        for (; remain > 0; remain--) {
-            float max0 = MAX(r0[0], r0[1]);
-            float max1 = MAX(r1[0], r1[1]);
-            *outptr = MAX(max0, max1);
+    void (*rows)(float *, const float *, int, int, int) = maxpool_rows_cpu;
+    void (*window)(const float *, float *, int, int, int) = maxpool_window_cpu;
+#ifdef SIMD_X86
+    if (cpu_support_avx2_fma()) {
+        rows = maxpool_rows_avx;
+        window = maxpool_window_avx;
+    }
+#endif
 
-            r0 += 2;
-            r1 += 2;
-            outptr++;
+    for (i = 0; i < outh; i++, out += outw) {
+        int r0 = i * stride - pad;
+        int r1 = r0 + size;
+        if (r0 < 0)
+            r0 = 0;
+        if (r1 > h)
+            r1 = h;
+        if (r0 >= r1) {
+            for (x = 0; x < outw; x++)
+                out[x] = -FLT_MAX;
+            continue;
         }
-
-        r0 += pad_w;
-        r1 += pad_w;
+        rows(colmax + pad, img, w, r0, r1);
+        window(colmax, out, outw, size, stride);
     }
 }
 
+void maxpool_cpu_thread(struct maxpool_params *params, size_t batch, size_t filters) {
+    const float *img = params->input + (params->inch * batch + filters) * params->w * params->h;
+    float *out = params->output + (params->outch * batch + filters) * params->outw * params->outh;
+    maxpool_channel(params, img, out);
+}
+
+static void maxpool_block_thread(struct maxpool_task_params *p, size_t batch, size_t block) {
+    int c = block * p->block;
+    int end = c + p->block;
+    if (end > p->channels)
+        end = p->channels;
+    for (; c < end; c++)
+        maxpool_cpu_thread(p->pool, batch, c);
+}
+
+/**
+ * @brief  多线程最大池化
+ * @note   特征图较小时每个任务处理多个通道, 减少任务调度的开销
+ */
+void maxpool_cpu(pthreadpool_t threadpool, struct maxpool_params *params, size_t batch) {
+    struct maxpool_task_params p;
+    p.pool = params;
+    p.channels = params->outch;
+    p.block = MAXPOOL_TASK_PIXELS / (params->outw * params->outh);
+    if (p.block < 1)
+        p.block = 1;
+    if (p.block > p.channels)
+        p.block = p.channels;
+    pthreadpool_compute_2d(threadpool, (pthreadpool_function_2d_t)maxpool_block_thread,
+                           &p, batch, (p.channels + p.block - 1) / p.block);
+}
@@ -8,6 +8,9 @@
 #ifndef MAXPOLL_NEON_H
 #define MAXPOLL_NEON_H
 
+#include <stddef.h>
+#include <pthreadpool.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -28,9 +31,13 @@ extern "C" {
 
     #define MAX(a, b)  (a) > (b) ? (a) : (b);
     #define MIN(a, b)  (a) < (b) ? (a) : (b);
+
+    /**
+     * 计算一个通道的最大池化, img 为该通道输入, out 为该通道输出
+     */
+    void maxpool_channel(const struct maxpool_params *params, const float *img, float *out);
     void maxpool_cpu_thread(struct maxpool_params *params, size_t batch, size_t filters);
-    void maxpool_cpu(struct maxpool_params *params, size_t batch, size_t filters);
-    void maxpool2x2_s2_cpu(struct maxpool_params *params, size_t batch, size_t filters);
+    void maxpool_cpu(pthreadpool_t threadpool, struct maxpool_params *params, size_t batch);
 
 #ifdef __cplusplus
 }
@@ -1,19 +1,47 @@
 #include <darknet.h>
 #include "image.h"
 #include "tools.h"
+#include "object_detect/container_ring_queue.h"
+#ifdef NNPACK
+#include "imgproc/imgproc.h"
+#endif
+
 
+network network_init(const char *cfgfile, const char *weightfile, int threadsize, network_load_mode mode)
+{
+    return network_init_batch(cfgfile, weightfile, threadsize, mode, 1);
+}
 
-network network_init(const char *cfgfile, const char *weightfile, int threadsize)
+network network_init_batch(const char *cfgfile, const char *weightfile, int threadsize, network_load_mode mode, int batch)
 {
-    network net = parse_network_cfg(cfgfile);
+    network net;
+    if (batch < 1)
+        batch = 1;
+    if (NETWORK_LOAD_INFERENCE == mode && weightfile) {
+        net = parse_network_cfg_inference_batch((char *)cfgfile, batch);
+    } else {
+        net = parse_network_cfg(cfgfile);
+        if (batch > net.batch)
+            batch = net.batch;
+    }
     if (weightfile) {
-        load_weights(&net, weightfile);
+        if (NETWORK_LOAD_INFERENCE != mode || !load_packed_weights(&net, (char *)weightfile)) {
+            load_weights(&net, weightfile);
+        }
     }
-    set_batch_network(&net, 1);
+    if (NETWORK_LOAD_INFERENCE == mode && weightfile) {
+        fold_network_batchnorm(&net);
+        fuse_network_maxpool(&net);
+        defer_network_region_activation(&net);
+    }
+    set_batch_network(&net, batch);
+    if (NETWORK_LOAD_INFERENCE == mode && weightfile)
+        plan_network_memory(&net);
 
 #ifdef NNPACK
     nnp_initialize();
     net.threadpool = pthreadpool_create(threadsize);
+    net.resize_plans = resize_plan_cache_create();
 #endif
 
     return  net;
@@ -25,11 +53,35 @@ void network_release(network *net)
     if(NULL != net)
     {
         pthreadpool_destroy(net->threadpool);
+        resize_plan_cache_free(net->resize_plans);
+        net->resize_plans = NULL;
         nnp_deinitialize();
     }
 #endif
 }
 
+int network_context_create(network *net, int threadsize, network *ctx)
+{
+    if (clone_network_context(net, ctx))
+        return 1;
+#ifdef NNPACK
+    ctx->threadpool = pthreadpool_create(threadsize);
+    ctx->resize_plans = resize_plan_cache_create();
+#endif
+    return 0;
+}
+
+void network_context_release(network *ctx)
+{
+    if (NULL == ctx)
+        return;
+#ifdef NNPACK
+    pthreadpool_destroy(ctx->threadpool);
+    resize_plan_cache_free(ctx->resize_plans);
+#endif
+    free_network(*ctx);
+}
+
 image loadimage(char* filename, network *net)
 {
 #ifdef NNPACK
@@ -61,7 +113,8 @@ int detect_object(network * net, image im, float thresh, float hier_thresh,  flo
     gettimeofday(&start, 0);
 
 #ifdef NNPACK
-    image sized = letterbox_image_thread(im, net->w, net->h, net->threadpool);
+    image sized = float_to_image(net->w, net->h, net->c, net->input);
+    letterbox_image_into_thread(im, net->w, net->h, sized, net->resize_plans, net->threadpool);
 #else
     image sized = letterbox_image(im, net->w, net->h);
 #endif
@@ -78,61 +131,442 @@ int detect_object(network * net, image im, float thresh, float hier_thresh,  flo
     //get_region_boxes(l, im.w, im.h, net->w, net->h, thresh, probs, boxes, 0, 0, hier_thresh, 1);
     if (nms) do_nms_obj(boxes, probs, l.w * l.h * l.n, l.classes, nms);
 
+#ifndef NNPACK
     free_image(sized);
+#endif
     gettimeofday(&stop, 0);
     printf("Predicted in %ld ms.\n", (stop.tv_sec * 1000 + stop.tv_usec / 1000) - (start.tv_sec * 1000 + start.tv_usec / 1000));
     fflush( stdout);
     return  0;
 }
 
-void validate_detector(char *datacfg, char *cfgfile, char *weightfile, char *outpath, float thresh, float hier_thresh) {
-    int j;
+int detect_objects_batch(network *net, image *images, int n, float thresh, float nms, object_box_array *detections)
+{
+    layer l = net->layers[net->n - 1];
+    if (l.type != REGION) {
+        fprintf(stderr, "detect_objects_batch: last layer is not a region layer\n");
+        return 1;
+    }
+
+    int i, b;
+    for (i = 0; i < n; i += net->batch) {
+        int count = n - i < net->batch ? n - i : net->batch;
+        for (b = 0; b < count; ++b) {
+            image boxed = float_to_image(net->w, net->h, net->c, net->input + b * net->inputs);
+#ifdef NNPACK
+            letterbox_image_into_thread(images[i + b], net->w, net->h, boxed, net->resize_plans, net->threadpool);
+#else
+            fill_image(boxed, .5);
+            letterbox_image_into(images[i + b], net->w, net->h, boxed);
+#endif
+        }
+
+        network_predict(*net, net->input);
+
+        for (b = 0; b < count; ++b) {
+            layer lb = l;
+            lb.output = l.output + b * l.outputs;
+            correct_param param = create_correct_param(images[i + b].w, images[i + b].h, net->w, net->h);
+            parse_object_boxs_array(lb, param, thresh, nms, detections + i + b);
+        }
+    }
+    return 0;
+}
+
+int detect_objects_file(network *net, char *filename, float thresh, float nms, object_box_array *boxes)
+{
+    layer l = net->layers[net->n - 1];
+    if (l.type != REGION) {
+        fprintf(stderr, "detect_objects_file: last layer is not a region layer\n");
+        return 1;
+    }
+
+    int w, h;
+    image boxed = float_to_image(net->w, net->h, net->c, net->input);
+#ifdef NNPACK
+    load_image_letterbox_thread(filename, boxed, &w, &h, net->resize_plans, net->threadpool);
+#else
+    unsigned char *data = load_image_data(filename, &w, &h, net->c);
+    letterbox_image_data_into(data, w, h, net->c, boxed);
+    free(data);
+#endif
+
+    network_predict(*net, net->input);
+
+    correct_param param = create_correct_param(w, h, net->w, net->h);
+    parse_object_boxs_array(l, param, thresh, nms, boxes);
+    return 0;
+}
+
+#ifdef NNPACK
+int detect_objects_yuv(network *net, const unsigned char *data, int w, int h, YUV_FORMAT format,
+                       float thresh, float nms, object_box_array *boxes)
+{
+    layer l = net->layers[net->n - 1];
+    if (l.type != REGION) {
+        fprintf(stderr, "detect_objects_yuv: last layer is not a region layer\n");
+        return 1;
+    }
+
+    image boxed = float_to_image(net->w, net->h, net->c, net->input);
+    if (letterbox_yuv_into_thread(data, w, h, format, boxed, net->resize_plans, net->threadpool)) {
+        fprintf(stderr, "detect_objects_yuv: unsupported frame size %d x %d\n", w, h);
+        return 1;
+    }
+
+    network_predict(*net, net->input);
+
+    correct_param param = create_correct_param(w, h, net->w, net->h);
+    parse_object_boxs_array(l, param, thresh, nms, boxes);
+    return 0;
+}
+#endif
+
+/**
+ * 流水线中传递的一张图片, data 为解码后的 8 位数据, 直到保存结果后才释放;
+ * sized 取自预分配的网络输入, 推理完成后放回; output 取自预分配的网络输出,
+ * 保存结果后放回
+ */
+typedef struct {
+    int index;
+    unsigned char *data;
+    int w;
+    int h;
+    image *sized;
+    float *output;
+} pipeline_item;
+
+typedef enum {
+    PIPELINE_DECODE,
+    PIPELINE_LETTERBOX,
+    PIPELINE_INFERENCE,
+    PIPELINE_POST,
+    PIPELINE_STAGES
+} pipeline_stage_type;
+
+static const char *pipeline_stage_names[PIPELINE_STAGES] = {"decode", "letterbox", "inference", "post"};
+
+/**
+ * 流水线阶段, in 为空的阶段从图片列表中取任务, out 为空的阶段是最后一个阶段
+ */
+typedef struct {
+    int workers;
+    int active;
+    int items;
+    double busy;
+    ring_queue *in;
+    ring_queue *out;
+    pthread_mutex_t mutex;
+} pipeline_stage;
+
+typedef struct {
+    char **paths;
+    int count;
+    int next;
+    char *outpath;
+    float thresh;
+    float nms;
+    network *net;
+    network *contexts;
+    pipeline_stage stages[PIPELINE_STAGES];
+    ring_queue queues[PIPELINE_STAGES - 1];
+    /* 预分配的网络输入, 空闲的放在 free_sized 中 */
+    image *sized;
+    int sized_count;
+    ring_queue free_sized;
+    /* 预分配的网络输出, 每份 outputs 个数, 空闲的放在 free_outputs 中 */
+    float *outputs;
+    int outputs_count;
+    ring_queue free_outputs;
+} detector_pipeline;
+
+typedef struct {
+    detector_pipeline *pipeline;
+    pipeline_stage_type type;
+    int worker;
+    object_box_array boxes;
+#ifdef NNPACK
+    struct resize_plan_cache *plans;
+#endif
+} pipeline_worker_args;
+
+detector_pipeline_config default_detector_pipeline_config()
+{
+    detector_pipeline_config config;
+    config.decode_workers = 2;
+    config.letterbox_workers = 1;
+    config.inference_workers = 1;
+    config.post_workers = 1;
+    config.inference_threads = 4;
+    config.queue_size = 8;
+    return config;
+}
+
+/**
+ * 在解码后的 8 位图片上画出目标框, 颜色与 draw_detections 相同
+ */
+static void draw_object_box_array_data(unsigned char *data, int w, int h, int c,
+                                       const object_box_array *boxes, int classes)
+{
+    int width = h * .006;
+    int i, k, t, x, y;
+    if (width < 1)
+        width = 1;
+    for (i = 0; i < boxes->size; ++i) {
+        int offset = boxes->classid[i] * 123457 % classes;
+        unsigned char rgb[3];
+        for (k = 0; k < 3; ++k)
+            rgb[k] = get_color(2 - k, offset, classes) * 255;
+
+        int left = boxes->x[i];
+        int top = boxes->y[i];
+        int right = boxes->x[i] + boxes->w[i];
+        int bot = boxes->y[i] + boxes->h[i];
+        left = left < 0 ? 0 : left;
+        top = top < 0 ? 0 : top;
+        right = right > w - 1 ? w - 1 : right;
+        bot = bot > h - 1 ? h - 1 : bot;
+
+        for (t = 0; t < width; ++t) {
+            int x1 = left + t, x2 = right - t, y1 = top + t, y2 = bot - t;
+            if (x1 > x2 || y1 > y2)
+                break;
+            for (x = x1; x <= x2; ++x) {
+                for (k = 0; k < c && k < 3; ++k) {
+                    data[(y1 * w + x) * c + k] = rgb[k];
+                    data[(y2 * w + x) * c + k] = rgb[k];
+                }
+            }
+            for (y = y1; y <= y2; ++y) {
+                for (k = 0; k < c && k < 3; ++k) {
+                    data[(y * w + x1) * c + k] = rgb[k];
+                    data[(y * w + x2) * c + k] = rgb[k];
+                }
+            }
+        }
+    }
+}
+
+static void pipeline_run_item(pipeline_worker_args *args, pipeline_item *item)
+{
+    detector_pipeline *p = args->pipeline;
+    network *net = p->net;
+    layer l = net->layers[net->n - 1];
+    switch (args->type) {
+    case PIPELINE_DECODE:
+        item->data = load_image_data(p->paths[item->index], &item->w, &item->h, net->c);
+        break;
+    case PIPELINE_LETTERBOX:
+        item->sized = (image *)ring_queue_pop(&p->free_sized);
+#ifdef NNPACK
+        /* letterbox 线程之间已经并行, 不再使用线程池 */
+        letterbox_image_data_into_thread(item->data, item->w, item->h, net->c, *item->sized, args->plans, NULL);
+#else
+        letterbox_image_data_into(item->data, item->w, item->h, net->c, *item->sized);
+#endif
+        break;
+    case PIPELINE_INFERENCE: {
+        network *ctx = p->contexts ? p->contexts + args->worker : net;
+        network_predict(*ctx, item->sized->data);
+        item->output = (float *)ring_queue_pop(&p->free_outputs);
+        memcpy(item->output, ctx->layers[ctx->n - 1].output, l.outputs * sizeof(float));
+        ring_queue_push(&p->free_sized, item->sized);
+        item->sized = NULL;
+        break;
+    }
+    case PIPELINE_POST: {
+        char output[512];
+        char *file = strrchr(p->paths[item->index], '/');
+        file = file ? file + 1 : p->paths[item->index];
+        l.output = item->output;
+        correct_param param = create_correct_param(item->w, item->h, net->w, net->h);
+        parse_object_boxs_array(l, param, p->thresh, p->nms, &args->boxes);
+        draw_object_box_array_data(item->data, item->w, item->h, net->c, &args->boxes, l.classes);
+        snprintf(output, sizeof(output), "%s%s", p->outpath, file);
+        save_image_data(item->data, item->w, item->h, net->c, output);
+        free(item->data);
+        ring_queue_push(&p->free_outputs, item->output);
+        item->output = NULL;
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+static void *pipeline_worker(void *ptr)
+{
+    pipeline_worker_args *args = (pipeline_worker_args *)ptr;
+    detector_pipeline *p = args->pipeline;
+    pipeline_stage *stage = p->stages + args->type;
+    double busy = 0;
+    int items = 0;
+    int i;
+
+    for (;;) {
+        pipeline_item *item;
+        if (stage->in) {
+            item = (pipeline_item *)ring_queue_pop(stage->in);
+            if (NULL == item)
+                break;
+        } else {
+            int index = __atomic_fetch_add(&p->next, 1, __ATOMIC_RELAXED);
+            if (index >= p->count)
+                break;
+            item = calloc(1, sizeof(pipeline_item));
+            item->index = index;
+        }
+
+        double start = what_time_is_it_now();
+        pipeline_run_item(args, item);
+        busy += what_time_is_it_now() - start;
+        ++items;
+
+        if (stage->out)
+            ring_queue_push(stage->out, item);
+        else
+            free(item);
+    }
+
+    pthread_mutex_lock(&stage->mutex);
+    stage->busy += busy;
+    stage->items += items;
+    pthread_mutex_unlock(&stage->mutex);
+
+    /* 本阶段最后一个线程结束时, 通知下一阶段的每个线程退出 */
+    if (0 == __atomic_sub_fetch(&stage->active, 1, __ATOMIC_ACQ_REL) && stage->out) {
+        for (i = 0; i < p->stages[args->type + 1].workers; ++i)
+            ring_queue_push(stage->out, NULL);
+    }
+    return 0;
+}
+
+void validate_detector_pipeline(char *datacfg, char *cfgfile, char *weightfile, char *outpath, float thresh, float nms,
+                                detector_pipeline_config config)
+{
     list *options = read_data_cfg(datacfg);
     char *valid_images = option_find_str(options, "valid", "data/train.list");
-    char *name_list = option_find_str(options, "names", "data/names.list");
-    char **names = get_labels(name_list);
-
-    double start = what_time_is_it_now();
-    float nms = .3;
     list *plist = get_paths(valid_images);
-    char **paths = (char **) list_to_array(plist);
-    int m = plist->size;
-    char buff[256];
-    char *input = buff;
-    char output[256] = {0};
+    int i, j, s;
 
-    image **alphabet = load_alphabet();
-    network net = network_init(cfgfile, weightfile, 4);
-    layer l = net.layers[net.n - 1];
-    box *boxes = calloc(l.w * l.h * l.n, sizeof (box));
-    float **probs = calloc(l.w * l.h * l.n, sizeof (float *));
+    detector_pipeline p = {0};
+    p.paths = (char **) list_to_array(plist);
+    p.count = plist->size;
+    p.outpath = outpath;
+    p.thresh = thresh;
+    p.nms = nms;
 
+    int workers[PIPELINE_STAGES] = {config.decode_workers, config.letterbox_workers,
+                                    config.inference_workers, config.post_workers};
+    network net = network_init(cfgfile, weightfile, config.inference_threads, NETWORK_LOAD_INFERENCE);
+    p.net = &net;
+    if (workers[PIPELINE_INFERENCE] > 1) {
+        p.contexts = calloc(workers[PIPELINE_INFERENCE], sizeof(network));
+        for (i = 0; i < workers[PIPELINE_INFERENCE]; ++i) {
+            if (network_context_create(&net, config.inference_threads, p.contexts + i)) {
+                for (j = 0; j < i; ++j)
+                    network_context_release(p.contexts + j);
+                free(p.contexts);
+                p.contexts = NULL;
+                workers[PIPELINE_INFERENCE] = 1;
+                break;
+            }
+        }
+    }
 
-    int i = 0;
-    for (i = 0; i < m; i++) {
-        strncpy(input, paths[i], 256);
-        strncpy(output, outpath, 256);
-        char*file = rindex(input, '/') + 1;
-        strcat(outpath, file);
+    int total = 0;
+    for (s = 0; s < PIPELINE_STAGES; ++s) {
+        pipeline_stage *stage = p.stages + s;
+        stage->workers = workers[s] > 0 ? workers[s] : 1;
+        stage->active = stage->workers;
+        pthread_mutex_init(&stage->mutex, NULL);
+        if (s + 1 < PIPELINE_STAGES) {
+            p.queues[s] = create_ring_queue(config.queue_size);
+            stage->out = p.queues + s;
+            p.stages[s + 1].in = p.queues + s;
+        }
+        total += stage->workers;
+    }
 
-        image im = loadimage(input, &net);
-        memset(boxes, 0, l.w * l.h * l.n *sizeof (box));
-        memset(probs, 0, l.w * l.h * l.n * sizeof (float *));
+    /* 网络输入最多同时被 letterbox 线程, 推理队列及推理线程持有 */
+    p.sized_count = p.stages[PIPELINE_LETTERBOX].workers + config.queue_size + p.stages[PIPELINE_INFERENCE].workers;
+    p.sized = calloc(p.sized_count, sizeof(image));
+    p.free_sized = create_ring_queue(p.sized_count);
+    for (i = 0; i < p.sized_count; ++i) {
+        p.sized[i] = make_image(net.w, net.h, net.c);
+        ring_queue_push(&p.free_sized, p.sized + i);
+    }
 
-        detect_object(&net, im,  thresh, hier_thresh,  nms,  boxes, probs);
+    /* 网络输出最多同时被推理线程, 后处理队列及后处理线程持有 */
+    int outputs = net.layers[net.n - 1].outputs;
+    p.outputs_count = p.stages[PIPELINE_INFERENCE].workers + config.queue_size + p.stages[PIPELINE_POST].workers;
+    p.outputs = calloc((size_t)p.outputs_count * outputs, sizeof(float));
+    p.free_outputs = create_ring_queue(p.outputs_count);
+    for (i = 0; i < p.outputs_count; ++i)
+        ring_queue_push(&p.free_outputs, p.outputs + (size_t)i * outputs);
 
-        //draw_detections(im, l.w * l.h * l.n, thresh, boxes, probs, names, alphabet, l.classes);
-        save_image(im, output);
+    pthread_t *threads = calloc(total, sizeof(pthread_t));
+    pipeline_worker_args *args = calloc(total, sizeof(pipeline_worker_args));
+    double start = what_time_is_it_now();
+    for (s = 0, i = 0; s < PIPELINE_STAGES; ++s) {
+        for (j = 0; j < p.stages[s].workers; ++j, ++i) {
+            args[i].pipeline = &p;
+            args[i].type = (pipeline_stage_type)s;
+            args[i].worker = j;
+            args[i].boxes = create_object_box_array(0);
+#ifdef NNPACK
+            if (PIPELINE_LETTERBOX == s)
+                args[i].plans = resize_plan_cache_create();
+#endif
+            if (pthread_create(threads + i, 0, pipeline_worker, args + i))
+                error("Thread creation failed");
+        }
+    }
+    for (i = 0; i < total; ++i)
+        pthread_join(threads[i], 0);
+    double wall = what_time_is_it_now() - start;
 
-        free_image(im);
+    for (s = 0; s < PIPELINE_STAGES; ++s) {
+        pipeline_stage *stage = p.stages + s;
+        fprintf(stderr, "%-10s %2d workers %6d images, busy %8.2f s, %8.2f images/s\n",
+                pipeline_stage_names[s], stage->workers, stage->items, stage->busy,
+                stage->busy > 0 ? stage->items * stage->workers / stage->busy : 0);
+        pthread_mutex_destroy(&stage->mutex);
     }
+    fprintf(stderr, "Total Detection Time: %f Seconds, %.2f images/s\n", wall, p.count / wall);
 
-    fprintf(stderr, "Total Detection Time: %f Seconds\n", (double) (time(0) - start));
-    free(boxes);
-    free_ptrs((void **) probs, l.w * l.h * l.n);
+    for (i = 0; i < total; ++i) {
+        free_object_box_array(&args[i].boxes);
+#ifdef NNPACK
+        if (args[i].plans)
+            resize_plan_cache_free(args[i].plans);
+#endif
+    }
+    free(args);
+    free(threads);
+    for (s = 0; s + 1 < PIPELINE_STAGES; ++s)
+        free_ring_queue(p.queues + s);
+    for (i = 0; i < p.sized_count; ++i)
+        free_image(p.sized[i]);
+    free(p.sized);
+    free_ring_queue(&p.free_sized);
+    free(p.outputs);
+    free_ring_queue(&p.free_outputs);
+    if (p.contexts) {
+        for (i = 0; i < workers[PIPELINE_INFERENCE]; ++i)
+            network_context_release(p.contexts + i);
+        free(p.contexts);
+    }
+    free(p.paths);
+    free_list_contents(plist);
+    free_list(plist);
     network_release(&net);
 }
 
+void validate_detector(char *datacfg, char *cfgfile, char *weightfile, char *outpath, float thresh) {
+    validate_detector_pipeline(datacfg, cfgfile, weightfile, outpath, thresh, .3, default_detector_pipeline_config());
+}
+
 void test_detector(char *datacfg, char *cfgfile, char *weightfile, char *filename, float thresh, float hier_thresh, char *outfile) {
     list *options = read_data_cfg(datacfg);
     char *name_list = option_find_str(options, "names", "data/names.list");
@@ -143,7 +577,7 @@ void test_detector(char *datacfg, char *cfgfile, char *weightfile, char *filenam
     char *input = buff;
     float nms = .4;
     image **alphabet = load_alphabet();
-    network net = network_init(cfgfile, weightfile, 4);
+    network net = network_init(cfgfile, weightfile, 4, NETWORK_LOAD_INFERENCE);
     layer l = net.layers[net.n - 1];
     box *boxes = calloc(l.w * l.h * l.n, sizeof (box));
     float **probs = calloc(l.w * l.h * l.n, sizeof (float *));
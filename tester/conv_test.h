@@ -13,7 +13,9 @@ extern "C" {
 #endif
 
     void test_1x1_convolutional_layer();
+    void test_1x1_stride2_convolutional_layer();
     void test_depthwise_convolutional_layer();
+    void test_3x3_convolutional_layer();
 #ifdef __cplusplus
 }
 #endif